@@ -7,11 +7,102 @@
 
 #include <time.h>
 #include <sys/time.h>
+#include <cmath>
+#include <cassert>
+
+#ifdef USING_PERFOSCOPE_TSC
+#if !defined(__x86_64__) && !defined(__i386__)
+#error "USING_PERFOSCOPE_TSC requires an x86 processor"
+#endif
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif // USING_PERFOSCOPE_TSC
+
+#define PERFOSCOPE_LIKELY(x) __builtin_expect(!!(x), 1)
+#define PERFOSCOPE_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#define PERFOSCOPE_COLD __attribute__((noinline, cold))
+
+#define PERFOSCOPE_CACHE_LINE 64
+
+// Error check of the inline hot path, fail is only evaluated if cond does 
+// not hold. With USING_PERFOSCOPE_ASSERT the check is an assertion, so that 
+// it is removed by NDEBUG.
+#ifdef USING_PERFOSCOPE_ASSERT
+#define PERFOSCOPE_CHECK(cond, fail) assert(cond)
+#else // USING_PERFOSCOPE_ASSERT
+#define PERFOSCOPE_CHECK(cond, fail) do { if(PERFOSCOPE_UNLIKELY(!(cond))) { fail; } } while(0)
+#endif // USING_PERFOSCOPE_ASSERT
 
 namespace perfoscope_internal {
 
+// 64 bit FNV-1a hash of a string, used at compile time by PERFOSCOPE_REGION
+constexpr unsigned long long fnv1a(const char *s, unsigned long long hash = 14695981039346656037ULL) {
+  return (*s == '\0' ? hash : fnv1a(s+1, (hash ^ (unsigned char)(*s))*1099511628211ULL));
+}
+
+#ifdef USING_PERFOSCOPE_TSC
+// Real time is read from the time stamp counter if the processor has an 
+// invariant TSC and from CLOCK_MONOTONIC in nanoseconds otherwise, 
+// calibrate_real_time (called by PerfoscopeUtil::init) decides and measures 
+// the TSC frequency against CLOCK_MONOTONIC.
+typedef long long real_time_t;
+
+extern bool tsc_enabled;
+extern double seconds_per_tick;
+extern long long tsc_base_ticks;
+extern long long tsc_base_nanoseconds;
+
+void calibrate_real_time();
+
+inline bool has_invariant_tsc() {
+  unsigned int eax, ebx, ecx, edx;
+  if(__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007) {
+    return false;
+  }
+  __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+  return (edx & (1u << 8)) != 0;
+}
+
+inline long long monotonic_nanoseconds() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)(ts.tv_sec)*1000000000LL + (long long)(ts.tv_nsec);
+}
+
+inline double difftime(const real_time_t end, const real_time_t start) {
+  return double(end - start)*seconds_per_tick;
+}
+
+inline long long elapsed_ticks(const real_time_t end, const real_time_t start) {
+  return end - start;
+}
+
+inline double ticks_to_seconds(const long long ticks) {
+  return double(ticks)*seconds_per_tick;
+}
+
+inline long long ticks_to_nanoseconds(const long long ticks) {
+  return (tsc_enabled ? (long long)(double(ticks)*seconds_per_tick*1e9) : ticks);
+}
+
+inline real_time_t get_real_time() {
+  if(tsc_enabled) {
+    return (long long)__rdtsc();
+  }
+  return monotonic_nanoseconds();
+}
+
+inline long long nanoseconds(const real_time_t t) {
+  if(tsc_enabled) {
+    return tsc_base_nanoseconds + (long long)(double(t - tsc_base_ticks)*seconds_per_tick*1e9);
+  }
+  return t;
+}
+#else // USING_PERFOSCOPE_TSC
 typedef timespec real_time_t;
 
+inline void calibrate_real_time() {}
+
 inline double difftime(const timespec &end, const timespec &start) {
 //  time_t sec = end.tv_sec - start.tv_sec;
 //  long nsec = end.tv_nsec - start.tv_nsec;
@@ -27,12 +118,119 @@ inline double difftime(const timespec &end, const timespec &start) {
   return double(result.tv_sec)+double(result.tv_nsec)*1e-9;
 }
 
+// Elapsed real time is accumulated in integer ticks, nanoseconds here and 
+// TSC cycles with USING_PERFOSCOPE_TSC, and converted to seconds for output.
+inline long long elapsed_ticks(const timespec &end, const timespec &start) {
+  return (long long)(end.tv_sec - start.tv_sec)*1000000000LL + (long long)(end.tv_nsec - start.tv_nsec);
+}
+
+inline double ticks_to_seconds(const long long ticks) {
+  return double(ticks)*1e-9;
+}
+
+inline long long ticks_to_nanoseconds(const long long ticks) {
+  return ticks;
+}
+
 inline real_time_t get_real_time() {
   timespec ts;
   clock_gettime(CLOCK_MONOTONIC, &ts);
   return ts;
 }
 
+inline long long nanoseconds(const timespec &t) {
+  return (long long)(t.tv_sec)*1000000000LL + (long long)(t.tv_nsec);
+}
+#endif // USING_PERFOSCOPE_TSC
+
+// Log-linear histogram buckets for non-negative values, bucket 0 holds zero 
+// (and anything below the smallest bucket), every power of two in 
+// [2^log_histogram_exponent_min, 2^log_histogram_exponent_max) is split into 
+// log_histogram_subbuckets linear sub-buckets. Histograms over the same 
+// buckets merge by adding counts.
+const int log_histogram_exponent_min = -32;
+const int log_histogram_exponent_max = 48;
+const int log_histogram_subbuckets = 8;
+const int log_histogram_size = 1 + 
+  (log_histogram_exponent_max - log_histogram_exponent_min)*log_histogram_subbuckets;
+
+inline int log_histogram_bucket(double value) {
+  if(!(value > 0.0)) {
+    return 0;
+  }
+  int exponent;
+  double mantissa = std::frexp(value, &exponent);
+  if(exponent <= log_histogram_exponent_min) {
+    return 0;
+  }
+  if(exponent > log_histogram_exponent_max) {
+    return log_histogram_size-1;
+  }
+  int sub = int((2.0*mantissa - 1.0)*log_histogram_subbuckets);
+  return 1 + (exponent - 1 - log_histogram_exponent_min)*log_histogram_subbuckets + sub;
+}
+
+inline double log_histogram_lower(int bucket) {
+  if(bucket <= 0) {
+    return 0.0;
+  }
+  int exponent = (bucket-1)/log_histogram_subbuckets + log_histogram_exponent_min;
+  int sub = (bucket-1)%log_histogram_subbuckets;
+  return std::ldexp(1.0 + double(sub)/log_histogram_subbuckets, exponent);
+}
+
+inline double log_histogram_upper(int bucket) {
+  return (bucket == 0 ? log_histogram_lower(1) : log_histogram_lower(bucket+1));
+}
+
+// Log-linear histogram buckets for durations in nanoseconds, computed with 
+// integer operations only. Durations below duration_histogram_subbuckets 
+// have a bucket each, every power of two above is split into 
+// duration_histogram_subbuckets linear sub-buckets, so a bucket is at most 
+// 1/8 of its lower bound wide. Histograms merge by adding counts.
+const int duration_histogram_subbucket_bits = 3;
+const int duration_histogram_subbuckets = 1 << duration_histogram_subbucket_bits;
+const int duration_histogram_size = (64 - duration_histogram_subbucket_bits)*duration_histogram_subbuckets;
+
+inline int duration_histogram_bucket(long long nanoseconds) {
+  if(nanoseconds < duration_histogram_subbuckets) {
+    return (nanoseconds < 0 ? 0 : int(nanoseconds));
+  }
+  const int exponent = 63 - __builtin_clzll((unsigned long long)nanoseconds);
+  const int shift = exponent - duration_histogram_subbucket_bits;
+  return ((shift+1) << duration_histogram_subbucket_bits) + 
+    int((nanoseconds >> shift) & (duration_histogram_subbuckets-1));
+}
+
+inline double duration_histogram_lower(int bucket) {
+  if(bucket < duration_histogram_subbuckets) {
+    return double(bucket);
+  }
+  const int shift = (bucket >> duration_histogram_subbucket_bits) - 1;
+  const int sub = bucket & (duration_histogram_subbuckets-1);
+  return std::ldexp(double(duration_histogram_subbuckets + sub), shift);
+}
+
+inline double duration_histogram_upper(int bucket) {
+  return duration_histogram_lower(bucket+1);
+}
+
+// Quantile q of the durations of a histogram, the midpoint of the bucket 
+// that holds it clamped to [min, max]
+inline double duration_histogram_quantile(const long long *histogram, long long count, 
+    double min, double max, double q) {
+  const double target = q*double(count);
+  long long cumulative = 0;
+  for(int bi = 0; bi < duration_histogram_size; ++bi) {
+    cumulative += histogram[bi];
+    if(double(cumulative) >= target && histogram[bi] > 0) {
+      double value = 0.5*(duration_histogram_lower(bi) + duration_histogram_upper(bi));
+      return (value < min ? min : (value > max ? max : value));
+    }
+  }
+  return max;
+}
+
 inline int iproc() {
 #ifdef USING_MPIC
   int ip;
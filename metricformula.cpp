@@ -0,0 +1,201 @@
+#include "metricformula.hpp"
+
+#include <cctype>
+#include <cstdlib>
+
+static void skip_space(const char *&pos) {
+  while(std::isspace(static_cast<unsigned char>(*pos))) {
+    ++pos;
+  }
+}
+
+static bool is_name_char(char c) {
+  return (std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == ':' || c == '.');
+}
+
+int MetricFormula::parse(const std::string &formula) {
+  m_formula = formula;
+  m_variables.clear();
+  m_program.clear();
+  m_stack_size = 0;
+  
+  const char *pos = m_formula.c_str();
+  int depth = 0;
+  bool valid = parse_expression(pos, depth);
+  skip_space(pos);
+  if(!valid || *pos != '\0' || m_stack_size > s_max_stack_size) {
+    m_variables.clear();
+    m_program.clear();
+    return int(pos - m_formula.c_str()) + 1;
+  }
+  
+  return 0;
+}
+
+bool MetricFormula::bind(const std::vector<std::string> &names, std::vector<int> &columns) const {
+  columns.assign(m_variables.size(), -1);
+  for(size_t vi = 0; vi < m_variables.size(); ++vi) {
+    for(size_t ni = 0; ni < names.size() && columns[vi] < 0; ++ni) {
+      if(names[ni] == m_variables[vi]) {
+        columns[vi] = ni;
+      }
+    }
+    if(columns[vi] < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+double MetricFormula::evaluate(const double *values, const int *columns) const {
+  double stack[s_max_stack_size];
+  int top = -1;
+  
+  for(size_t oi = 0; oi < m_program.size(); ++oi) {
+    const Op &op = m_program[oi];
+    switch(op.code) {
+      case PUSH_CONSTANT:
+        stack[++top] = op.constant;
+        break;
+      case PUSH_VARIABLE:
+        stack[++top] = values[columns[op.variable]];
+        break;
+      case ADD:
+        stack[top-1] += stack[top];
+        --top;
+        break;
+      case SUBTRACT:
+        stack[top-1] -= stack[top];
+        --top;
+        break;
+      case MULTIPLY:
+        stack[top-1] *= stack[top];
+        --top;
+        break;
+      case DIVIDE:
+        stack[top-1] /= stack[top];
+        --top;
+        break;
+      case NEGATE:
+        stack[top] = -stack[top];
+        break;
+    }
+  }
+  
+  return stack[0];
+}
+
+bool MetricFormula::parse_expression(const char *&pos, int &depth) {
+  if(!parse_term(pos, depth)) {
+    return false;
+  }
+  skip_space(pos);
+  while(*pos == '+' || *pos == '-') {
+    const OpCode code = (*pos == '+' ? ADD : SUBTRACT);
+    ++pos;
+    if(!parse_term(pos, depth)) {
+      return false;
+    }
+    emit(code, -1, 0.0, depth);
+    skip_space(pos);
+  }
+  return true;
+}
+
+bool MetricFormula::parse_term(const char *&pos, int &depth) {
+  if(!parse_factor(pos, depth)) {
+    return false;
+  }
+  skip_space(pos);
+  while(*pos == '*' || *pos == '/') {
+    const OpCode code = (*pos == '*' ? MULTIPLY : DIVIDE);
+    ++pos;
+    if(!parse_factor(pos, depth)) {
+      return false;
+    }
+    emit(code, -1, 0.0, depth);
+    skip_space(pos);
+  }
+  return true;
+}
+
+bool MetricFormula::parse_factor(const char *&pos, int &depth) {
+  skip_space(pos);
+  
+  if(*pos == '-') {
+    ++pos;
+    if(!parse_factor(pos, depth)) {
+      return false;
+    }
+    emit(NEGATE, -1, 0.0, depth);
+    return true;
+  }
+  
+  if(*pos == '(') {
+    ++pos;
+    if(!parse_expression(pos, depth)) {
+      return false;
+    }
+    skip_space(pos);
+    if(*pos != ')') {
+      return false;
+    }
+    ++pos;
+    return true;
+  }
+  
+  if(std::isdigit(static_cast<unsigned char>(*pos)) || *pos == '.') {
+    char *end;
+    const double constant = std::strtod(pos, &end);
+    if(end == pos) {
+      return false;
+    }
+    pos = end;
+    emit(PUSH_CONSTANT, -1, constant, depth);
+    return true;
+  }
+  
+  std::string name;
+  if(*pos == '{') {
+    const char *begin = ++pos;
+    while(*pos != '}' && *pos != '\0') {
+      ++pos;
+    }
+    if(*pos != '}' || pos == begin) {
+      return false;
+    }
+    name.assign(begin, pos);
+    ++pos;
+  } else if(std::isalpha(static_cast<unsigned char>(*pos)) || *pos == '_') {
+    const char *begin = pos;
+    while(is_name_char(*pos)) {
+      ++pos;
+    }
+    name.assign(begin, pos);
+  } else {
+    return false;
+  }
+  
+  int variable = 0;
+  while(variable < int(m_variables.size()) && m_variables[variable] != name) {
+    ++variable;
+  }
+  if(variable == int(m_variables.size())) {
+    m_variables.push_back(name);
+  }
+  emit(PUSH_VARIABLE, variable, 0.0, depth);
+  
+  return true;
+}
+
+void MetricFormula::emit(OpCode code, int variable, double constant, int &depth) {
+  m_program.push_back({code, variable, constant});
+  if(code == PUSH_CONSTANT || code == PUSH_VARIABLE) {
+    ++depth;
+  } else if(code != NEGATE) {
+    --depth;
+  }
+  if(depth > m_stack_size) {
+    m_stack_size = depth;
+  }
+}
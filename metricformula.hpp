@@ -0,0 +1,79 @@
+#ifndef _PERFOSCOPE_METRICFORMULA_HPP_
+#define _PERFOSCOPE_METRICFORMULA_HPP_
+
+#include <string>
+#include <vector>
+
+/**---------------------------------------------------------------------------*/
+
+// Arithmetic formula over named variables, e.g. "PAPI_FP_OPS/time/1e9". A
+// formula has numbers, variables, the operators + - * / with the usual
+// precedence, unary minus and parentheses. A variable name starts with a
+// letter or '_' and continues with letters, digits and '_', ':' or '.',
+// other names are written in braces, e.g. "{CPU_CLK_UNHALTED:u=0}". The
+// formula is compiled to a postfix program when it is parsed.
+class MetricFormula {
+public:
+  MetricFormula() : m_stack_size(0) {}
+  
+  // Returns 0 if the formula is valid, else the 1-based position of the
+  // first error in it
+  int parse(const std::string &formula);
+  
+  const std::string & formula() const {
+    return m_formula;
+  }
+  
+  int variables_count() const {
+    return m_variables.size();
+  }
+  
+  const std::string & variable(int vi) const {
+    return m_variables[vi];
+  }
+  
+  // Sets columns[vi] to the index of variable vi in names, returns false if
+  // a variable is not in names
+  bool bind(const std::vector<std::string> &names, std::vector<int> &columns) const;
+  
+  // Evaluates the formula with values[columns[vi]] as the value of
+  // variable vi
+  double evaluate(const double *values, const int *columns) const;
+  
+private:
+  enum OpCode {
+    PUSH_CONSTANT,
+    PUSH_VARIABLE,
+    ADD,
+    SUBTRACT,
+    MULTIPLY,
+    DIVIDE,
+    NEGATE
+  };
+  
+  struct Op {
+    OpCode code;
+    int variable;
+    double constant;
+  };
+  
+  static const int s_max_stack_size = 64;
+  
+  bool parse_expression(const char *&pos, int &depth);
+  
+  bool parse_term(const char *&pos, int &depth);
+  
+  bool parse_factor(const char *&pos, int &depth);
+  
+  void emit(OpCode code, int variable, double constant, int &depth);
+  
+private:
+  std::string m_formula;
+  std::vector<std::string> m_variables;
+  std::vector<Op> m_program;
+  int m_stack_size;
+};
+
+/**---------------------------------------------------------------------------*/
+
+#endif // #ifndef _PERFOSCOPE_METRICFORMULA_HPP_
@@ -0,0 +1,353 @@
+#include "perfoscope.hpp"
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif // _OPENMP
+
+/**---------------------------------------------------------------------------*/
+
+// Measures the overhead per call of the Perfoscope entry points in the
+// configuration the library is built with. Every thread of a run calls an
+// entry point on its own Perfoscope, cycling through the first ncategories
+// categories. With warm caches a sample is the mean of a batch of calls,
+// with cold caches every sample is a single call after the thread wrote a
+// buffer larger than its share of the caches. The entry point "timer"
+// measures the empty loop, the other ones include its overhead. The results
+// are written as CSV, one row per entry point, thread count, category count
+// and cache state. With MPI every process runs the benchmark and the first 
+// one writes its results.
+
+enum BenchEntry {
+  ENTRY_TIMER,
+  ENTRY_ACCUMULATE,
+  ENTRY_BEGIN_END,
+  ENTRY_RESET,
+  ENTRY_START_STOP,
+  ENTRY_COUNT
+};
+
+static const char *s_entry_names[ENTRY_COUNT] = {"timer", "accumulate", "begin+end", "reset", "start+stop"};
+
+// Calls per sample with warm caches
+static const int s_batch = 16;
+static const long long s_max_flush_bytes = 64LL << 20;
+
+struct BenchOptions {
+  int max_threads;
+  std::vector<int> category_counts;
+  int samples;
+  std::vector<std::string> events;
+  const char *dbfilename;
+  const char *output;
+};
+
+static void print_usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-t maxthreads] [-c ncategories,...] [-n samples] "
+    "[-e event,...] [-d dbfile] [-o csvfile]\n", name);
+}
+
+static std::vector<std::string> split_list(const char *list) {
+  std::vector<std::string> items;
+  std::string item;
+  for(const char *pos = list; ; ++pos) {
+    if(*pos == ',' || *pos == '\0') {
+      if(!item.empty()) {
+        items.push_back(item);
+      }
+      item.clear();
+      if(*pos == '\0') {
+        break;
+      }
+    } else {
+      item += *pos;
+    }
+  }
+  return items;
+}
+
+static std::string config_name() {
+  std::string name;
+#ifdef USING_PERFOSCOPE_WCT
+  name += "+WCT";
+#endif // USING_PERFOSCOPE_WCT
+#ifdef USING_PERFOSCOPE_TSC
+  name += "+TSC";
+#endif // USING_PERFOSCOPE_TSC
+#ifdef USING_PERFOSCOPE_HWC
+  name += "+HWC";
+#endif // USING_PERFOSCOPE_HWC
+#ifdef USING_PERFOSCOPE_DBSTORE
+  name += "+DBSTORE";
+#endif // USING_PERFOSCOPE_DBSTORE
+#ifdef USING_PERFOSCOPE_TRACE
+  name += "+TRACE";
+#endif // USING_PERFOSCOPE_TRACE
+#ifdef USING_PERFOSCOPE_SAMPLING
+  name += "+SAMPLING";
+#endif // USING_PERFOSCOPE_SAMPLING
+#ifdef USING_PERFOSCOPE_ASSERT
+  name += "+ASSERT";
+#endif // USING_PERFOSCOPE_ASSERT
+  return (name.empty() ? std::string("none") : name.substr(1));
+}
+
+static int max_threads_count() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else // _OPENMP
+  return 1;
+#endif // _OPENMP
+}
+
+static long long flush_bytes(const int nthreads) {
+  long long l2_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  long long l3_size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  l2_size = (l2_size > 0 ? l2_size : 1LL << 20);
+  l3_size = (l3_size > 0 ? l3_size : 32LL << 20);
+  const long long bytes = std::max(2*l3_size/nthreads, 4*l2_size);
+  return std::min(bytes, s_max_flush_bytes);
+}
+
+static void flush_caches(std::vector<double> &buffer) {
+  const size_t stride = PERFOSCOPE_CACHE_LINE/sizeof(double);
+  for(size_t i = 0; i < buffer.size(); i += stride) {
+    buffer[i] += 1.0;
+  }
+}
+
+template<typename Call>
+static void measure(Call call, const bool cold, const int ncategories, const int nsamples,
+    std::vector<double> &flush, std::vector<double> &ns) {
+  int ci = 0;
+  
+  if(!cold) {
+    for(int i = 0; i < 16*s_batch; ++i) {
+      call(ci);
+      ci = (ci+1 == ncategories ? 0 : ci+1);
+    }
+  }
+  
+  for(int si = 0; si < nsamples; ++si) {
+    if(cold) {
+      flush_caches(flush);
+    }
+    const int ncalls = (cold ? 1 : s_batch);
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(int i = 0; i < ncalls; ++i) {
+      call(ci);
+      ci = (ci+1 == ncategories ? 0 : ci+1);
+    }
+    const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    ns.push_back(std::chrono::duration<double, std::nano>(end - start).count()/ncalls);
+  }
+}
+
+static void measure_entry(Perfoscope &pscope, const int entry, const bool cold, const int ncategories,
+    const int nsamples, std::vector<double> &flush, std::vector<double> &ns) {
+  switch(entry) {
+    case ENTRY_TIMER:
+      measure([](int) {}, cold, ncategories, nsamples, flush, ns);
+      break;
+    case ENTRY_ACCUMULATE:
+      measure([&pscope](int ci) { pscope.accumulate(ci, __FILE__, __LINE__); },
+        cold, ncategories, nsamples, flush, ns);
+      break;
+    case ENTRY_BEGIN_END:
+      measure([&pscope](int ci) { pscope.begin(ci, __FILE__, __LINE__); pscope.end(__FILE__, __LINE__); },
+        cold, ncategories, nsamples, flush, ns);
+      break;
+    case ENTRY_RESET:
+      measure([&pscope](int) { pscope.reset(__FILE__, __LINE__); },
+        cold, ncategories, nsamples, flush, ns);
+      break;
+    case ENTRY_START_STOP:
+      // The counters run outside of this entry point
+      pscope.stop(__FILE__, __LINE__);
+      measure([&pscope](int ci) { pscope.start(__FILE__, __LINE__); pscope.stop(ci, __FILE__, __LINE__); },
+        cold, ncategories, nsamples, flush, ns);
+      pscope.start(__FILE__, __LINE__);
+      break;
+  }
+}
+
+static void write_row(FILE *out, const int entry, const int nthreads, const int ncategories,
+    const int nevents, const bool cold, std::vector<double> &ns) {
+  std::sort(ns.begin(), ns.end());
+  const size_t count = ns.size();
+  double sum = 0.0;
+  for(size_t i = 0; i < count; ++i) {
+    sum += ns[i];
+  }
+  auto percentile = [&ns, count](int p) {
+    return ns[std::min(count-1, count*p/100)];
+  };
+  
+  fprintf(out, "%s,%s,%d,%d,%d,%s,%zu,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n",
+    config_name().c_str(), s_entry_names[entry], nthreads, ncategories, nevents,
+    (cold ? "cold" : "warm"), count, sum/count, ns.front(), percentile(50),
+    percentile(90), percentile(99), ns.back());
+}
+
+static void run_bench(FILE *out, const PerfoscopeData &tmplt, const int nthreads,
+    const int ncategories, const int nsamples) {
+  const int ncold_samples = std::max(10, nsamples/20);
+  const long long nflush = flush_bytes(nthreads)/sizeof(double);
+  std::vector<std::vector<double> > results(2*ENTRY_COUNT);
+  
+  #pragma omp parallel num_threads(nthreads)
+  {
+#ifdef _OPENMP
+    const int tid = omp_get_thread_num();
+#else // _OPENMP
+    const int tid = 0;
+#endif // _OPENMP
+    PerfoscopeData *data = tmplt.clone(tid);
+    Perfoscope *pscope = new Perfoscope(data);
+    pscope->init(__FILE__, __LINE__);
+    pscope->start(__FILE__, __LINE__);
+    
+    // Allocated and first touched by the thread that flushes with it
+    std::vector<double> flush(nflush, 0.0);
+    std::vector<double> ns;
+    
+    for(int cold = 0; cold < 2; ++cold) {
+      for(int entry = 0; entry < ENTRY_COUNT; ++entry) {
+        ns.clear();
+        #pragma omp barrier
+        measure_entry(*pscope, entry, cold, ncategories, (cold ? ncold_samples : nsamples), flush, ns);
+        #pragma omp critical
+        {
+          std::vector<double> &result = results[cold*ENTRY_COUNT+entry];
+          result.insert(result.end(), ns.begin(), ns.end());
+        }
+      }
+    }
+    
+    pscope->stop(__FILE__, __LINE__);
+    pscope->destroy(__FILE__, __LINE__);
+    delete pscope;
+    delete data;
+  }
+  
+  if(out == nullptr) {
+    return;
+  }
+  for(int cold = 0; cold < 2; ++cold) {
+    for(int entry = 0; entry < ENTRY_COUNT; ++entry) {
+      write_row(out, entry, nthreads, ncategories, tmplt.events_count(), cold,
+        results[cold*ENTRY_COUNT+entry]);
+    }
+  }
+  fflush(out);
+}
+
+int main(int argc, char *argv[]) {
+  BenchOptions options;
+  options.max_threads = max_threads_count();
+  options.category_counts = {1, 16, 256};
+  options.samples = 2000;
+#ifdef USING_PERFOSCOPE_HWC
+  options.events = {"PAPI_TOT_CYC", "PAPI_TOT_INS"};
+#endif // USING_PERFOSCOPE_HWC
+  options.dbfilename = "perfoscope-bench.db";
+  options.output = nullptr;
+  
+  for(int ai = 1; ai < argc; ai += 2) {
+    if(ai+1 >= argc) {
+      print_usage(argv[0]);
+      return 1;
+    }
+    if(std::strcmp(argv[ai], "-t") == 0) {
+      options.max_threads = std::atoi(argv[ai+1]);
+    } else if(std::strcmp(argv[ai], "-c") == 0) {
+      options.category_counts.clear();
+      std::vector<std::string> counts = split_list(argv[ai+1]);
+      for(size_t i = 0; i < counts.size(); ++i) {
+        options.category_counts.push_back(std::atoi(counts[i].c_str()));
+      }
+    } else if(std::strcmp(argv[ai], "-n") == 0) {
+      options.samples = std::atoi(argv[ai+1]);
+    } else if(std::strcmp(argv[ai], "-e") == 0) {
+      options.events = split_list(argv[ai+1]);
+    } else if(std::strcmp(argv[ai], "-d") == 0) {
+      options.dbfilename = argv[ai+1];
+    } else if(std::strcmp(argv[ai], "-o") == 0) {
+      options.output = argv[ai+1];
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  
+  int max_categories = 0;
+  for(size_t i = 0; i < options.category_counts.size(); ++i) {
+    max_categories = std::max(max_categories, options.category_counts[i]);
+  }
+  if(options.max_threads < 1 || max_categories < 1 || options.samples < 1 ||
+      *std::min_element(options.category_counts.begin(), options.category_counts.end()) < 1) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  
+  std::vector<int> thread_counts;
+  for(int nthreads = 1; nthreads < options.max_threads; nthreads *= 2) {
+    thread_counts.push_back(nthreads);
+  }
+  thread_counts.push_back(options.max_threads);
+  
+  std::vector<std::string> category_names(max_categories);
+  std::vector<const char*> categories(max_categories);
+  for(int ci = 0; ci < max_categories; ++ci) {
+    category_names[ci] = "category" + std::to_string(ci);
+    categories[ci] = category_names[ci].c_str();
+  }
+  std::vector<const char*> events(options.events.size());
+  for(size_t ei = 0; ei < options.events.size(); ++ei) {
+    events[ei] = options.events[ei].c_str();
+  }
+  
+#ifdef USING_MPIC
+  MPI_Init(&argc, &argv);
+#endif // USING_MPIC
+  const bool writer = (perfoscope_internal::iproc() == 0);
+  
+  FILE *out = (writer ? stdout : nullptr);
+  if(writer && options.output != nullptr && (out = fopen(options.output, "w")) == nullptr) {
+    fprintf(stderr, "Error opening output file %s\n", options.output);
+    perfoscope_internal::abort(1);
+  }
+  
+  const PerfoscopeData &tmplt = PerfoscopeUtil::init("perfoscope-bench", categories.data(), max_categories,
+    events.data(), events.size(), options.dbfilename, nullptr, __FILE__, __LINE__);
+  
+  if(writer) {
+    fprintf(out, "config,entry,threads,categories,events,caches,samples,"
+      "mean_ns,min_ns,p50_ns,p90_ns,p99_ns,max_ns\n");
+  }
+  for(size_t ti = 0; ti < thread_counts.size(); ++ti) {
+    for(size_t ci = 0; ci < options.category_counts.size(); ++ci) {
+      run_bench(out, tmplt, thread_counts[ti], options.category_counts[ci], options.samples);
+    }
+  }
+  
+  PerfoscopeUtil::finalize(__FILE__, __LINE__);
+  
+  if(out != nullptr && out != stdout) {
+    fclose(out);
+  }
+#ifdef USING_MPIC
+  MPI_Finalize();
+#endif // USING_MPIC
+  
+  return 0;
+}
@@ -0,0 +1,945 @@
+#include <sqlite3.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <tuple>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+/**---------------------------------------------------------------------------*/
+
+// Merges the db shards written with PerfoscopeUtil::STORAGE_SHARD_PER_NODE or
+// STORAGE_SHARD_PER_PROCESS into one db with the perf_profile/perf_run/
+// perf_value schema of the shards. Worker threads read the shards, the main
+// thread writes the merged db in a single transaction. Profiles, categories,
+// events, metric names and machines (by host and build of the roofline 
+// kernels) are matched by name. A run of the shards is identified by 
+// (profile, size, run), all shards of a job hold the same runs, and the
+// merged runs are created in that order with the query of
+// PerfoscopeUtil::create_new_run, so run numbers continue from the runs
+// already in the merged db. The rows of the other tables are copied by one 
+// routine driven by s_merge_tables, which names the id columns to map to the 
+// ids of the merged db; a row whose id is not in its shard aborts the merge.
+// Every shard run copied is recorded in perf_merged_run with its profile, 
+// size, run, first process and the count and total of its values, and a 
+// shard run found there is skipped, so merging the same shards again or a 
+// shard that got more runs since only adds the new runs.
+
+enum MergeId {
+  ID_NONE = -1,
+  ID_PROFILE,
+  ID_CATEGORY,
+  ID_EVENT,
+  ID_RUN,
+  ID_METRIC_NAME,
+  ID_MACHINE,
+  ID_PATH,
+  ID_CALL,
+  ID_COUNT
+};
+
+static const char *s_id_names[ID_COUNT] = {"profile", "category", "event", "run", "metric name", 
+  "machine", "path", "call"};
+
+struct MergeIdColumn {
+  const char *column;
+  MergeId id;
+};
+
+// A table copied from the shards. The rows of the runs to merge are read 
+// with "select * ... where <run> in (...) order by rowid", the id column is 
+// not copied but mapped to the id of the inserted row if self is not 
+// ID_NONE, and the id columns are mapped to the ids of the merged db. Tables 
+// without self and update are inserted with multi-row statements.
+struct MergeTable {
+  const char *name;
+  const char *run; // run id of a row in the shard
+  MergeId self;
+  const char *insert;
+  const char *update; // run after each insert with the same :column parameters
+  MergeIdColumn ids[5];
+};
+
+static const MergeTable s_merge_tables[] = {
+  {"perf_value", "run_id", ID_NONE, "insert", nullptr, 
+    {{"profile_id", ID_PROFILE}, {"category_id", ID_CATEGORY}, {"event_id", ID_EVENT}, {"run_id", ID_RUN}}},
+  // Paths are read ordered by id, so a parent is inserted before its children
+  {"perf_path", "run_id", ID_PATH, "insert", nullptr, 
+    {{"run_id", ID_RUN}, {"category_id", ID_CATEGORY}, {"parent_id", ID_PATH}}},
+  {"perf_path_value", "(select p.run_id from perf_path p where p.id=path_id)", ID_NONE, "insert", nullptr, 
+    {{"path_id", ID_PATH}, {"event_id", ID_EVENT}}},
+  {"perf_thread", "run_id", ID_NONE, "insert", nullptr, 
+    {{"run_id", ID_RUN}}},
+  // All shards hold the same runs, a run keeps the lowest estimate of its shards
+  {"perf_run_event_coverage", "run_id", ID_NONE, "insert or ignore", 
+    "update perf_run_event_coverage set estimated_coverage=:estimated_coverage "
+    "where run_id=:run_id and event_id=:event_id and estimated_coverage>:estimated_coverage;", 
+    {{"run_id", ID_RUN}, {"event_id", ID_EVENT}}},
+  // The event group of a run is inserted once
+  {"perf_run_event_group", "run_id", ID_NONE, "insert or ignore", nullptr, 
+    {{"run_id", ID_RUN}}},
+  {"perf_metric", "run_id", ID_NONE, "insert", nullptr, 
+    {{"run_id", ID_RUN}, {"category_id", ID_CATEGORY}, {"name_id", ID_METRIC_NAME}}},
+  // A run that is in shards of several hosts keeps the machine of the first shard
+  {"perf_run_machine", "run_id", ID_NONE, "insert or ignore", nullptr, 
+    {{"run_id", ID_RUN}, {"machine_id", ID_MACHINE}}},
+  {"perf_call_overhead", "run_id", ID_NONE, "insert", nullptr, 
+    {{"run_id", ID_RUN}, {"event_id", ID_EVENT}}},
+  {"perf_compensated_value", "run_id", ID_NONE, "insert", nullptr, 
+    {{"run_id", ID_RUN}, {"category_id", ID_CATEGORY}, {"event_id", ID_EVENT}}},
+  {"perf_sample", "run_id", ID_NONE, "insert", nullptr, 
+    {{"run_id", ID_RUN}, {"category_id", ID_CATEGORY}}},
+  {"perf_call", "run_id", ID_CALL, "insert", nullptr, 
+    {{"run_id", ID_RUN}, {"category_id", ID_CATEGORY}}},
+  {"perf_call_bucket", "(select c.run_id from perf_call c where c.id=call_id)", ID_NONE, "insert", nullptr, 
+    {{"call_id", ID_CALL}}},
+  {"perf_series", "run_id", ID_NONE, "insert", nullptr, 
+    {{"run_id", ID_RUN}, {"category_id", ID_CATEGORY}, {"event_id", ID_EVENT}}}
+};
+
+static const int s_merge_tables_count = sizeof(s_merge_tables)/sizeof(s_merge_tables[0]);
+
+struct ShardEvent {
+  std::string name;
+  long long profile_id;
+};
+
+// A run of a shard, proc_id, nvalues and total identify it in perf_merged_run
+struct ShardRun {
+  ShardRun() : run(0), size(0), profile_id(0), proc_id(0), nvalues(0), total(0.0), merged(false) {}
+  
+  long long run;
+  long long size;
+  long long profile_id;
+  std::string profile;
+  int proc_id;
+  long long nvalues;
+  double total;
+  bool merged;
+};
+
+struct MergeMachineRow {
+  long long id;
+  std::string host;
+  std::string build;
+  int nthreads;
+  double gflops;
+  long long level_sizes[4]; // L1, L2, L3, memory
+  double bandwidths[4];
+};
+
+// One value of a copied row, text and blobs are stored in the bytes of 
+// their table
+struct MergeCell {
+  int type;
+  int length;
+  union {
+    long long int_value;
+    double real_value;
+    size_t offset;
+  };
+};
+
+struct MergeRows {
+  std::vector<std::string> columns;
+  std::vector<MergeCell> cells; // row-major
+  std::string bytes;
+  
+  size_t count() const {
+    return (columns.empty() ? 0 : cells.size()/columns.size());
+  }
+};
+
+struct Shard {
+  Shard() : loaded(false), sqlrc(SQLITE_OK) {}
+  
+  std::string filename;
+  std::map<long long, std::string> profiles;
+  std::map<long long, std::string> categories;
+  std::map<long long, ShardEvent> events;
+  std::map<long long, ShardRun> runs;
+  std::map<long long, std::string> metric_names;
+  std::vector<MergeMachineRow> machines;
+  
+  // Ids in the merged db of the ids in the shard
+  std::map<long long, long long> ids[ID_COUNT];
+  
+  std::vector<MergeRows> tables; // of s_merge_tables
+  bool loaded;
+  int sqlrc;
+};
+
+static const int s_insert_values_batch = 128;
+static const int s_max_parameters = 999;
+
+static const char *s_create_new_run_query =
+"insert into perf_run (run, size, profile_id) "
+"values ("
+"(select ifnull(max(r.run+1), 1) from perf_run r where r.profile_id=?2 and r.size=?1), "
+"?1, "
+"?2);";
+
+static const char *s_create_merged_run_query =
+"create table if not exists perf_merged_run("
+"profile_id integer not null references perf_profile(id), "
+"size integer not null, "
+"run integer not null, "
+"proc_id int not null, "
+"nvalues integer not null, "
+"total real not null, "
+"run_id integer not null references perf_run(id), "
+"primary key(profile_id, size, run, proc_id, nvalues, total));";
+
+/**---------------------------------------------------------------------------*/
+
+static void print_usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-j nthreads] merged.db shard...\n", name);
+}
+
+static int step_done(sqlite3_stmt *stmt) {
+  int sqlrc = sqlite3_step(stmt);
+  return (sqlrc == SQLITE_DONE ? SQLITE_OK : sqlrc);
+}
+
+static int open_shard(const Shard &shard, sqlite3 **db) {
+  int sqlrc;
+  if((sqlrc = sqlite3_open_v2(shard.filename.c_str(), db, SQLITE_OPEN_READONLY, nullptr)) != SQLITE_OK) {
+    fprintf(stderr, "Could not open shard '%s' (error: %s, code: %d)\n", 
+      shard.filename.c_str(), sqlite3_errstr(sqlrc), sqlrc);
+  }
+  return sqlrc;
+}
+
+static bool has_table(sqlite3 *db, const char *name) {
+  sqlite3_stmt *stmt = nullptr;
+  bool exists = false;
+  if(sqlite3_prepare_v2(db, "select count(*) from sqlite_master where type='table' and name=?1;", -1, &stmt, NULL) == SQLITE_OK) {
+    sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+    exists = (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) > 0);
+  }
+  sqlite3_finalize(stmt);
+  return exists;
+}
+
+static int load_shard_machines(Shard &shard, sqlite3 *db) {
+  int sqlrc;
+  sqlite3_stmt *stmt = nullptr;
+  const char *query = "select id, host, build, nthreads, gflops, l1_size, l1_gbs, l2_size, l2_gbs, "
+    "l3_size, l3_gbs, memory_size, memory_gbs from perf_machine;";
+  
+  if((sqlrc = sqlite3_prepare_v2(db, query, -1, &stmt, NULL)) == SQLITE_OK) {
+    MergeMachineRow row;
+    while((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      row.id = sqlite3_column_int64(stmt, 0);
+      row.host = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+      row.build = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+      row.nthreads = sqlite3_column_int(stmt, 3);
+      row.gflops = sqlite3_column_double(stmt, 4);
+      for(int li = 0; li < 4; ++li) {
+        row.level_sizes[li] = sqlite3_column_int64(stmt, 5+2*li);
+        row.bandwidths[li] = sqlite3_column_double(stmt, 6+2*li);
+      }
+      shard.machines.push_back(row);
+    }
+    sqlite3_finalize(stmt);
+  }
+  
+  return sqlrc;
+}
+
+static int load_shard_ids(Shard &shard) {
+  int sqlrc;
+  sqlite3 *db = nullptr;
+  sqlite3_stmt *stmt = nullptr;
+  
+  if((sqlrc = open_shard(shard, &db)) == SQLITE_OK) {
+    if((sqlrc = sqlite3_prepare_v2(db, "select id, name from perf_profile;", -1, &stmt, NULL)) == SQLITE_OK) {
+      while((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        shard.profiles[sqlite3_column_int64(stmt, 0)] =
+          reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+      }
+      sqlite3_finalize(stmt);
+    }
+    if(sqlrc == SQLITE_DONE &&
+        (sqlrc = sqlite3_prepare_v2(db, "select id, name from perf_category;", -1, &stmt, NULL)) == SQLITE_OK) {
+      while((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        shard.categories[sqlite3_column_int64(stmt, 0)] =
+          reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+      }
+      sqlite3_finalize(stmt);
+    }
+    if(sqlrc == SQLITE_DONE &&
+        (sqlrc = sqlite3_prepare_v2(db, "select id, name, profile_id from perf_event;", -1, &stmt, NULL)) == SQLITE_OK) {
+      while((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        ShardEvent &event = shard.events[sqlite3_column_int64(stmt, 0)];
+        event.name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        event.profile_id = sqlite3_column_int64(stmt, 2);
+      }
+      sqlite3_finalize(stmt);
+    }
+    if(sqlrc == SQLITE_DONE &&
+        (sqlrc = sqlite3_prepare_v2(db, "select id, run, size, profile_id from perf_run;", -1, &stmt, NULL)) == SQLITE_OK) {
+      while((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        ShardRun &run = shard.runs[sqlite3_column_int64(stmt, 0)];
+        run.run = sqlite3_column_int64(stmt, 1);
+        run.size = sqlite3_column_int64(stmt, 2);
+        run.profile_id = sqlite3_column_int64(stmt, 3);
+        std::map<long long, std::string>::const_iterator it = shard.profiles.find(run.profile_id);
+        if(it == shard.profiles.end()) {
+          fprintf(stderr, "Shard '%s' references profile id %lld that is not in the shard\n", 
+            shard.filename.c_str(), run.profile_id);
+          sqlrc = SQLITE_CORRUPT;
+          break;
+        }
+        run.profile = it->second;
+      }
+      sqlite3_finalize(stmt);
+    }
+    if(sqlrc == SQLITE_DONE &&
+        (sqlrc = sqlite3_prepare_v2(db, "select run_id, min(proc_id), count(*), total(value) from perf_value "
+          "group by run_id;", -1, &stmt, NULL)) == SQLITE_OK) {
+      while((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        std::map<long long, ShardRun>::iterator it = shard.runs.find(sqlite3_column_int64(stmt, 0));
+        if(it != shard.runs.end()) {
+          it->second.proc_id = sqlite3_column_int(stmt, 1);
+          it->second.nvalues = sqlite3_column_int64(stmt, 2);
+          it->second.total = sqlite3_column_double(stmt, 3);
+        }
+      }
+      sqlite3_finalize(stmt);
+    }
+    if(sqlrc == SQLITE_DONE && has_table(db, "perf_metric_name") &&
+        (sqlrc = sqlite3_prepare_v2(db, "select id, name from perf_metric_name;", -1, &stmt, NULL)) == SQLITE_OK) {
+      while((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        shard.metric_names[sqlite3_column_int64(stmt, 0)] =
+          reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+      }
+      sqlite3_finalize(stmt);
+    }
+    if(sqlrc == SQLITE_DONE && has_table(db, "perf_machine")) {
+      sqlrc = load_shard_machines(shard, db);
+    }
+    if(sqlrc == SQLITE_DONE) {
+      sqlrc = SQLITE_OK;
+    } else {
+      fprintf(stderr, "Could not read ids from shard '%s' (error: %s, code: %d)\n", 
+        shard.filename.c_str(), sqlite3_errstr(sqlrc), sqlrc);
+    }
+  }
+  sqlite3_close(db);
+  
+  return sqlrc;
+}
+
+// Reads the rows of the runs to merge from one table of the shard
+static int load_shard_table(sqlite3 *db, const MergeTable &table, const std::string &run_ids, MergeRows &rows) {
+  int sqlrc;
+  sqlite3_stmt *stmt = nullptr;
+  std::string query = std::string("select * from ") + table.name + " where " + table.run + 
+    " in (" + run_ids + ") order by rowid;";
+  
+  if((sqlrc = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, NULL)) == SQLITE_OK) {
+    const int ncolumns = sqlite3_column_count(stmt);
+    for(int ci = 0; ci < ncolumns; ++ci) {
+      rows.columns.push_back(sqlite3_column_name(stmt, ci));
+    }
+    MergeCell cell;
+    while((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      for(int ci = 0; ci < ncolumns; ++ci) {
+        cell.type = sqlite3_column_type(stmt, ci);
+        cell.length = 0;
+        if(cell.type == SQLITE_INTEGER || cell.type == SQLITE_NULL) {
+          cell.int_value = sqlite3_column_int64(stmt, ci);
+        } else if(cell.type == SQLITE_FLOAT) {
+          cell.real_value = sqlite3_column_double(stmt, ci);
+        } else {
+          const void *bytes = (cell.type == SQLITE_TEXT ? sqlite3_column_text(stmt, ci) : sqlite3_column_blob(stmt, ci));
+          cell.length = sqlite3_column_bytes(stmt, ci);
+          cell.offset = rows.bytes.size();
+          rows.bytes.append(static_cast<const char*>(bytes), cell.length);
+        }
+        rows.cells.push_back(cell);
+      }
+    }
+    sqlite3_finalize(stmt);
+  }
+  
+  return sqlrc;
+}
+
+static int load_shard_tables(Shard &shard) {
+  int sqlrc;
+  sqlite3 *db = nullptr;
+  
+  // Runs already merged are not read
+  std::string run_ids;
+  for(auto it = shard.runs.begin(); it != shard.runs.end(); ++it) {
+    if(!it->second.merged) {
+      run_ids += (run_ids.empty() ? "" : ", ") + std::to_string(it->first);
+    }
+  }
+  
+  shard.tables.assign(s_merge_tables_count, MergeRows());
+  if(run_ids.empty()) {
+    return SQLITE_OK;
+  }
+  
+  if((sqlrc = open_shard(shard, &db)) == SQLITE_OK) {
+    sqlrc = SQLITE_DONE;
+    for(int ti = 0; ti < s_merge_tables_count && sqlrc == SQLITE_DONE; ++ti) {
+      if(has_table(db, s_merge_tables[ti].name)) {
+        sqlrc = load_shard_table(db, s_merge_tables[ti], run_ids, shard.tables[ti]);
+      }
+    }
+    if(sqlrc == SQLITE_DONE) {
+      sqlrc = SQLITE_OK;
+    } else {
+      fprintf(stderr, "Could not read values from shard '%s' (error: %s, code: %d)\n", 
+        shard.filename.c_str(), sqlite3_errstr(sqlrc), sqlrc);
+    }
+  }
+  sqlite3_close(db);
+  
+  return sqlrc;
+}
+
+/**---------------------------------------------------------------------------*/
+
+// Creates the tables of the shard that do not exist in the merged db
+static int create_schema(sqlite3 *db, const Shard &shard) {
+  int sqlrc;
+  sqlite3 *shard_db = nullptr;
+  sqlite3_stmt *stmt = nullptr;
+  sqlite3_stmt *exists_stmt = nullptr;
+  
+  if((sqlrc = open_shard(shard, &shard_db)) == SQLITE_OK) {
+    if((sqlrc = sqlite3_prepare_v2(shard_db, "select name, sql from sqlite_master "
+        "where type='table' and name not like 'sqlite_%' order by rowid;", -1, &stmt, NULL)) == SQLITE_OK) {
+      if((sqlrc = sqlite3_prepare_v2(db, "select count(*) from sqlite_master where name=?1;", -1, &exists_stmt, NULL)) == SQLITE_OK) {
+        while((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+          sqlite3_reset(exists_stmt);
+          sqlite3_bind_text(exists_stmt, 1, reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)), -1, SQLITE_TRANSIENT);
+          if((sqlrc = sqlite3_step(exists_stmt)) != SQLITE_ROW) {
+            break;
+          }
+          if(sqlite3_column_int(exists_stmt, 0) == 0) {
+            if((sqlrc = sqlite3_exec(db, reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)), NULL, NULL, NULL)) != SQLITE_OK) {
+              break;
+            }
+          }
+        }
+        sqlite3_finalize(exists_stmt);
+      }
+      sqlite3_finalize(stmt);
+    }
+    if(sqlrc == SQLITE_DONE) {
+      sqlrc = SQLITE_OK;
+    } else {
+      fprintf(stderr, "Could not create schema from shard '%s' (error: %s, code: %d)\n", 
+        shard.filename.c_str(), sqlite3_errstr(sqlrc), sqlrc);
+    }
+  }
+  sqlite3_close(shard_db);
+  
+  return sqlrc;
+}
+
+static int merge_name(sqlite3 *db, const char *table, const std::string &name, long long *id) {
+  int sqlrc;
+  sqlite3_stmt *stmt = nullptr;
+  std::string insert_query = std::string("insert or ignore into ") + table + "(name) values(?1);";
+  std::string select_query = std::string("select id from ") + table + " where name=?1;";
+  
+  if((sqlrc = sqlite3_prepare_v2(db, insert_query.c_str(), -1, &stmt, NULL)) == SQLITE_OK) {
+    sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_STATIC);
+    sqlrc = step_done(stmt);
+    sqlite3_finalize(stmt);
+  }
+  if(sqlrc == SQLITE_OK && (sqlrc = sqlite3_prepare_v2(db, select_query.c_str(), -1, &stmt, NULL)) == SQLITE_OK) {
+    sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_STATIC);
+    if((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      *id = sqlite3_column_int64(stmt, 0);
+      sqlrc = SQLITE_OK;
+    }
+    sqlite3_finalize(stmt);
+  }
+  
+  return sqlrc;
+}
+
+static int merge_event(sqlite3 *db, const std::string &name, long long profile_id, long long *id) {
+  int sqlrc;
+  sqlite3_stmt *stmt = nullptr;
+  
+  if((sqlrc = sqlite3_prepare_v2(db, "insert or ignore into perf_event(name, profile_id) values(?1, ?2);", -1, &stmt, NULL)) == SQLITE_OK) {
+    sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, profile_id);
+    sqlrc = step_done(stmt);
+    sqlite3_finalize(stmt);
+  }
+  if(sqlrc == SQLITE_OK && (sqlrc = sqlite3_prepare_v2(db, "select id from perf_event where name=?1 and profile_id=?2;", -1, &stmt, NULL)) == SQLITE_OK) {
+    sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, profile_id);
+    if((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      *id = sqlite3_column_int64(stmt, 0);
+      sqlrc = SQLITE_OK;
+    }
+    sqlite3_finalize(stmt);
+  }
+  
+  return sqlrc;
+}
+
+// Looks up the id in the merged db of an id of the shard
+static int merged_id(const Shard &shard, MergeId id, long long shard_id, long long *merged) {
+  std::map<long long, long long>::const_iterator it = shard.ids[id].find(shard_id);
+  if(it == shard.ids[id].end()) {
+    fprintf(stderr, "Shard '%s' references %s id %lld that is not in the shard\n", 
+      shard.filename.c_str(), s_id_names[id], shard_id);
+    return SQLITE_CORRUPT;
+  }
+  *merged = it->second;
+  return SQLITE_OK;
+}
+
+// A machine already in the merged db keeps its peaks
+static int merge_machines(sqlite3 *db, Shard &shard) {
+  int sqlrc = SQLITE_OK;
+  sqlite3_stmt *stmt = nullptr;
+  const char *insert_query = "insert or ignore into perf_machine(host, build, nthreads, gflops, l1_size, l1_gbs, "
+    "l2_size, l2_gbs, l3_size, l3_gbs, memory_size, memory_gbs) "
+    "values (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12);";
+  
+  if(shard.machines.empty()) {
+    return SQLITE_OK;
+  }
+  
+  if((sqlrc = sqlite3_prepare_v2(db, insert_query, -1, &stmt, NULL)) == SQLITE_OK) {
+    for(size_t mi = 0; mi < shard.machines.size() && sqlrc == SQLITE_OK; ++mi) {
+      const MergeMachineRow &row = shard.machines[mi];
+      sqlite3_reset(stmt);
+      sqlite3_bind_text(stmt, 1, row.host.c_str(), -1, SQLITE_STATIC);
+      sqlite3_bind_text(stmt, 2, row.build.c_str(), -1, SQLITE_STATIC);
+      sqlite3_bind_int(stmt, 3, row.nthreads);
+      sqlite3_bind_double(stmt, 4, row.gflops);
+      for(int li = 0; li < 4; ++li) {
+        sqlite3_bind_int64(stmt, 5+2*li, row.level_sizes[li]);
+        sqlite3_bind_double(stmt, 6+2*li, row.bandwidths[li]);
+      }
+      sqlrc = step_done(stmt);
+    }
+    sqlite3_finalize(stmt);
+  }
+  if(sqlrc == SQLITE_OK && 
+      (sqlrc = sqlite3_prepare_v2(db, "select id from perf_machine where host=?1 and build=?2;", -1, &stmt, NULL)) == SQLITE_OK) {
+    for(size_t mi = 0; mi < shard.machines.size() && sqlrc == SQLITE_OK; ++mi) {
+      sqlite3_reset(stmt);
+      sqlite3_bind_text(stmt, 1, shard.machines[mi].host.c_str(), -1, SQLITE_STATIC);
+      sqlite3_bind_text(stmt, 2, shard.machines[mi].build.c_str(), -1, SQLITE_STATIC);
+      if((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        shard.ids[ID_MACHINE][shard.machines[mi].id] = sqlite3_column_int64(stmt, 0);
+        sqlrc = SQLITE_OK;
+      }
+    }
+    sqlite3_finalize(stmt);
+  }
+  
+  return sqlrc;
+}
+
+// Shard runs already in perf_merged_run are skipped, the runs of other 
+// shards with the same (profile, size, run) are added to the run they were 
+// merged into. The other runs are created ordered by (profile, size, run).
+static int merge_ids(sqlite3 *db, std::vector<Shard> &shards) {
+  int sqlrc = SQLITE_OK;
+  typedef std::tuple<std::string, long long, long long> RunKey;
+  std::map<RunKey, long long> run_ids;
+  size_t nskipped = 0, ncreated = 0;
+  long long profile_id;
+  
+  for(size_t si = 0; si < shards.size() && sqlrc == SQLITE_OK; ++si) {
+    Shard &shard = shards[si];
+    for(auto it = shard.profiles.begin(); it != shard.profiles.end() && sqlrc == SQLITE_OK; ++it) {
+      sqlrc = merge_name(db, "perf_profile", it->second, &shard.ids[ID_PROFILE][it->first]);
+    }
+    for(auto it = shard.categories.begin(); it != shard.categories.end() && sqlrc == SQLITE_OK; ++it) {
+      sqlrc = merge_name(db, "perf_category", it->second, &shard.ids[ID_CATEGORY][it->first]);
+    }
+    for(auto it = shard.metric_names.begin(); it != shard.metric_names.end() && sqlrc == SQLITE_OK; ++it) {
+      sqlrc = merge_name(db, "perf_metric_name", it->second, &shard.ids[ID_METRIC_NAME][it->first]);
+    }
+    for(auto it = shard.events.begin(); it != shard.events.end() && sqlrc == SQLITE_OK; ++it) {
+      if((sqlrc = merged_id(shard, ID_PROFILE, it->second.profile_id, &profile_id)) == SQLITE_OK) {
+        sqlrc = merge_event(db, it->second.name, profile_id, &shard.ids[ID_EVENT][it->first]);
+      }
+    }
+    if(sqlrc == SQLITE_OK) {
+      sqlrc = merge_machines(db, shard);
+    }
+  }
+  
+  sqlite3_stmt *stmt = nullptr;
+  if(sqlrc == SQLITE_OK && (sqlrc = sqlite3_prepare_v2(db, "select run_id from perf_merged_run "
+      "where profile_id=?1 and size=?2 and run=?3 and proc_id=?4 and nvalues=?5 and total=?6;", -1, &stmt, NULL)) == SQLITE_OK) {
+    for(size_t si = 0; si < shards.size() && sqlrc == SQLITE_OK; ++si) {
+      Shard &shard = shards[si];
+      for(auto it = shard.runs.begin(); it != shard.runs.end() && sqlrc == SQLITE_OK; ++it) {
+        ShardRun &run = it->second;
+        if((sqlrc = merged_id(shard, ID_PROFILE, run.profile_id, &profile_id)) != SQLITE_OK) {
+          break;
+        }
+        sqlite3_reset(stmt);
+        sqlite3_bind_int64(stmt, 1, profile_id);
+        sqlite3_bind_int64(stmt, 2, run.size);
+        sqlite3_bind_int64(stmt, 3, run.run);
+        sqlite3_bind_int(stmt, 4, run.proc_id);
+        sqlite3_bind_int64(stmt, 5, run.nvalues);
+        sqlite3_bind_double(stmt, 6, run.total);
+        if((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+          run.merged = true;
+          shard.ids[ID_RUN][it->first] = sqlite3_column_int64(stmt, 0);
+          run_ids[RunKey(run.profile, run.size, run.run)] = sqlite3_column_int64(stmt, 0);
+          fprintf(stderr, "Run %lld of size %lld of shard '%s' is already merged, skipped\n", 
+            run.run, run.size, shard.filename.c_str());
+          ++nskipped;
+        }
+        if(sqlrc == SQLITE_ROW || sqlrc == SQLITE_DONE) {
+          sqlrc = SQLITE_OK;
+        }
+      }
+    }
+    sqlite3_finalize(stmt);
+  }
+  for(size_t si = 0; si < shards.size() && sqlrc == SQLITE_OK; ++si) {
+    Shard &shard = shards[si];
+    for(auto it = shard.runs.begin(); it != shard.runs.end(); ++it) {
+      if(!it->second.merged) {
+        run_ids.insert(std::make_pair(RunKey(it->second.profile, it->second.size, it->second.run), -1LL));
+      }
+    }
+  }
+  
+  if(sqlrc == SQLITE_OK && (sqlrc = sqlite3_prepare_v2(db, s_create_new_run_query, -1, &stmt, NULL)) == SQLITE_OK) {
+    for(auto it = run_ids.begin(); it != run_ids.end() && sqlrc == SQLITE_OK; ++it) {
+      if(it->second >= 0) {
+        continue;
+      }
+      if((sqlrc = merge_name(db, "perf_profile", std::get<0>(it->first), &profile_id)) == SQLITE_OK) {
+        sqlite3_reset(stmt);
+        sqlite3_bind_int64(stmt, 1, std::get<1>(it->first));
+        sqlite3_bind_int64(stmt, 2, profile_id);
+        if((sqlrc = step_done(stmt)) == SQLITE_OK) {
+          it->second = sqlite3_last_insert_rowid(db);
+          ++ncreated;
+        }
+      }
+    }
+    sqlite3_finalize(stmt);
+  }
+  
+  if(sqlrc == SQLITE_OK && (sqlrc = sqlite3_prepare_v2(db, "insert into perf_merged_run"
+      "(profile_id, size, run, proc_id, nvalues, total, run_id) values (?1, ?2, ?3, ?4, ?5, ?6, ?7);", -1, &stmt, NULL)) == SQLITE_OK) {
+    for(size_t si = 0; si < shards.size() && sqlrc == SQLITE_OK; ++si) {
+      Shard &shard = shards[si];
+      for(auto it = shard.runs.begin(); it != shard.runs.end() && sqlrc == SQLITE_OK; ++it) {
+        const ShardRun &run = it->second;
+        if(run.merged) {
+          continue;
+        }
+        const long long run_id = run_ids.find(RunKey(run.profile, run.size, run.run))->second;
+        shard.ids[ID_RUN][it->first] = run_id;
+        if((sqlrc = merged_id(shard, ID_PROFILE, run.profile_id, &profile_id)) == SQLITE_OK) {
+          sqlite3_reset(stmt);
+          sqlite3_bind_int64(stmt, 1, profile_id);
+          sqlite3_bind_int64(stmt, 2, run.size);
+          sqlite3_bind_int64(stmt, 3, run.run);
+          sqlite3_bind_int(stmt, 4, run.proc_id);
+          sqlite3_bind_int64(stmt, 5, run.nvalues);
+          sqlite3_bind_double(stmt, 6, run.total);
+          sqlite3_bind_int64(stmt, 7, run_id);
+          sqlrc = step_done(stmt);
+        }
+      }
+    }
+    sqlite3_finalize(stmt);
+  }
+  
+  if(sqlrc != SQLITE_OK) {
+    fprintf(stderr, "Could not merge profiles, categories, events and runs (error: %s, code: %d)\n", 
+      sqlite3_errstr(sqlrc), sqlrc);
+  } else {
+    fprintf(stdout, "Merged %zu runs, skipped %zu shard runs already merged\n", ncreated, nskipped);
+  }
+  
+  return sqlrc;
+}
+
+/**---------------------------------------------------------------------------*/
+
+static int bind_cell(sqlite3_stmt *stmt, int pi, const Shard &shard, const MergeRows &rows, 
+    const MergeCell &cell, MergeId id) {
+  int sqlrc;
+  long long merged;
+  if(cell.type == SQLITE_NULL) {
+    sqlrc = sqlite3_bind_null(stmt, pi);
+  } else if(id != ID_NONE) {
+    if((sqlrc = merged_id(shard, id, cell.int_value, &merged)) == SQLITE_OK) {
+      sqlrc = sqlite3_bind_int64(stmt, pi, merged);
+    }
+  } else if(cell.type == SQLITE_INTEGER) {
+    sqlrc = sqlite3_bind_int64(stmt, pi, cell.int_value);
+  } else if(cell.type == SQLITE_FLOAT) {
+    sqlrc = sqlite3_bind_double(stmt, pi, cell.real_value);
+  } else if(cell.type == SQLITE_TEXT) {
+    sqlrc = sqlite3_bind_text(stmt, pi, rows.bytes.data() + cell.offset, cell.length, SQLITE_STATIC);
+  } else {
+    sqlrc = sqlite3_bind_blob(stmt, pi, rows.bytes.data() + cell.offset, cell.length, SQLITE_STATIC);
+  }
+  return sqlrc;
+}
+
+// Inserts the rows read from one table of the shard, all columns but the id
+static int insert_shard_table(sqlite3 *db, Shard &shard, const MergeTable &table, const MergeRows &rows) {
+  int sqlrc = SQLITE_OK;
+  const size_t nrows = rows.count();
+  const int nrow_columns = rows.columns.size();
+  
+  if(nrows == 0) {
+    return SQLITE_OK;
+  }
+  
+  std::vector<int> columns;
+  std::vector<MergeId> ids;
+  int self_column = -1;
+  for(int ci = 0; ci < nrow_columns; ++ci) {
+    if(rows.columns[ci] == "id") {
+      self_column = ci;
+      continue;
+    }
+    MergeId id = ID_NONE;
+    for(const MergeIdColumn *column = table.ids; column < table.ids + 5 && column->column != nullptr; ++column) {
+      if(rows.columns[ci] == column->column) {
+        id = column->id;
+      }
+    }
+    columns.push_back(ci);
+    ids.push_back(id);
+  }
+  const int ncolumns = columns.size();
+  const MergeId self = (self_column < 0 ? ID_NONE : table.self);
+  
+  // Rows whose id is mapped or that are updated are inserted one by one 
+  // with :column parameters, the others in batches
+  const bool batched = (self == ID_NONE && table.update == nullptr);
+  const int batch = (batched ? std::max(1, std::min(s_insert_values_batch, s_max_parameters/ncolumns)) : 1);
+  std::string names, parameters;
+  for(int ci = 0; ci < ncolumns; ++ci) {
+    names += (ci == 0 ? "" : ", ") + rows.columns[columns[ci]];
+    parameters += (ci == 0 ? "" : ", ") + (batched ? std::string("?") : ":" + rows.columns[columns[ci]]);
+  }
+  const std::string insert_query = std::string(table.insert) + " into " + table.name + "(" + names + ") values ";
+  
+  sqlite3_stmt *stmt = nullptr;
+  sqlite3_stmt *update_stmt = nullptr;
+  std::vector<int> update_parameters(ncolumns, 0);
+  if(table.update != nullptr && (sqlrc = sqlite3_prepare_v2(db, table.update, -1, &update_stmt, NULL)) == SQLITE_OK) {
+    for(int ci = 0; ci < ncolumns; ++ci) {
+      update_parameters[ci] = sqlite3_bind_parameter_index(update_stmt, (":" + rows.columns[columns[ci]]).c_str());
+    }
+  }
+  
+  size_t stmt_rows = 0;
+  for(size_t ri = 0; ri < nrows && sqlrc == SQLITE_OK; ri += stmt_rows) {
+    const size_t nstmt_rows = std::min(size_t(batch), nrows - ri);
+    if(nstmt_rows != stmt_rows) {
+      std::string query = insert_query;
+      for(size_t si = 0; si < nstmt_rows; ++si) {
+        query += (si == 0 ? "(" : ", (") + parameters + ")";
+      }
+      sqlite3_finalize(stmt);
+      stmt = nullptr;
+      if((sqlrc = sqlite3_prepare_v2(db, (query + ";").c_str(), -1, &stmt, NULL)) != SQLITE_OK) {
+        break;
+      }
+      stmt_rows = nstmt_rows;
+    }
+    
+    sqlite3_reset(stmt);
+    for(size_t si = 0; si < stmt_rows && sqlrc == SQLITE_OK; ++si) {
+      const MergeCell *row = &rows.cells[(ri+si)*nrow_columns];
+      for(int ci = 0; ci < ncolumns && sqlrc == SQLITE_OK; ++ci) {
+        sqlrc = bind_cell(stmt, 1 + si*ncolumns + ci, shard, rows, row[columns[ci]], ids[ci]);
+      }
+    }
+    if(sqlrc == SQLITE_OK) {
+      sqlrc = step_done(stmt);
+    }
+    
+    const MergeCell *row = &rows.cells[ri*nrow_columns];
+    if(sqlrc == SQLITE_OK && self != ID_NONE) {
+      shard.ids[self][row[self_column].int_value] = sqlite3_last_insert_rowid(db);
+    }
+    if(sqlrc == SQLITE_OK && update_stmt != nullptr) {
+      sqlite3_reset(update_stmt);
+      for(int ci = 0; ci < ncolumns && sqlrc == SQLITE_OK; ++ci) {
+        if(update_parameters[ci] > 0) {
+          sqlrc = bind_cell(update_stmt, update_parameters[ci], shard, rows, row[columns[ci]], ids[ci]);
+        }
+      }
+      if(sqlrc == SQLITE_OK) {
+        sqlrc = step_done(update_stmt);
+      }
+    }
+  }
+  sqlite3_finalize(stmt);
+  sqlite3_finalize(update_stmt);
+  
+  if(sqlrc != SQLITE_OK) {
+    fprintf(stderr, "Could not insert %s of shard '%s' (error: %s, code: %d)\n", 
+      table.name, shard.filename.c_str(), sqlite3_errstr(sqlrc), sqlrc);
+  }
+  
+  return sqlrc;
+}
+
+/**---------------------------------------------------------------------------*/
+
+// Runs load on every shard with nthreads worker threads, done is called on
+// the calling thread for every shard in order as soon as it is loaded. A
+// worker only loads a shard less than nthreads shards ahead of the last one
+// done, so at most nthreads loaded shards are held in memory.
+template<typename Load, typename Done>
+static int for_each_shard(std::vector<Shard> &shards, int nthreads, Load load, Done done) {
+  int sqlrc = SQLITE_OK;
+  std::atomic<int> next(0);
+  int ndone = 0;
+  std::mutex mutex;
+  std::condition_variable loaded;
+  std::condition_variable progress;
+  
+  for(size_t si = 0; si < shards.size(); ++si) {
+    shards[si].loaded = false;
+  }
+  
+  std::vector<std::thread> workers;
+  for(int ti = 0; ti < nthreads; ++ti) {
+    workers.push_back(std::thread([&]() {
+      int si;
+      while((si = next++) < int(shards.size())) {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          progress.wait(lock, [&]() { return si < ndone + nthreads; });
+        }
+        int rc = load(shards[si]);
+        std::lock_guard<std::mutex> lock(mutex);
+        shards[si].sqlrc = rc;
+        shards[si].loaded = true;
+        loaded.notify_all();
+      }
+    }));
+  }
+  
+  for(size_t si = 0; si < shards.size(); ++si) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      loaded.wait(lock, [&]() { return shards[si].loaded; });
+    }
+    if(sqlrc == SQLITE_OK && (sqlrc = shards[si].sqlrc) == SQLITE_OK) {
+      sqlrc = done(shards[si]);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    ++ndone;
+    progress.notify_all();
+  }
+  
+  for(size_t ti = 0; ti < workers.size(); ++ti) {
+    workers[ti].join();
+  }
+  
+  return sqlrc;
+}
+
+int main(int argc, char *argv[]) {
+  int nthreads = std::thread::hardware_concurrency();
+  int ai = 1;
+  if(ai+1 < argc && std::strcmp(argv[ai], "-j") == 0) {
+    nthreads = std::atoi(argv[ai+1]);
+    ai += 2;
+  }
+  if(argc - ai < 2) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  if(nthreads < 1) {
+    nthreads = 1;
+  }
+  
+  const char *dbfilename = argv[ai++];
+  std::vector<Shard> shards(argc-ai);
+  for(size_t si = 0; si < shards.size(); ++si) {
+    shards[si].filename = argv[ai+si];
+  }
+  
+  int sqlrc;
+  sqlite3 *db = nullptr;
+  long long nvalues = 0;
+  long long npaths = 0;
+  
+  if((sqlrc = sqlite3_open(dbfilename, &db)) != SQLITE_OK) {
+    fprintf(stderr, "Could not open merged db '%s' (error: %s, code: %d)\n", 
+      dbfilename, sqlite3_errstr(sqlrc), sqlrc);
+  } else if((sqlrc = sqlite3_exec(db, "PRAGMA foreign_keys = on; begin transaction;", NULL, NULL, NULL)) == SQLITE_OK) {
+    for(size_t si = 0; si < shards.size() && sqlrc == SQLITE_OK; ++si) {
+      sqlrc = create_schema(db, shards[si]);
+    }
+    if(sqlrc == SQLITE_OK) {
+      sqlrc = sqlite3_exec(db, s_create_merged_run_query, NULL, NULL, NULL);
+    }
+    if(sqlrc == SQLITE_OK) {
+      sqlrc = for_each_shard(shards, nthreads, load_shard_ids, [](Shard &) { return SQLITE_OK; });
+    }
+    if(sqlrc == SQLITE_OK) {
+      sqlrc = merge_ids(db, shards);
+    }
+    if(sqlrc == SQLITE_OK) {
+      // Tables are read by the workers while the shards before are written
+      sqlrc = for_each_shard(shards, nthreads, load_shard_tables, [&](Shard &shard) {
+        int rc = SQLITE_OK;
+        for(int ti = 0; ti < s_merge_tables_count && rc == SQLITE_OK; ++ti) {
+          rc = insert_shard_table(db, shard, s_merge_tables[ti], shard.tables[ti]);
+        }
+        // perf_value and perf_path are the first two of s_merge_tables
+        nvalues += shard.tables[0].count();
+        npaths += shard.tables[1].count();
+        std::vector<MergeRows>().swap(shard.tables);
+        std::map<long long, long long>().swap(shard.ids[ID_PATH]);
+        std::map<long long, long long>().swap(shard.ids[ID_CALL]);
+        return rc;
+      });
+    }
+    
+    if(sqlrc == SQLITE_OK) {
+      sqlrc = sqlite3_exec(db, "commit transaction;", NULL, NULL, NULL);
+    } else {
+      sqlite3_exec(db, "rollback transaction;", NULL, NULL, NULL);
+    }
+  }
+  
+  if(sqlrc == SQLITE_OK) {
+    fprintf(stdout, "Merged %lld perfdata values and %lld paths from %zu shards into '%s'\n", 
+      nvalues, npaths, shards.size(), dbfilename);
+  } else {
+    fprintf(stderr, "Could not merge shards into '%s' (error: %s, code: %d)\n", 
+      dbfilename, sqlite3_errstr(sqlrc), sqlrc);
+  }
+  sqlite3_close(db);
+  
+  return (sqlrc == SQLITE_OK ? 0 : 1);
+}
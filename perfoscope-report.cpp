@@ -0,0 +1,684 @@
+#include "texttable.hpp"
+
+#include <sqlite3.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <set>
+#include <utility>
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+/**---------------------------------------------------------------------------*/
+
+// Reports over the perf_profile/perf_run/perf_value schema: the profiles, the
+// runs, the values of runs aggregated over processes and threads and the
+// scaling of a profile across problem sizes, as text tables or CSV. The
+// values are aggregated once per run, category and event into perf_aggregate
+// and the processes and threads of a run into perf_aggregate_run, and the
+// reports only read these tables. A run is written in a single transaction,
+// so a later report only aggregates the perf_value rows above the last id it
+// aggregated. perf_aggregate_run keeps the number of rows and the last id of
+// every run, and a run that got rows after it was aggregated is aggregated
+// again as a whole. Runs added in RUN_DATA_SUMMARY mode are taken from
+// perf_summary. With -n, or if the db is read-only, the tables are temporary
+// and the perf_value rows that are not in the tables of the db are
+// aggregated by every report.
+
+struct ReportAggregate {
+  long long count;
+  double sum;
+  double min;
+  double max;
+};
+
+struct ReportRun {
+  ReportRun() : nprocs(0), nvalues(0), last_value_id(0) {}
+  
+  std::unordered_map<long long, ReportAggregate> aggregates; // category_id << 32 | event_id
+  std::vector<bool> procs;
+  long long nprocs;
+  std::unordered_set<long long> threads; // proc_id << 32 | thread_id
+  long long nvalues;
+  long long last_value_id;
+};
+
+struct ReportOptions {
+  bool csv;
+  bool temporary;
+  bool weak;
+  std::string aggregate;
+  std::string event;
+  std::vector<long long> run_ids;
+};
+
+typedef std::vector<std::vector<std::string> > ReportRows;
+
+/**---------------------------------------------------------------------------*/
+
+static void print_usage(const char *name) {
+  fprintf(stderr, "Usage: %s [options] perf.db command\n"
+    "Commands:\n"
+    "  profiles          profiles with their runs, problem sizes and events\n"
+    "  runs [profile]    runs with their processes and threads\n"
+    "  values profile    values of runs aggregated over processes and threads\n"
+    "  scaling profile   speedup and efficiency across problem sizes\n"
+    "Options:\n"
+    "  -f text|csv       output format (default text)\n"
+    "  -r run_id         run of values, repeatable (default the last run)\n"
+    "  -e event          event of values or scaling (default time for scaling)\n"
+    "  -a sum|mean|min|max  aggregate of scaling (default max)\n"
+    "  -w                weak scaling\n"
+    "  -n                do not store the aggregates in the db\n", name);
+}
+
+static int step_done(sqlite3_stmt *stmt) {
+  int sqlrc = sqlite3_step(stmt);
+  return (sqlrc == SQLITE_DONE ? SQLITE_OK : sqlrc);
+}
+
+static bool has_table(sqlite3 *db, const char *name) {
+  sqlite3_stmt *stmt = nullptr;
+  bool exists = false;
+  if(sqlite3_prepare_v2(db, "select count(*) from sqlite_master where type='table' and name=?1;", -1, &stmt, NULL) == SQLITE_OK) {
+    sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+    exists = (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) > 0);
+  }
+  sqlite3_finalize(stmt);
+  return exists;
+}
+
+static std::string column_string(sqlite3_stmt *stmt, int column) {
+  const unsigned char *text = sqlite3_column_text(stmt, column);
+  return (text != nullptr ? reinterpret_cast<const char*>(text) : "");
+}
+
+static std::string format_value(double value) {
+  std::stringstream valuestrm;
+  valuestrm << value;
+  return valuestrm.str();
+}
+
+static std::string csv_field(const std::string &field) {
+  if(field.find_first_of(",\"\n") == std::string::npos) {
+    return field;
+  }
+  std::string quoted = "\"";
+  for(size_t i = 0; i < field.size(); ++i) {
+    if(field[i] == '"') {
+      quoted += '"';
+    }
+    quoted += field[i];
+  }
+  return quoted + "\"";
+}
+
+// The first row is the header
+static void print_rows(const ReportRows &rows, bool csv) {
+  if(csv) {
+    for(size_t ri = 0; ri < rows.size(); ++ri) {
+      for(size_t ci = 0; ci < rows[ri].size(); ++ci) {
+        std::cout << (ci > 0 ? "," : "") << csv_field(rows[ri][ci]);
+      }
+      std::cout << '\n';
+    }
+  } else {
+    TextTable table(rows.size(), rows[0].size(), 2);
+    for(size_t ri = 0; ri < rows.size(); ++ri) {
+      for(size_t ci = 0; ci < rows[ri].size(); ++ci) {
+        table.at(ri, ci) = rows[ri][ci];
+      }
+    }
+    std::cout << table;
+  }
+  std::cout.flush();
+}
+
+static int find_profile(sqlite3 *db, const char *name, long long *profile_id) {
+  int sqlrc;
+  sqlite3_stmt *stmt = nullptr;
+  
+  if((sqlrc = sqlite3_prepare_v2(db, "select id from perf_profile where name=?1;", -1, &stmt, NULL)) == SQLITE_OK) {
+    sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+    if((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      *profile_id = sqlite3_column_int64(stmt, 0);
+      sqlrc = SQLITE_OK;
+    } else if(sqlrc == SQLITE_DONE) {
+      fprintf(stderr, "No profile '%s' in db\n", name);
+      sqlrc = SQLITE_NOTFOUND;
+    }
+    sqlite3_finalize(stmt);
+  }
+  
+  return sqlrc;
+}
+
+/**---------------------------------------------------------------------------*/
+
+// Aggregates of a db without the nvalues column of perf_aggregate_run are 
+// dropped and aggregated again
+static bool has_current_aggregates(sqlite3 *db) {
+  sqlite3_stmt *stmt = nullptr;
+  const bool current = (has_table(db, "perf_aggregate_run") && 
+    sqlite3_prepare_v2(db, "select nvalues from main.perf_aggregate_run;", -1, &stmt, NULL) == SQLITE_OK);
+  sqlite3_finalize(stmt);
+  return current;
+}
+
+static int create_aggregate_tables(sqlite3 *db, bool temporary) {
+  int sqlrc = SQLITE_OK;
+  const bool current = has_current_aggregates(db);
+  const std::string prefix = (temporary ? "temp." : "");
+  std::string query =
+    "create table if not exists " + prefix + "perf_aggregate("
+      "run_id integer not null, "
+      "category_id integer not null, "
+      "event_id integer not null, "
+      "count integer not null, "
+      "sum numeric not null, "
+      "min numeric not null, "
+      "max numeric not null, "
+      "primary key(run_id, category_id, event_id));"
+    "create table if not exists " + prefix + "perf_aggregate_run("
+      "run_id integer primary key, "
+      "procs integer, "
+      "threads integer not null, "
+      "nvalues integer not null, "
+      "last_value_id integer not null);";
+  
+  if(!temporary && !current && has_table(db, "perf_aggregate_run")) {
+    sqlrc = sqlite3_exec(db, "drop table perf_aggregate; drop table perf_aggregate_run;", NULL, NULL, NULL);
+  }
+  if(sqlrc == SQLITE_OK && (sqlrc = sqlite3_exec(db, query.c_str(), NULL, NULL, NULL)) == SQLITE_OK) {
+    // The aggregates the db already has are reused
+    if(temporary && current) {
+      sqlrc = sqlite3_exec(db,
+        "insert into temp.perf_aggregate select * from main.perf_aggregate;"
+        "insert into temp.perf_aggregate_run select * from main.perf_aggregate_run;", NULL, NULL, NULL);
+    }
+  }
+  if(sqlrc == SQLITE_OK) {
+    sqlrc = sqlite3_exec(db,
+      "delete from perf_aggregate where run_id not in (select id from main.perf_run);"
+      "delete from perf_aggregate_run where run_id not in (select id from main.perf_run);", NULL, NULL, NULL);
+  }
+  
+  return sqlrc;
+}
+
+// Adds a row of "select id, run_id, proc_id, thread_id, category_id, 
+// event_id, value from perf_value" to the aggregates of its run
+static void add_value(sqlite3_stmt *stmt, ReportRun &run, long long *last_thread) {
+  const long long value_id = sqlite3_column_int64(stmt, 0);
+  const int proc_id = sqlite3_column_int(stmt, 2);
+  const long long thread = (long long)proc_id << 32 | sqlite3_column_int(stmt, 3);
+  if(thread != *last_thread) {
+    *last_thread = thread;
+    if(proc_id >= int(run.procs.size())) {
+      run.procs.resize(proc_id+1, false);
+    }
+    if(!run.procs[proc_id]) {
+      run.procs[proc_id] = true;
+      ++run.nprocs;
+    }
+    run.threads.insert(thread);
+  }
+  if(value_id > run.last_value_id) {
+    run.last_value_id = value_id;
+  }
+  ++run.nvalues;
+  
+  const double value = sqlite3_column_double(stmt, 6);
+  ReportAggregate &aggregate = run.aggregates[sqlite3_column_int64(stmt, 4) << 32 | sqlite3_column_int64(stmt, 5)];
+  if(aggregate.count == 0 || value < aggregate.min) {
+    aggregate.min = value;
+  }
+  if(aggregate.count == 0 || value > aggregate.max) {
+    aggregate.max = value;
+  }
+  aggregate.sum += value;
+  ++aggregate.count;
+}
+
+// Reads the perf_value rows above the last aggregated id in a single scan. 
+// A row of a run that is already aggregated means the run changed since, 
+// such a run is stale and its rows up to the last aggregated id are read 
+// in a second scan, so that it is aggregated again as a whole.
+static int scan_values(sqlite3 *db, std::map<long long, ReportRun> &runs, std::set<long long> &stale) {
+  int sqlrc;
+  sqlite3_stmt *stmt = nullptr;
+  std::set<long long> aggregated;
+  long long last_value_id = 0;
+  
+  if((sqlrc = sqlite3_prepare_v2(db, "select run_id, last_value_id from perf_aggregate_run;", -1, &stmt, NULL)) == SQLITE_OK) {
+    while((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      aggregated.insert(sqlite3_column_int64(stmt, 0));
+      if(sqlite3_column_int64(stmt, 1) > last_value_id) {
+        last_value_id = sqlite3_column_int64(stmt, 1);
+      }
+    }
+    sqlite3_finalize(stmt);
+  }
+  if(sqlrc == SQLITE_DONE && (sqlrc = sqlite3_prepare_v2(db,
+      "select id, run_id, proc_id, thread_id, category_id, event_id, value from perf_value where id > ?1;",
+      -1, &stmt, NULL)) == SQLITE_OK) {
+    sqlite3_bind_int64(stmt, 1, last_value_id);
+    long long last_run_id = -1;
+    ReportRun *run = nullptr;
+    long long last_thread = -1;
+    while((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      const long long run_id = sqlite3_column_int64(stmt, 1);
+      if(run_id != last_run_id) {
+        last_run_id = run_id;
+        last_thread = -1;
+        run = &runs[run_id];
+        if(aggregated.count(run_id) > 0) {
+          stale.insert(run_id);
+        }
+      }
+      add_value(stmt, *run, &last_thread);
+    }
+    sqlite3_finalize(stmt);
+  }
+  if(sqlrc == SQLITE_DONE && !stale.empty() && (sqlrc = sqlite3_prepare_v2(db,
+      "select id, run_id, proc_id, thread_id, category_id, event_id, value from perf_value where id <= ?1;",
+      -1, &stmt, NULL)) == SQLITE_OK) {
+    sqlite3_bind_int64(stmt, 1, last_value_id);
+    long long last_run_id = -1;
+    ReportRun *run = nullptr;
+    long long last_thread = -1;
+    while((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      const long long run_id = sqlite3_column_int64(stmt, 1);
+      if(run_id != last_run_id) {
+        last_run_id = run_id;
+        last_thread = -1;
+        run = (stale.count(run_id) > 0 ? &runs[run_id] : nullptr);
+      }
+      if(run != nullptr) {
+        add_value(stmt, *run, &last_thread);
+      }
+    }
+    sqlite3_finalize(stmt);
+  }
+  
+  return (sqlrc == SQLITE_DONE ? SQLITE_OK : sqlrc);
+}
+
+static int delete_aggregates(sqlite3 *db, const std::set<long long> &stale) {
+  int sqlrc = SQLITE_OK;
+  sqlite3_stmt *stmt = nullptr;
+  sqlite3_stmt *run_stmt = nullptr;
+  
+  if(stale.empty()) {
+    return SQLITE_OK;
+  }
+  
+  if((sqlrc = sqlite3_prepare_v2(db, "delete from perf_aggregate where run_id = ?1;", -1, &stmt, NULL)) == SQLITE_OK) {
+    if((sqlrc = sqlite3_prepare_v2(db, "delete from perf_aggregate_run where run_id = ?1;", -1, &run_stmt, NULL)) == SQLITE_OK) {
+      for(std::set<long long>::const_iterator sit = stale.begin(); sit != stale.end() && sqlrc == SQLITE_OK; ++sit) {
+        sqlite3_reset(stmt);
+        sqlite3_bind_int64(stmt, 1, *sit);
+        if((sqlrc = step_done(stmt)) == SQLITE_OK) {
+          sqlite3_reset(run_stmt);
+          sqlite3_bind_int64(run_stmt, 1, *sit);
+          sqlrc = step_done(run_stmt);
+        }
+      }
+      sqlite3_finalize(run_stmt);
+    }
+    sqlite3_finalize(stmt);
+  }
+  
+  return sqlrc;
+}
+
+static int insert_aggregates(sqlite3 *db, const std::map<long long, ReportRun> &runs) {
+  int sqlrc;
+  sqlite3_stmt *stmt = nullptr;
+  sqlite3_stmt *run_stmt = nullptr;
+  
+  if((sqlrc = sqlite3_prepare_v2(db, "insert into perf_aggregate values (?1, ?2, ?3, ?4, ?5, ?6, ?7);", -1, &stmt, NULL)) == SQLITE_OK) {
+    if((sqlrc = sqlite3_prepare_v2(db, "insert into perf_aggregate_run values (?1, ?2, ?3, ?4, ?5);", -1, &run_stmt, NULL)) == SQLITE_OK) {
+      for(std::map<long long, ReportRun>::const_iterator rit = runs.begin(); rit != runs.end() && sqlrc == SQLITE_OK; ++rit) {
+        const ReportRun &run = rit->second;
+        for(std::unordered_map<long long, ReportAggregate>::const_iterator ait = run.aggregates.begin();
+            ait != run.aggregates.end() && sqlrc == SQLITE_OK; ++ait) {
+          sqlite3_reset(stmt);
+          sqlite3_bind_int64(stmt, 1, rit->first);
+          sqlite3_bind_int64(stmt, 2, ait->first >> 32);
+          sqlite3_bind_int64(stmt, 3, ait->first & 0xffffffffLL);
+          sqlite3_bind_int64(stmt, 4, ait->second.count);
+          sqlite3_bind_double(stmt, 5, ait->second.sum);
+          sqlite3_bind_double(stmt, 6, ait->second.min);
+          sqlite3_bind_double(stmt, 7, ait->second.max);
+          sqlrc = step_done(stmt);
+        }
+        if(sqlrc == SQLITE_OK) {
+          sqlite3_reset(run_stmt);
+          sqlite3_bind_int64(run_stmt, 1, rit->first);
+          sqlite3_bind_int64(run_stmt, 2, run.nprocs);
+          sqlite3_bind_int64(run_stmt, 3, run.threads.size());
+          sqlite3_bind_int64(run_stmt, 4, run.nvalues);
+          sqlite3_bind_int64(run_stmt, 5, run.last_value_id);
+          sqlrc = step_done(run_stmt);
+        }
+      }
+      sqlite3_finalize(run_stmt);
+    }
+    sqlite3_finalize(stmt);
+  }
+  
+  return sqlrc;
+}
+
+// Runs without perf_value rows are summarized runs or have no values at all
+static int insert_remaining_runs(sqlite3 *db) {
+  int sqlrc = SQLITE_OK;
+  
+  if(has_table(db, "perf_summary")) {
+    sqlrc = sqlite3_exec(db,
+      "insert into perf_aggregate "
+      "select run_id, category_id, event_id, count, sum, min, max from perf_summary "
+      "where run_id not in (select run_id from perf_aggregate_run);"
+      "insert into perf_aggregate_run "
+      "select run_id, null, max(count), 0, 0 from perf_summary "
+      "where run_id not in (select run_id from perf_aggregate_run) group by run_id;", NULL, NULL, NULL);
+  }
+  if(sqlrc == SQLITE_OK) {
+    sqlrc = sqlite3_exec(db,
+      "insert into perf_aggregate_run "
+      "select id, 0, 0, 0, 0 from perf_run where id not in (select run_id from perf_aggregate_run);",
+      NULL, NULL, NULL);
+  }
+  
+  return sqlrc;
+}
+
+// Brings perf_aggregate and perf_aggregate_run up to date with the runs of
+// the db, in one transaction so that no run is committed in between
+static int update_aggregates(sqlite3 *db, bool temporary) {
+  int sqlrc;
+  std::map<long long, ReportRun> runs;
+  std::set<long long> stale;
+  
+  if((sqlrc = sqlite3_exec(db, (temporary ? "begin transaction;" : "begin immediate transaction;"), NULL, NULL, NULL)) == SQLITE_OK) {
+    if((sqlrc = create_aggregate_tables(db, temporary)) == SQLITE_OK) {
+      if((sqlrc = scan_values(db, runs, stale)) == SQLITE_OK) {
+        if((sqlrc = delete_aggregates(db, stale)) == SQLITE_OK) {
+          if((sqlrc = insert_aggregates(db, runs)) == SQLITE_OK) {
+            sqlrc = insert_remaining_runs(db);
+          }
+        }
+      }
+    }
+    if(sqlrc == SQLITE_OK) {
+      sqlrc = sqlite3_exec(db, "commit transaction;", NULL, NULL, NULL);
+    } else {
+      sqlite3_exec(db, "rollback transaction;", NULL, NULL, NULL);
+    }
+  }
+  if(sqlrc != SQLITE_OK) {
+    fprintf(stderr, "Could not aggregate values (error: %s, code: %d)\n",
+      sqlite3_errmsg(db), sqlrc);
+  }
+  
+  return sqlrc;
+}
+
+/**---------------------------------------------------------------------------*/
+
+static int report_profiles(sqlite3 *db, const ReportOptions &options) {
+  int sqlrc;
+  sqlite3_stmt *stmt = nullptr;
+  ReportRows rows(1);
+  rows[0] = {"profile", "runs", "sizes", "events"};
+  
+  if((sqlrc = sqlite3_prepare_v2(db,
+      "select p.name, count(r.id), count(distinct r.size), "
+      "(select count(*) from perf_event e where e.profile_id = p.id) "
+      "from perf_profile p left join perf_run r on r.profile_id = p.id "
+      "group by p.id order by p.id;", -1, &stmt, NULL)) == SQLITE_OK) {
+    while((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      rows.push_back({column_string(stmt, 0), column_string(stmt, 1), column_string(stmt, 2), column_string(stmt, 3)});
+    }
+    sqlite3_finalize(stmt);
+  }
+  if(sqlrc == SQLITE_DONE) {
+    print_rows(rows, options.csv);
+    sqlrc = SQLITE_OK;
+  }
+  
+  return sqlrc;
+}
+
+static int report_runs(sqlite3 *db, const char *profile_name, const ReportOptions &options) {
+  int sqlrc;
+  sqlite3_stmt *stmt = nullptr;
+  ReportRows rows(1);
+  rows[0] = {"run_id", "profile", "size", "run", "procs", "threads"};
+  
+  if((sqlrc = sqlite3_prepare_v2(db,
+      "select r.id, p.name, r.size, r.run, a.procs, a.threads "
+      "from perf_run r "
+      "join perf_profile p on p.id = r.profile_id "
+      "left join perf_aggregate_run a on a.run_id = r.id "
+      "where ?1 is null or p.name = ?1 "
+      "order by r.id;", -1, &stmt, NULL)) == SQLITE_OK) {
+    if(profile_name != nullptr) {
+      sqlite3_bind_text(stmt, 1, profile_name, -1, SQLITE_STATIC);
+    }
+    while((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      std::vector<std::string> row(6);
+      for(int ci = 0; ci < 6; ++ci) {
+        row[ci] = column_string(stmt, ci);
+      }
+      rows.push_back(row);
+    }
+    sqlite3_finalize(stmt);
+  }
+  if(sqlrc == SQLITE_DONE) {
+    print_rows(rows, options.csv);
+    sqlrc = SQLITE_OK;
+  }
+  
+  return sqlrc;
+}
+
+static int report_values(sqlite3 *db, long long profile_id, const ReportOptions &options) {
+  int sqlrc;
+  sqlite3_stmt *stmt = nullptr;
+  ReportRows rows(1);
+  rows[0] = {"run_id", "size", "run", "category", "event", "threads", "sum", "mean", "min", "max"};
+  
+  std::string query =
+    "select r.id, r.size, r.run, c.name, e.name, a.count, a.sum, 1.0*a.sum/a.count, a.min, a.max "
+    "from perf_aggregate a "
+    "join perf_run r on r.id = a.run_id "
+    "join perf_category c on c.id = a.category_id "
+    "join perf_event e on e.id = a.event_id "
+    "where r.profile_id = ?1 and (?2 is null or e.name = ?2) and ";
+  if(options.run_ids.empty()) {
+    query += "r.id = (select max(id) from perf_run where profile_id = ?1) ";
+  } else {
+    query += "r.id in (";
+    for(size_t ri = 0; ri < options.run_ids.size(); ++ri) {
+      query += (ri > 0 ? ", ?" : "?") + std::to_string(ri+3);
+    }
+    query += ") ";
+  }
+  query += "order by r.id, a.category_id, a.event_id;";
+  
+  if((sqlrc = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, NULL)) == SQLITE_OK) {
+    sqlite3_bind_int64(stmt, 1, profile_id);
+    if(!options.event.empty()) {
+      sqlite3_bind_text(stmt, 2, options.event.c_str(), -1, SQLITE_STATIC);
+    }
+    for(size_t ri = 0; ri < options.run_ids.size(); ++ri) {
+      sqlite3_bind_int64(stmt, ri+3, options.run_ids[ri]);
+    }
+    while((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      std::vector<std::string> row(10);
+      for(int ci = 0; ci < 10; ++ci) {
+        row[ci] = (ci == 7 ? format_value(sqlite3_column_double(stmt, ci)) : column_string(stmt, ci));
+      }
+      rows.push_back(row);
+    }
+    sqlite3_finalize(stmt);
+  }
+  if(sqlrc == SQLITE_DONE) {
+    print_rows(rows, options.csv);
+    sqlrc = SQLITE_OK;
+  }
+  
+  return sqlrc;
+}
+
+// The smallest problem size of every category is the base. With strong
+// scaling the speedup is the base value over the value and the efficiency
+// the speedup per thread relative to the base, with weak scaling the
+// efficiency is the base value over the value. Repeated runs of a size are
+// averaged.
+static int report_scaling(sqlite3 *db, long long profile_id, const ReportOptions &options) {
+  int sqlrc;
+  sqlite3_stmt *stmt = nullptr;
+  const std::string event = (options.event.empty() ? "time" : options.event);
+  ReportRows rows(1);
+  rows[0] = {"category", "size", "runs", "threads", options.aggregate + " " + event, "speedup", "efficiency"};
+  
+  std::string value = "a.max";
+  if(options.aggregate == "sum") {
+    value = "a.sum";
+  } else if(options.aggregate == "mean") {
+    value = "1.0*a.sum/a.count";
+  } else if(options.aggregate == "min") {
+    value = "a.min";
+  }
+  const std::string query =
+    "select a.category_id, c.name, r.size, count(*), avg(a.count), avg(" + value + ") "
+    "from perf_aggregate a "
+    "join perf_run r on r.id = a.run_id "
+    "join perf_category c on c.id = a.category_id "
+    "join perf_event e on e.id = a.event_id "
+    "where r.profile_id = ?1 and e.name = ?2 "
+    "group by a.category_id, r.size "
+    "order by a.category_id, r.size;";
+  
+  if((sqlrc = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, NULL)) == SQLITE_OK) {
+    sqlite3_bind_int64(stmt, 1, profile_id);
+    sqlite3_bind_text(stmt, 2, event.c_str(), -1, SQLITE_STATIC);
+    long long base_category_id = -1;
+    double base_threads = 0.0;
+    double base_value = 0.0;
+    while((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      const double threads = sqlite3_column_double(stmt, 4);
+      const double value = sqlite3_column_double(stmt, 5);
+      if(sqlite3_column_int64(stmt, 0) != base_category_id) {
+        base_category_id = sqlite3_column_int64(stmt, 0);
+        base_threads = threads;
+        base_value = value;
+      }
+      
+      std::vector<std::string> row = {column_string(stmt, 1), column_string(stmt, 2), column_string(stmt, 3),
+        format_value(threads), format_value(value), "", ""};
+      if(value > 0.0 && threads > 0.0) {
+        const double ratio = base_value/value;
+        row[5] = format_value(options.weak ? ratio*threads/base_threads : ratio);
+        row[6] = format_value(options.weak ? ratio : ratio*base_threads/threads);
+      }
+      rows.push_back(row);
+    }
+    sqlite3_finalize(stmt);
+  }
+  if(sqlrc == SQLITE_DONE) {
+    print_rows(rows, options.csv);
+    sqlrc = SQLITE_OK;
+  }
+  
+  return sqlrc;
+}
+
+/**---------------------------------------------------------------------------*/
+
+int main(int argc, char *argv[]) {
+  ReportOptions options;
+  options.csv = false;
+  options.temporary = false;
+  options.weak = false;
+  options.aggregate = "max";
+  
+  int ai = 1;
+  for(; ai < argc && argv[ai][0] == '-'; ++ai) {
+    if(std::strcmp(argv[ai], "-n") == 0) {
+      options.temporary = true;
+    } else if(std::strcmp(argv[ai], "-w") == 0) {
+      options.weak = true;
+    } else if(ai+1 < argc && std::strcmp(argv[ai], "-f") == 0 &&
+        (std::strcmp(argv[ai+1], "text") == 0 || std::strcmp(argv[ai+1], "csv") == 0)) {
+      options.csv = (std::strcmp(argv[++ai], "csv") == 0);
+    } else if(ai+1 < argc && std::strcmp(argv[ai], "-a") == 0 &&
+        (std::strcmp(argv[ai+1], "sum") == 0 || std::strcmp(argv[ai+1], "mean") == 0 ||
+         std::strcmp(argv[ai+1], "min") == 0 || std::strcmp(argv[ai+1], "max") == 0)) {
+      options.aggregate = argv[++ai];
+    } else if(ai+1 < argc && std::strcmp(argv[ai], "-e") == 0) {
+      options.event = argv[++ai];
+    } else if(ai+1 < argc && std::strcmp(argv[ai], "-r") == 0) {
+      options.run_ids.push_back(std::atoll(argv[++ai]));
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  
+  const int nargs = argc - ai;
+  const char *command = (nargs >= 2 ? argv[ai+1] : "");
+  const bool has_profile = (std::strcmp(command, "values") == 0 || std::strcmp(command, "scaling") == 0);
+  if(!((std::strcmp(command, "profiles") == 0 && nargs == 2) ||
+       (std::strcmp(command, "runs") == 0 && (nargs == 2 || nargs == 3)) ||
+       (has_profile && nargs == 3))) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  
+  const char *dbfilename = argv[ai];
+  const char *profile_name = (nargs == 3 ? argv[ai+2] : nullptr);
+  int sqlrc;
+  sqlite3 *db = nullptr;
+  long long profile_id = 0;
+  
+  if((sqlrc = sqlite3_open_v2(dbfilename, &db,
+      (options.temporary ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE) | SQLITE_OPEN_NOMUTEX, nullptr)) != SQLITE_OK) {
+    fprintf(stderr, "Could not open db '%s' (error: %s, code: %d)\n",
+      dbfilename, sqlite3_errstr(sqlrc), sqlrc);
+  } else {
+    sqlite3_busy_timeout(db, 10000);
+    if(sqlite3_db_readonly(db, "main") == 1) {
+      options.temporary = true;
+    }
+    if(std::strcmp(command, "profiles") == 0) {
+      sqlrc = report_profiles(db, options);
+    } else if((sqlrc = update_aggregates(db, options.temporary)) == SQLITE_OK) {
+      if(!has_profile) {
+        sqlrc = report_runs(db, profile_name, options);
+      } else if((sqlrc = find_profile(db, profile_name, &profile_id)) == SQLITE_OK) {
+        if(std::strcmp(command, "values") == 0) {
+          sqlrc = report_values(db, profile_id, options);
+        } else {
+          sqlrc = report_scaling(db, profile_id, options);
+        }
+      }
+    }
+    if(sqlrc != SQLITE_OK && sqlrc != SQLITE_NOTFOUND) {
+      fprintf(stderr, "Could not report on '%s' (error: %s, code: %d)\n",
+        dbfilename, sqlite3_errmsg(db), sqlrc);
+    }
+  }
+  sqlite3_close(db);
+  
+  return (sqlrc == SQLITE_OK ? 0 : 1);
+}
@@ -0,0 +1,251 @@
+#include "tracebuffer.hpp"
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+#include <sqlite3.h>
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+/**---------------------------------------------------------------------------*/
+
+// Converts the trace files written by Perfoscope in tracing mode, either to
+// text (records of all files merged in timestamp order) or to the tables
+// trace_record and trace_value of a SQLite db.
+
+struct TraceFile {
+  TraceFileHeader header;
+  std::string profile_name;
+  std::vector<std::string> category_names;
+  std::vector<std::string> event_names;
+  long long first;
+  std::vector<char> records;
+  
+  const TraceRecord & record(long long i) const {
+    return *reinterpret_cast<const TraceRecord*>(&records[i*header.record_size]);
+  }
+  
+  const long long * deltas(long long i) const {
+    return reinterpret_cast<const long long*>(&records[i*header.record_size] + sizeof(TraceRecord));
+  }
+  
+  long long count() const {
+    return records.size()/header.record_size;
+  }
+};
+
+struct TraceRecordRef {
+  long long timestamp;
+  int file;
+  long long index;
+  
+  bool operator<(const TraceRecordRef &rhs) const {
+    return (timestamp < rhs.timestamp || (timestamp == rhs.timestamp && file < rhs.file));
+  }
+};
+
+static void print_usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-o dbfile] tracefile...\n", name);
+}
+
+static int read_trace_file(const char *filename, TraceFile &trace) {
+  std::ifstream in(filename, std::ios::binary);
+  if(!in.read(reinterpret_cast<char*>(&trace.header), sizeof(TraceFileHeader))) {
+    fprintf(stderr, "Error reading trace file %s\n", filename);
+    return 1;
+  }
+  
+  const TraceFileHeader &header = trace.header;
+  if(std::memcmp(header.magic, TraceBuffer::magic(), sizeof(header.magic)) != 0 ||
+      header.version != TraceBuffer::version) {
+    fprintf(stderr, "Error reading trace file %s (not a trace file or unsupported version)\n", filename);
+    return 1;
+  }
+  
+  std::vector<char> names(header.names_size);
+  if(!in.read(names.data(), header.names_size)) {
+    fprintf(stderr, "Error reading names from trace file %s\n", filename);
+    return 1;
+  }
+  const char *name = names.data();
+  trace.profile_name = name;
+  name += trace.profile_name.size()+1;
+  for(int ci = 0; ci < header.ncategories; ++ci) {
+    trace.category_names.push_back(name);
+    name += trace.category_names.back().size()+1;
+  }
+  for(int ei = 0; ei < header.nevents; ++ei) {
+    trace.event_names.push_back(name);
+    name += trace.event_names.back().size()+1;
+  }
+  
+  // Read the last min(head, capacity) records in the order they were appended
+  const long long nrecords = std::min(header.head, header.capacity);
+  trace.first = header.head - nrecords;
+  trace.records.resize(nrecords*header.record_size);
+  for(long long i = 0; i < nrecords; ++i) {
+    const long long slot = (trace.first + i) & (header.capacity-1);
+    in.seekg(header.records_offset + slot*header.record_size);
+    if(!in.read(&trace.records[i*header.record_size], header.record_size)) {
+      fprintf(stderr, "Error reading records from trace file %s\n", filename);
+      return 1;
+    }
+  }
+  
+  return 0;
+}
+
+static void write_text(const std::vector<TraceFile> &traces) {
+  std::vector<TraceRecordRef> refs;
+  const int nfiles = traces.size();
+  for(int fi = 0; fi < nfiles; ++fi) {
+    for(long long i = 0; i < traces[fi].count(); ++i) {
+      refs.push_back({traces[fi].record(i).timestamp, fi, i});
+    }
+  }
+  std::sort(refs.begin(), refs.end());
+  
+  std::cout << "# proc_id thread_id seq timestamp[ns] duration[ns] category [event=delta ...]\n";
+  for(size_t ri = 0; ri < refs.size(); ++ri) {
+    const TraceFile &trace = traces[refs[ri].file];
+    const TraceRecord &record = trace.record(refs[ri].index);
+    const long long *deltas = trace.deltas(refs[ri].index);
+    std::cout << trace.header.proc_id << " " << trace.header.thread_id << " "
+      << trace.first + refs[ri].index << " " << record.timestamp << " " << record.duration << " "
+      << trace.category_names[record.category];
+    for(int ei = 0; ei < trace.header.nevents; ++ei) {
+      std::cout << " " << trace.event_names[ei] << "=" << deltas[ei];
+    }
+    std::cout << "\n";
+  }
+}
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+static int write_sqlite3db(const char *dbfilename, const std::vector<TraceFile> &traces) {
+  int sqlrc;
+  sqlite3 *db = nullptr;
+  sqlite3_stmt *record_stmt = nullptr;
+  sqlite3_stmt *value_stmt = nullptr;
+  
+  const char *schema =
+    "create table if not exists trace_record("
+    "profile text not null, "
+    "proc_id integer not null, "
+    "thread_id integer not null, "
+    "seq integer not null, "
+    "timestamp integer not null, "
+    "duration integer not null, "
+    "category text not null, "
+    "primary key(profile, proc_id, thread_id, seq));"
+    "create table if not exists trace_value("
+    "profile text not null, "
+    "proc_id integer not null, "
+    "thread_id integer not null, "
+    "seq integer not null, "
+    "event text not null, "
+    "value integer not null, "
+    "primary key(profile, proc_id, thread_id, seq, event));";
+  const char *record_query =
+    "insert or replace into trace_record(profile, proc_id, thread_id, seq, timestamp, duration, category) "
+    "values (?1, ?2, ?3, ?4, ?5, ?6, ?7);";
+  const char *value_query =
+    "insert or replace into trace_value(profile, proc_id, thread_id, seq, event, value) "
+    "values (?1, ?2, ?3, ?4, ?5, ?6);";
+  
+  if((sqlrc = sqlite3_open(dbfilename, &db)) == SQLITE_OK) {
+    if((sqlrc = sqlite3_exec(db, schema, nullptr, nullptr, nullptr)) == SQLITE_OK) {
+      if((sqlrc = sqlite3_prepare_v2(db, record_query, -1, &record_stmt, nullptr)) == SQLITE_OK) {
+        if((sqlrc = sqlite3_prepare_v2(db, value_query, -1, &value_stmt, nullptr)) == SQLITE_OK) {
+          if((sqlrc = sqlite3_exec(db, "begin transaction;", nullptr, nullptr, nullptr)) == SQLITE_OK) {
+            for(size_t fi = 0; fi < traces.size() && sqlrc == SQLITE_OK; ++fi) {
+              const TraceFile &trace = traces[fi];
+              for(long long i = 0; i < trace.count() && sqlrc == SQLITE_OK; ++i) {
+                const TraceRecord &record = trace.record(i);
+                const long long *deltas = trace.deltas(i);
+                sqlite3_bind_text(record_stmt, 1, trace.profile_name.c_str(), -1, SQLITE_STATIC);
+                sqlite3_bind_int(record_stmt, 2, trace.header.proc_id);
+                sqlite3_bind_int(record_stmt, 3, trace.header.thread_id);
+                sqlite3_bind_int64(record_stmt, 4, trace.first + i);
+                sqlite3_bind_int64(record_stmt, 5, record.timestamp);
+                sqlite3_bind_int64(record_stmt, 6, record.duration);
+                sqlite3_bind_text(record_stmt, 7, trace.category_names[record.category].c_str(), -1, SQLITE_STATIC);
+                if((sqlrc = sqlite3_step(record_stmt)) == SQLITE_DONE) {
+                  sqlrc = SQLITE_OK;
+                }
+                sqlite3_reset(record_stmt);
+                for(int ei = 0; ei < trace.header.nevents && sqlrc == SQLITE_OK; ++ei) {
+                  sqlite3_bind_text(value_stmt, 1, trace.profile_name.c_str(), -1, SQLITE_STATIC);
+                  sqlite3_bind_int(value_stmt, 2, trace.header.proc_id);
+                  sqlite3_bind_int(value_stmt, 3, trace.header.thread_id);
+                  sqlite3_bind_int64(value_stmt, 4, trace.first + i);
+                  sqlite3_bind_text(value_stmt, 5, trace.event_names[ei].c_str(), -1, SQLITE_STATIC);
+                  sqlite3_bind_int64(value_stmt, 6, deltas[ei]);
+                  if((sqlrc = sqlite3_step(value_stmt)) == SQLITE_DONE) {
+                    sqlrc = SQLITE_OK;
+                  }
+                  sqlite3_reset(value_stmt);
+                }
+              }
+            }
+            if(sqlrc == SQLITE_OK) {
+              sqlrc = sqlite3_exec(db, "commit transaction;", nullptr, nullptr, nullptr);
+            } else {
+              sqlite3_exec(db, "rollback transaction;", nullptr, nullptr, nullptr);
+            }
+          }
+        }
+      }
+    }
+  }
+  
+  if(sqlrc != SQLITE_OK) {
+    fprintf(stderr, "Error writing trace to db %s (error: %s, code: %d)\n", 
+      dbfilename, sqlite3_errstr(sqlrc), sqlrc);
+  }
+  
+  sqlite3_finalize(value_stmt);
+  sqlite3_finalize(record_stmt);
+  sqlite3_close(db);
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+int main(int argc, char *argv[]) {
+  const char *dbfilename = nullptr;
+  std::vector<TraceFile> traces;
+  
+  int ai = 1;
+  if(ai+1 < argc && std::strcmp(argv[ai], "-o") == 0) {
+    dbfilename = argv[ai+1];
+    ai += 2;
+  }
+  if(ai >= argc) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  
+  traces.resize(argc-ai);
+  for(int fi = 0; ai < argc; ++ai, ++fi) {
+    if(read_trace_file(argv[ai], traces[fi]) != 0) {
+      return 1;
+    }
+  }
+  
+  if(dbfilename == nullptr) {
+    write_text(traces);
+    return 0;
+  }
+  
+#ifdef USING_PERFOSCOPE_DBSTORE
+  return (write_sqlite3db(dbfilename, traces) == SQLITE_OK ? 0 : 1);
+#else // USING_PERFOSCOPE_DBSTORE
+  fprintf(stderr, "Error: %s was built without SQLite support\n", argv[0]);
+  return 1;
+#endif // USING_PERFOSCOPE_DBSTORE
+}
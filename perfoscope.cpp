@@ -5,36 +5,585 @@
 #include <fstream>
 #include <cstdio>
 #include <cstring>
+#include <climits>
+#include <algorithm>
 #include <cstdio>
 
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifdef USING_PERFOSCOPE_SAMPLING
+#include <map>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#endif // USING_PERFOSCOPE_SAMPLING
+
 /**---------------------------------------------------------------------------*/
 
 bool PerfoscopeUtil::s_initialized = false;
 bool PerfoscopeUtil::s_modified = false;
 int PerfoscopeUtil::s_owner_proc_id = 0;
+PerfoscopeUtil::RunDataMode PerfoscopeUtil::s_run_data_mode = PerfoscopeUtil::RUN_DATA_ALL;
+bool PerfoscopeUtil::s_verbose = false;
+PerfoscopeUtil::PersistenceMode PerfoscopeUtil::s_persistence_mode = PerfoscopeUtil::PERSIST_AT_FINALIZE;
+int PerfoscopeUtil::s_checkpoint_interval = 1;
+PerfoscopeUtil::StorageMode PerfoscopeUtil::s_storage_mode = PerfoscopeUtil::STORAGE_SHARED;
+long long PerfoscopeUtil::s_series_capacity = 0;
 PerfoscopeData PerfoscopeUtil::s_template;
+std::vector<int> PerfoscopeUtil::s_region_categories;
+bool PerfoscopeUtil::s_roofline = false;
+MachinePeaks PerfoscopeUtil::s_machine_peaks;
+std::vector<PerfoscopeUtil::RooflineEstimate> PerfoscopeUtil::s_roofline_estimates;
+bool PerfoscopeUtil::s_compensate_overhead = false;
+#ifdef USING_PERFOSCOPE_HWC
+bool PerfoscopeUtil::s_multiplex = false;
+long long PerfoscopeUtil::s_multiplex_time_slice = 0;
+std::vector<int> PerfoscopeUtil::s_event_group_sizes;
+std::vector<std::vector<std::string> > PerfoscopeUtil::s_event_groups;
+std::vector<int> PerfoscopeUtil::s_event_group_fits;
+int PerfoscopeUtil::s_event_group = -1;
+#endif // USING_PERFOSCOPE_HWC
+#ifdef USING_PERFOSCOPE_TRACE
+std::string PerfoscopeUtil::s_trace_file_prefix;
+long long PerfoscopeUtil::s_trace_capacity = 1LL << 16;
+#endif // USING_PERFOSCOPE_TRACE
+#ifdef USING_PERFOSCOPE_SAMPLING
+long long PerfoscopeUtil::s_sampling_interval = 1000;
+long long PerfoscopeUtil::s_sampling_capacity = 1LL << 14;
+int PerfoscopeUtil::s_sampling_frames = 8;
+#endif // USING_PERFOSCOPE_SAMPLING
 #ifdef USING_PERFOSCOPE_DBSTORE
 std::string PerfoscopeUtil::s_dbfilename;
 std::string PerfoscopeUtil::s_dbvfs;
+#ifdef USING_MPIC
+MPI_Comm PerfoscopeUtil::s_db_comm = MPI_COMM_NULL;
+#endif // USING_MPIC
 sqlite3 *PerfoscopeUtil::s_sqldb = nullptr;
 bool PerfoscopeUtil::s_forkeyon;
 
 const char * PerfoscopeUtil::s_create_new_run_query = 
 "insert into perf_run (run, size, profile_id) "
 "values ("
-"(select ifnull(max(r.run+1), 1) from perf_run r, perf_profile p where p.name=?2 and r.profile_id=p.id and r.size=?1), "
+"(select ifnull(max(r.run+1), 1) from perf_run r where r.profile_id=?2 and r.size=?1), "
 "?1, "
-"(select p.id from perf_profile p where p.name=?2));";
+"?2);";
 sqlite3_stmt * PerfoscopeUtil::s_create_new_run_stmt = nullptr;
 
 const char * PerfoscopeUtil::s_insert_value_query = 
 "insert into perf_value(proc_id, thread_id, profile_id, category_id, event_id, run_id, value) "
-"select ?1 as proc_id, ?2 as thread_id, p.id, c.id, e.id, ?3 as run_id, ?4 as value "
-"from perf_profile p, perf_category c, perf_event e "
-"where p.name=?5 and c.name=?6 and e.name=?7 and e.profile_id=p.id;";
+"values (?3, ?4, ?1, ?5, ?6, ?2, ?7);";
 sqlite3_stmt * PerfoscopeUtil::s_insert_value_stmt = nullptr;
+
+std::string PerfoscopeUtil::s_insert_values_query;
+sqlite3_stmt * PerfoscopeUtil::s_insert_values_stmt = nullptr;
+int PerfoscopeUtil::s_runs_since_checkpoint = 0;
+
+long long PerfoscopeUtil::s_profile_id = -1;
+std::vector<long long> PerfoscopeUtil::s_category_ids;
+std::vector<long long> PerfoscopeUtil::s_event_ids;
+std::vector<PerfoscopeUtil::BoundMetric> PerfoscopeUtil::s_bound_metrics;
+std::vector<long long> PerfoscopeUtil::s_metric_name_ids;
+long long PerfoscopeUtil::s_machine_id = -1;
 #endif // #ifdef USING_PERFOSCOPE_DBSTORE
 
+#ifdef USING_PERFOSCOPE_TSC
+namespace perfoscope_internal {
+
+bool tsc_enabled = false;
+double seconds_per_tick = 1e-9;
+long long tsc_base_ticks = 0;
+long long tsc_base_nanoseconds = 0;
+
+// The TSC is read right before and after CLOCK_MONOTONIC at the start and at 
+// the end of a 20 ms busy wait, the frequency follows from the midpoints.
+void calibrate_real_time() {
+  tsc_enabled = false;
+  seconds_per_tick = 1e-9;
+  if(!has_invariant_tsc()) {
+    return;
+  }
+  
+  unsigned int aux;
+  const long long start_before = __rdtscp(&aux);
+  const long long start_ns = monotonic_nanoseconds();
+  const long long start_after = __rdtscp(&aux);
+  long long end_ns = start_ns;
+  while(end_ns - start_ns < 20000000LL) {
+    end_ns = monotonic_nanoseconds();
+  }
+  const long long end_before = __rdtscp(&aux);
+  end_ns = monotonic_nanoseconds();
+  const long long end_after = __rdtscp(&aux);
+  
+  const long long start_ticks = start_before + (start_after - start_before)/2;
+  const long long end_ticks = end_before + (end_after - end_before)/2;
+  if(end_ticks <= start_ticks) {
+    return;
+  }
+  seconds_per_tick = double(end_ns - start_ns)*1e-9/double(end_ticks - start_ticks);
+  tsc_base_ticks = start_ticks;
+  tsc_base_nanoseconds = start_ns;
+  tsc_enabled = true;
+}
+
+}
+#endif // USING_PERFOSCOPE_TSC
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+namespace perfoscope_internal {
+
+// Layout of the statistics of one (category, event) value in a summary, the 
+// remaining summary_size-summary_histogram entries are the counts of a log 
+// histogram used as a quantile sketch. The variance is carried as the mean 
+// and the sum of squared deviations from it (m2), which are updated with 
+// Welford's method per value and merged with Chan's parallel formula, 
+// instead of a sum of squares that cancels for large values with a small 
+// spread.
+enum SummaryLayout {
+  summary_count = 0, 
+  summary_min, 
+  summary_min_proc, 
+  summary_max, 
+  summary_max_proc, 
+  summary_sum, 
+  summary_mean, 
+  summary_m2, 
+  summary_histogram, 
+  summary_size = summary_histogram + log_histogram_size
+};
+
+inline void summary_merge(const double *in, double *inout) {
+  if(in[summary_count] == 0.0) {
+    return;
+  }
+  if(inout[summary_count] == 0.0) {
+    std::memcpy(inout, in, summary_size*sizeof(double));
+    return;
+  }
+  if(in[summary_min] < inout[summary_min] || (in[summary_min] == inout[summary_min] && 
+      in[summary_min_proc] < inout[summary_min_proc])) {
+    inout[summary_min] = in[summary_min];
+    inout[summary_min_proc] = in[summary_min_proc];
+  }
+  if(in[summary_max] > inout[summary_max] || (in[summary_max] == inout[summary_max] && 
+      in[summary_max_proc] < inout[summary_max_proc])) {
+    inout[summary_max] = in[summary_max];
+    inout[summary_max_proc] = in[summary_max_proc];
+  }
+  const double count = inout[summary_count] + in[summary_count];
+  const double delta = in[summary_mean] - inout[summary_mean];
+  inout[summary_m2] += in[summary_m2] + delta*delta*inout[summary_count]*in[summary_count]/count;
+  inout[summary_mean] += delta*in[summary_count]/count;
+  inout[summary_count] = count;
+  inout[summary_sum] += in[summary_sum];
+  for(int bi = summary_histogram; bi < summary_size; ++bi) {
+    inout[bi] += in[bi];
+  }
+}
+
+inline double summary_quantile(const double *summary, double q) {
+  const double target = q*summary[summary_count];
+  double cumulative = 0.0;
+  for(int bi = 0; bi < log_histogram_size; ++bi) {
+    cumulative += summary[summary_histogram+bi];
+    if(cumulative >= target && summary[summary_histogram+bi] > 0.0) {
+      double value = 0.5*(log_histogram_lower(bi) + log_histogram_upper(bi));
+      if(value < summary[summary_min]) {
+        value = summary[summary_min];
+      }
+      if(value > summary[summary_max]) {
+        value = summary[summary_max];
+      }
+      return value;
+    }
+  }
+  return summary[summary_max];
+}
+
+#ifdef USING_MPIC
+void summary_reduce(void *in, void *inout, int *len, MPI_Datatype *datatype) {
+  const double *in_summary = static_cast<const double*>(in);
+  double *inout_summary = static_cast<double*>(inout);
+  for(int i = 0; i < *len; ++i) {
+    summary_merge(in_summary + i*summary_size, inout_summary + i*summary_size);
+  }
+}
+#endif // USING_MPIC
+
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+int PerfoscopeUtil::register_region(const char *name, unsigned long long hash) {
+  std::vector<RegionName> &regions = region_registry();
+  const int nregions = regions.size();
+  for(int ri = 0; ri < nregions; ++ri) {
+    if(regions[ri].hash == hash && regions[ri].name == name) {
+      return ri;
+    }
+  }
+  if(s_initialized) {
+    print_error(__FILE__, __LINE__, "%s - Region '%s' is registered after init, declare it at namespace scope", 
+      __PRETTY_FUNCTION__, name);
+    perfoscope_internal::abort(-1);
+  }
+  regions.push_back({name, hash});
+  return nregions;
+}
+
+void PerfoscopeUtil::fail_region(const int region_id) {
+  print_error(__FILE__, __LINE__, "%s - Region '%s' is used before init", 
+    __PRETTY_FUNCTION__, region_registry()[region_id].name.c_str());
+  perfoscope_internal::abort(-1);
+}
+
+// A region with the name of a category passed to init is charged to that 
+// category, the other regions are added as categories in registration order.
+void PerfoscopeUtil::add_region_categories(const char *file, const int line) {
+  const std::vector<RegionName> &regions = region_registry();
+  const int nregions = regions.size();
+  std::vector<unsigned long long> category_hashes;
+  for(int ci = 0; ci < s_template.categories_count(); ++ci) {
+    category_hashes.push_back(perfoscope_internal::fnv1a(s_template.category_name(ci).c_str()));
+  }
+  
+  s_region_categories.assign(nregions, -1);
+  for(int ri = 0; ri < nregions; ++ri) {
+    const int ncategories = category_hashes.size();
+    for(int ci = 0; ci < ncategories; ++ci) {
+      if(category_hashes[ci] == regions[ri].hash) {
+        if(s_template.category_name(ci) != regions[ri].name) {
+          print_error(file, line, "%s - Region '%s' and category '%s' have the same hash %llx", 
+            __PRETTY_FUNCTION__, regions[ri].name.c_str(), s_template.category_name(ci).c_str(), regions[ri].hash);
+          perfoscope_internal::abort(-1);
+        }
+        s_region_categories[ri] = ci;
+        break;
+      }
+    }
+    if(s_region_categories[ri] < 0) {
+      s_region_categories[ri] = s_template.add_category(regions[ri].name);
+      category_hashes.push_back(regions[ri].hash);
+    }
+  }
+}
+
+std::vector<PerfoscopeUtil::Metric> & PerfoscopeUtil::metric_registry() {
+  static std::vector<Metric> registry;
+  static bool defaults_added = false;
+  if(!defaults_added) {
+    defaults_added = true;
+    std::stringstream line_strm;
+    line_strm << "*" << PERFOSCOPE_CACHE_LINE;
+    const std::string line = line_strm.str();
+    // FLOP and the bytes moved from a level are the roofline of a category
+    const std::string defaults[][2] = {
+      {"IPC", "PAPI_TOT_INS/PAPI_TOT_CYC"}, 
+      {"GHz", "PAPI_TOT_CYC/time/1e9"}, 
+      {"GFLOP/s", "PAPI_FP_OPS/time/1e9"}, 
+      {"DP GFLOP/s", "PAPI_DP_OPS/time/1e9"}, 
+      {"SP GFLOP/s", "PAPI_SP_OPS/time/1e9"}, 
+      {"L1D miss ratio", "PAPI_L1_DCM/PAPI_L1_DCA"}, 
+      {"L2D miss ratio", "PAPI_L2_DCM/PAPI_L2_DCA"}, 
+      {"L3 miss ratio", "PAPI_L3_TCM/PAPI_L3_TCA"}, 
+      {"L3 miss GB/s", "PAPI_L3_TCM" + line + "/time/1e9"}, 
+      {"branch miss ratio", "PAPI_BR_MSP/PAPI_BR_CN"}, 
+      {"FLOP", "PAPI_FP_OPS"}, 
+      {"L2 bytes", "PAPI_L1_DCM" + line}, 
+      {"L3 bytes", "PAPI_L2_TCM" + line}, 
+      {"memory bytes", "PAPI_L3_TCM" + line}
+    };
+    for(size_t mi = 0; mi < sizeof(defaults)/sizeof(defaults[0]); ++mi) {
+      registry.push_back(Metric());
+      registry.back().name = defaults[mi][0];
+      registry.back().formula.parse(defaults[mi][1]);
+    }
+  }
+  return registry;
+}
+
+void PerfoscopeUtil::add_metric(const char *name, const char *formula, 
+    const char *file, const int line) {
+  std::vector<Metric> &metrics = metric_registry();
+  Metric metric;
+  metric.name = name;
+  const int error_pos = metric.formula.parse(formula);
+  if(error_pos != 0) {
+    print_error(file, line, "%s - Could not parse formula '%s' of metric '%s' at position %d", 
+      __PRETTY_FUNCTION__, formula, name, error_pos);
+    perfoscope_internal::abort(-1);
+  }
+  
+  for(size_t mi = 0; mi < metrics.size(); ++mi) {
+    if(metrics[mi].name == metric.name) {
+      metrics[mi].formula = metric.formula;
+      return;
+    }
+  }
+  metrics.push_back(metric);
+}
+
+std::vector<PerfoscopeUtil::BoundMetric> PerfoscopeUtil::bind_metrics(const PerfoscopeData &data) {
+  std::vector<BoundMetric> bound;
+  std::vector<std::string> names;
+  const int nevents = data.events_count();
+  for(int ei = 0; ei < nevents; ++ei) {
+    names.push_back(data.event_name(ei));
+  }
+#ifdef USING_PERFOSCOPE_WCT
+  names.push_back("time");
+#endif // #ifdef USING_PERFOSCOPE_WCT
+  
+  BoundMetric metric;
+  for(metric.metric = 0; metric.metric < metrics_count(); ++metric.metric) {
+    if(metric_formula(metric.metric).bind(names, metric.columns)) {
+      bound.push_back(metric);
+    }
+  }
+  return bound;
+}
+
+void PerfoscopeUtil::roofline_estimate(const char *category, double flop, double bytes) {
+  for(size_t ri = 0; ri < s_roofline_estimates.size(); ++ri) {
+    if(s_roofline_estimates[ri].category == category) {
+      s_roofline_estimates[ri].flop = flop;
+      s_roofline_estimates[ri].bytes = bytes;
+      return;
+    }
+  }
+  s_roofline_estimates.push_back({category, flop, bytes});
+}
+
+bool PerfoscopeUtil::roofline_estimate(const std::string &category, double *flop, double *bytes) {
+  for(size_t ri = 0; ri < s_roofline_estimates.size(); ++ri) {
+    if(s_roofline_estimates[ri].category == category) {
+      *flop = s_roofline_estimates[ri].flop;
+      *bytes = s_roofline_estimates[ri].bytes;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void pack_machine_peaks(const MachinePeaks &peaks, double *packed) {
+  packed[0] = peaks.nthreads;
+  packed[1] = peaks.gflops;
+  for(int li = 0; li < MachinePeaks::nlevels; ++li) {
+    packed[2+li] = peaks.level_sizes[li];
+    packed[2+MachinePeaks::nlevels+li] = peaks.bandwidths[li];
+  }
+}
+
+static void unpack_machine_peaks(const double *packed, MachinePeaks &peaks) {
+  peaks.nthreads = packed[0];
+  peaks.gflops = packed[1];
+  for(int li = 0; li < MachinePeaks::nlevels; ++li) {
+    peaks.level_sizes[li] = packed[2+li];
+    peaks.bandwidths[li] = packed[2+MachinePeaks::nlevels+li];
+  }
+}
+
+// The owner process of the db measures the peaks if the db has none for its 
+// host and the build of the kernels and shares them with the processes of 
+// the db
+void PerfoscopeUtil::select_machine_peaks(const char *file, const int line) {
+  double packed[2+MachinePeaks::nlevels*2] = {0.0};
+#ifdef USING_PERFOSCOPE_DBSTORE
+  const bool owner = (db_proc_id() == s_owner_proc_id);
+#ifdef USING_MPIC
+  if(s_storage_mode == STORAGE_SHARD_PER_PROCESS) {
+    select_node_machine_peaks(file, line);
+    return;
+  }
+#endif // USING_MPIC
+#else // USING_PERFOSCOPE_DBSTORE
+  const bool owner = (perfoscope_internal::iproc() == s_owner_proc_id);
+#endif // USING_PERFOSCOPE_DBSTORE
+  
+  if(owner) {
+    char host[256] = {0};
+    gethostname(host, sizeof(host)-1);
+    s_machine_peaks = MachinePeaks();
+#ifdef USING_PERFOSCOPE_DBSTORE
+    int sqlrc;
+    if((sqlrc = select_perf_machine(host, Roofline::build(), s_machine_peaks, &s_machine_id)) != SQLITE_OK) {
+      perfoscope_internal::abort(sqlrc);
+    }
+    if(s_machine_id < 0) {
+      measure_machine_peaks();
+      store_machine_peaks(file, line);
+    }
+#else // USING_PERFOSCOPE_DBSTORE
+    measure_machine_peaks();
+#endif // USING_PERFOSCOPE_DBSTORE
+    pack_machine_peaks(s_machine_peaks, packed);
+  }
+  
+#ifdef USING_MPIC
+#ifdef USING_PERFOSCOPE_DBSTORE
+  MPI_Bcast(packed, 2+MachinePeaks::nlevels*2, MPI_DOUBLE, s_owner_proc_id, s_db_comm);
+#else // USING_PERFOSCOPE_DBSTORE
+  MPI_Bcast(packed, 2+MachinePeaks::nlevels*2, MPI_DOUBLE, s_owner_proc_id, MPI_COMM_WORLD);
+#endif // USING_PERFOSCOPE_DBSTORE
+#endif // USING_MPIC
+  
+  if(!owner) {
+    unpack_machine_peaks(packed, s_machine_peaks);
+  }
+}
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+#ifdef USING_MPIC
+// With a shard per process every process owns a db. The kernels use all 
+// cores of a node, so only the first process of a node runs them, if a 
+// shard of the node has no peaks, and the shards without peaks store its 
+// peaks.
+void PerfoscopeUtil::select_node_machine_peaks(const char *file, const int line) {
+  double packed[2+MachinePeaks::nlevels*2] = {0.0};
+  char host[256] = {0};
+  gethostname(host, sizeof(host)-1);
+  s_machine_peaks = MachinePeaks();
+  int sqlrc;
+  if((sqlrc = select_perf_machine(host, Roofline::build(), s_machine_peaks, &s_machine_id)) != SQLITE_OK) {
+    perfoscope_internal::abort(sqlrc);
+  }
+  
+  MPI_Comm node_comm;
+  int node_proc_id;
+  int missing = (s_machine_id < 0 ? 1 : 0);
+  int nmissing = 0;
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, perfoscope_internal::iproc(), MPI_INFO_NULL, &node_comm);
+  MPI_Comm_rank(node_comm, &node_proc_id);
+  MPI_Allreduce(&missing, &nmissing, 1, MPI_INT, MPI_SUM, node_comm);
+  if(nmissing > 0) {
+    if(node_proc_id == 0) {
+      if(missing) {
+        measure_machine_peaks();
+      }
+      pack_machine_peaks(s_machine_peaks, packed);
+    }
+    MPI_Bcast(packed, 2+MachinePeaks::nlevels*2, MPI_DOUBLE, 0, node_comm);
+    if(missing) {
+      if(node_proc_id != 0) {
+        s_machine_peaks.host = host;
+        s_machine_peaks.build = Roofline::build();
+        unpack_machine_peaks(packed, s_machine_peaks);
+      }
+      store_machine_peaks(file, line);
+    }
+  }
+  MPI_Comm_free(&node_comm);
+}
+#endif // USING_MPIC
+#endif // USING_PERFOSCOPE_DBSTORE
+
+void PerfoscopeUtil::measure_machine_peaks() {
+  Roofline::characterize(s_machine_peaks);
+  if(s_verbose) {
+    fprintf(stdout, "Measured the peaks of %s with %d threads: %g GFLOP/s", 
+      s_machine_peaks.host.c_str(), s_machine_peaks.nthreads, s_machine_peaks.gflops);
+    for(int li = 0; li < MachinePeaks::nlevels; ++li) {
+      fprintf(stdout, ", %s %g GB/s", Roofline::level_name(li), s_machine_peaks.bandwidths[li]);
+    }
+    fprintf(stdout, " (%s)\n", s_machine_peaks.build.c_str());
+  }
+}
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+void PerfoscopeUtil::store_machine_peaks(const char *file, const int line) {
+  int sqlrc;
+  if((sqlrc = insert_into_perf_machine(s_machine_peaks, &s_machine_id)) != SQLITE_OK) {
+    print_error(file, line, "Could not store the peaks of %s (error: %s, code: %d)", 
+      s_machine_peaks.host.c_str(), sqlite3_errstr(sqlrc), sqlrc);
+    perfoscope_internal::abort(sqlrc);
+  }
+  s_modified = true;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_HWC
+// Splits the events into the groups and dry-runs every group on an eventset 
+// of the calling thread, a group fits if it fits on all processes.
+void PerfoscopeUtil::add_event_groups(const char *events[], const int nevents, 
+    const char *file, const int line) {
+  const int ngroups = s_event_group_sizes.size();
+  int ngrouped = 0;
+  s_event_groups.clear();
+  for(int gi = 0; gi < ngroups; ++gi) {
+    if(s_event_group_sizes[gi] < 1 || ngrouped + s_event_group_sizes[gi] > nevents) {
+      break;
+    }
+    s_event_groups.push_back(std::vector<std::string>(events + ngrouped, events + ngrouped + s_event_group_sizes[gi]));
+    ngrouped += s_event_group_sizes[gi];
+  }
+  if((int)s_event_groups.size() != ngroups || ngrouped != nevents) {
+    print_error(file, line, "%s - The sizes of the event groups do not add up to the %d events", 
+      __PRETTY_FUNCTION__, nevents);
+    perfoscope_internal::abort(-1);
+  }
+  
+  s_event_group_fits.assign(ngroups, 1);
+  for(int gi = 0; gi < ngroups; ++gi) {
+    int eventset = PAPI_NULL;
+    int errcode = PAPI_create_eventset(&eventset);
+    if(errcode == PAPI_OK && s_multiplex) {
+      if((errcode = PAPI_assign_eventset_component(eventset, 0)) == PAPI_OK) {
+        errcode = PAPI_set_multiplex(eventset);
+      }
+    }
+    for(size_t ei = 0; ei < s_event_groups[gi].size() && errcode == PAPI_OK; ++ei) {
+      int eventcode;
+      const char *event_name = s_event_groups[gi][ei].c_str();
+      if((errcode = PAPI_event_name_to_code(const_cast<char*>(event_name), &eventcode)) == PAPI_OK) {
+        errcode = PAPI_add_event(eventset, eventcode);
+      }
+      if(errcode != PAPI_OK) {
+        print_error(file, line, "%s - Event group %d does not fit, could not add event %s, PAPI errorcode: %d, PAPI error: %s", 
+          __PRETTY_FUNCTION__, gi, event_name, errcode, PAPI_strerror(errcode));
+      }
+    }
+    s_event_group_fits[gi] = (errcode == PAPI_OK ? 1 : 0);
+    if(eventset != PAPI_NULL) {
+      PAPI_cleanup_eventset(eventset);
+      PAPI_destroy_eventset(&eventset);
+    }
+  }
+#ifdef USING_MPIC
+  MPI_Allreduce(MPI_IN_PLACE, s_event_group_fits.data(), ngroups, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+#endif // USING_MPIC
+  
+  if(std::find(s_event_group_fits.begin(), s_event_group_fits.end(), 1) == s_event_group_fits.end()) {
+    print_error(file, line, "%s - None of the %d event groups fits", __PRETTY_FUNCTION__, ngroups);
+    perfoscope_internal::abort(-1);
+  }
+}
+
+// Adds the events of the first group that fits after the group of the last 
+// run of the profile, the owner process decides for all processes.
+void PerfoscopeUtil::select_event_group(const char *file, const int line) {
+  int last_group = -1;
+#ifdef USING_PERFOSCOPE_DBSTORE
+  if(db_proc_id() == s_owner_proc_id) {
+    int sqlrc = select_last_event_group(s_template.profile_name().c_str(), &last_group);
+    if(sqlrc != SQLITE_OK) {
+      perfoscope_internal::abort(sqlrc);
+    }
+  }
+#endif // USING_PERFOSCOPE_DBSTORE
+#ifdef USING_MPIC
+  MPI_Bcast(&last_group, 1, MPI_INT, s_owner_proc_id, MPI_COMM_WORLD);
+#endif // USING_MPIC
+  
+  const int ngroups = s_event_groups.size();
+  s_event_group = (last_group + 1) % ngroups;
+  while(!s_event_group_fits[s_event_group]) {
+    s_event_group = (s_event_group + 1) % ngroups;
+  }
+  for(size_t ei = 0; ei < s_event_groups[s_event_group].size(); ++ei) {
+    s_template.add_event(s_event_groups[s_event_group][ei], file, line);
+  }
+}
+#endif // USING_PERFOSCOPE_HWC
+
 const PerfoscopeData& PerfoscopeUtil::init(
     const char *profile,
     const char *categories[],
@@ -55,11 +604,24 @@ const PerfoscopeData& PerfoscopeUtil::init(
     for(int i = 0; i < ncategories; ++i) {
       s_template.add_category(categories[i]);
     }
+    add_region_categories(file, line);
     
     int iproc = perfoscope_internal::iproc();
     int nproc = perfoscope_internal::nproc();
     int *int_recvbuf = new int[nproc];
     
+    perfoscope_internal::calibrate_real_time();
+#ifdef USING_PERFOSCOPE_TSC
+    if(s_verbose && iproc == s_owner_proc_id) {
+      if(perfoscope_internal::tsc_enabled) {
+        fprintf(stdout, "Measuring real time with the TSC (%g GHz)\n", 
+          1e-9/perfoscope_internal::seconds_per_tick);
+      } else {
+        fprintf(stdout, "No invariant TSC, measuring real time with clock_gettime\n");
+      }
+    }
+#endif // USING_PERFOSCOPE_TSC
+    
 #ifdef USING_PERFOSCOPE_DBSTORE
     s_dbfilename = (dbfilename == nullptr ? "perf.db" : dbfilename);
     s_dbvfs = (dbvfs == nullptr ? "unix-none" : dbvfs);
@@ -77,11 +639,26 @@ const PerfoscopeData& PerfoscopeUtil::init(
         if(errcode != PAPI_OK) {
           print_error(file, line, "%s - Could not initialize PAPI thread support on process %d, PAPI errorcode: %d, PAPI error: %s", 
             __PRETTY_FUNCTION__, iproc, errcode, PAPI_strerror(errcode));
+        } else if(s_multiplex) {
+          errcode = PAPI_multiplex_init();
+          if(errcode != PAPI_OK) {
+            print_error(file, line, "%s - Could not initialize PAPI multiplexing on process %d, PAPI errorcode: %d, PAPI error: %s", 
+              __PRETTY_FUNCTION__, iproc, errcode, PAPI_strerror(errcode));
+          } else if(s_multiplex_time_slice > 0) {
+            PAPI_option_t option;
+            std::memset(&option, 0, sizeof(option));
+            option.multiplex.ns = s_multiplex_time_slice*1000;
+            errcode = PAPI_set_opt(PAPI_DEF_MPX_NS, &option);
+            if(errcode != PAPI_OK) {
+              print_error(file, line, "%s - Could not set the PAPI multiplexing time slice on process %d, PAPI errorcode: %d, PAPI error: %s", 
+                __PRETTY_FUNCTION__, iproc, errcode, PAPI_strerror(errcode));
+            }
+          }
         }
       }
       
 #ifdef USING_MPIC
-      MPI_Alltoall(&errcode, 1, MPI_INT, int_recvbuf, nproc, MPI_INT, MPI_COMM_WORLD);
+      MPI_Allgather(&errcode, 1, MPI_INT, int_recvbuf, 1, MPI_INT, MPI_COMM_WORLD);
 #else // #ifdef USING_MPIC
       int_recvbuf[0] = errcode;
 #endif // #ifdef USING_MPIC
@@ -92,8 +669,16 @@ const PerfoscopeData& PerfoscopeUtil::init(
       }
     }
     
-    for(int i = 0; i < nevents; ++i) {
-      s_template.add_event(events[i]);
+    s_event_group = -1;
+    if(s_event_group_sizes.empty()) {
+      for(int i = 0; i < nevents; ++i) {
+        s_template.add_event(events[i]);
+      }
+    } else {
+      add_event_groups(events, nevents, file, line);
+#ifndef USING_PERFOSCOPE_DBSTORE
+      select_event_group(file, line);
+#endif // USING_PERFOSCOPE_DBSTORE
     }
 #endif // #ifdef USING_PERFOSCOPE_HWC
     
@@ -112,7 +697,7 @@ const PerfoscopeData& PerfoscopeUtil::init(
       }
       
       int events_count = s_template.events_count();
-      MPI_Alltoall(&events_count, 1, MPI_INT, int_recvbuf, nproc, MPI_INT, MPI_COMM_WORLD);
+      MPI_Allgather(&events_count, 1, MPI_INT, int_recvbuf, 1, MPI_INT, MPI_COMM_WORLD);
       for(int i = 0; i < nproc; ++i) {
         if(int_recvbuf[i] != events_count) {
           print_error(file, line, "%s - Number of events do not match on process %d", __PRETTY_FUNCTION__, i);
@@ -133,7 +718,7 @@ const PerfoscopeData& PerfoscopeUtil::init(
       }
       
       int categories_count = s_template.categories_count();
-      MPI_Alltoall(&categories_count, 1, MPI_INT, int_recvbuf, nproc, MPI_INT, MPI_COMM_WORLD);
+      MPI_Allgather(&categories_count, 1, MPI_INT, int_recvbuf, 1, MPI_INT, MPI_COMM_WORLD);
       for(int i = 0; i < nproc; ++i) {
         if(int_recvbuf[i] != categories_count) {
           print_error(file, line, "%s - Number of categories do not match on process %d", __PRETTY_FUNCTION__, iproc);
@@ -158,6 +743,23 @@ const PerfoscopeData& PerfoscopeUtil::init(
 #ifdef USING_PERFOSCOPE_DBSTORE
     {
       int sqlrc;
+      int shard_id = iproc;
+#ifdef USING_MPIC
+      if(s_storage_mode == STORAGE_SHARD_PER_PROCESS) {
+        MPI_Comm_dup(MPI_COMM_SELF, &s_db_comm);
+      } else if(s_storage_mode == STORAGE_SHARD_PER_NODE) {
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, iproc, MPI_INFO_NULL, &s_db_comm);
+      } else {
+        MPI_Comm_dup(MPI_COMM_WORLD, &s_db_comm);
+      }
+      MPI_Bcast(&shard_id, 1, MPI_INT, s_owner_proc_id, s_db_comm);
+#endif // USING_MPIC
+      if(s_storage_mode != STORAGE_SHARED) {
+        std::stringstream strm;
+        strm << s_dbfilename << ".shard" << shard_id;
+        s_dbfilename = strm.str();
+      }
+      
       if((sqlrc = open_sqlite3db()) != SQLITE_OK) {
         print_error(file, line, "Could not create perfdata data store (error: %s, code: %d)", sqlite3_errstr(sqlrc), sqlrc);
         perfoscope_internal::abort(sqlrc);
@@ -170,28 +772,43 @@ const PerfoscopeData& PerfoscopeUtil::init(
         perfoscope_internal::abort(sqlrc);
       }
       
+#ifdef USING_PERFOSCOPE_HWC
+      // The group follows the group of the last run in the db
+      if(!s_event_group_sizes.empty()) {
+        select_event_group(file, line);
+      }
+#endif // USING_PERFOSCOPE_HWC
+      
       if((sqlrc = insert_perfoscope_data_profile(s_template)) != SQLITE_OK) {
         print_error(file, line, "Could not create perfdata profile (error: %s, code: %d)", sqlite3_errstr(sqlrc), sqlrc);
         perfoscope_internal::abort(sqlrc);
       }
       
-      if((sqlrc = sqlite3_prepare_v2(s_sqldb, s_create_new_run_query, -1, &s_create_new_run_stmt, NULL)) != SQLITE_OK) {
-        print_error(file, line, "Could not create statement for creating new perfdata run (error: %s, code: %d)", sqlite3_errstr(sqlrc), sqlrc);
-        print_error(file, line, "Query: %s", s_create_new_run_query);
+      s_bound_metrics = bind_metrics(s_template);
+      
+      if((sqlrc = insert_perf_metric_names()) != SQLITE_OK) {
+        print_error(file, line, "Could not create metric names (error: %s, code: %d)", sqlite3_errstr(sqlrc), sqlrc);
         perfoscope_internal::abort(sqlrc);
       }
       
-      if((sqlrc = sqlite3_prepare_v2(s_sqldb, s_insert_value_query, -1, &s_insert_value_stmt, NULL)) != SQLITE_OK) {
-        print_error(file, line, "Could not create statement for inserting perfdata value (error: %s, code: %d)", sqlite3_errstr(sqlrc), sqlrc);
-        print_error(file, line, "Query: %s", s_insert_value_query);
+      if(s_roofline) {
+        select_machine_peaks(file, line);
+      }
+      
+      if((sqlrc = prepare_sqlite3_statements()) != SQLITE_OK) {
+        print_error(file, line, "Could not create perfdata statements (error: %s, code: %d)", sqlite3_errstr(sqlrc), sqlrc);
         perfoscope_internal::abort(sqlrc);
       }
     }
 #endif // #ifdef USING_PERFOSCOPE_DBSTORE
     
-#ifdef USING_MPIC
+#ifndef USING_PERFOSCOPE_DBSTORE
+    if(s_roofline) {
+      select_machine_peaks(file, line);
+    }
+#endif // USING_PERFOSCOPE_DBSTORE
+    
     delete[] int_recvbuf;
-#endif // #ifdef USING_MPIC
   }
   
   return s_template;
@@ -200,7 +817,17 @@ const PerfoscopeData& PerfoscopeUtil::init(
 void PerfoscopeUtil::finalize(const char *file, const int line) {
   if(s_initialized) {
 #ifdef USING_PERFOSCOPE_DBSTORE
-    if(s_modified) {
+#ifdef USING_MPIC
+    int modified = s_modified;
+    MPI_Bcast(&modified, 1, MPI_INT, s_owner_proc_id, s_db_comm);
+    s_modified = modified;
+#endif // USING_MPIC
+    if(s_persistence_mode == PERSIST_STREAMING) {
+      if(db_proc_id() == s_owner_proc_id) {
+        checkpoint_sqlite3db();
+      }
+      s_modified = false;
+    } else if(s_modified) {
       store_sqlite3db();
       s_modified = false;
     } else {
@@ -213,7 +840,20 @@ void PerfoscopeUtil::finalize(const char *file, const int line) {
     sqlite3_finalize(s_insert_value_stmt);
     s_insert_value_stmt = nullptr;
     
+    sqlite3_finalize(s_insert_values_stmt);
+    s_insert_values_stmt = nullptr;
+    
+    s_profile_id = -1;
+    s_category_ids.clear();
+    s_event_ids.clear();
+    s_bound_metrics.clear();
+    s_metric_name_ids.clear();
+    s_machine_id = -1;
+    
     close_sqlite3db();
+#ifdef USING_MPIC
+    MPI_Comm_free(&s_db_comm);
+#endif // USING_MPIC
 #endif // #ifdef USING_PERFOSCOPE_DBSTORE
     s_initialized = false;
   }
@@ -240,26 +880,97 @@ void PerfoscopeUtil::add_run_data(
 //  perfdata_ffile.close();
   
 #ifdef USING_PERFOSCOPE_DBSTORE
-  int sqlrc;
+  int sqlrc = SQLITE_OK;
   long long run_id;
-  bool run_created = false;
+  std::vector<char> buffer;
+  std::vector<size_t> offsets;
+  std::vector<double> summary;
   
-  for(int i = 0; i < count; ++i) {
-    if(perfoscope_data_list[i] != nullptr) {
-      if((sqlrc = create_new_run(perfoscope_data_list[i]->profile_name().c_str(), problem_size, &run_id)) == SQLITE_OK) {
-        run_created = true;
-        s_modified = true;
-        break;
-      } else {
-        print_error(__FILE__, __LINE__, "Failed to create a new run (error: %s, code: %d)", sqlite3_errstr(sqlrc), sqlrc);
-      }
-    }
+  // In RUN_DATA_ALL mode the data of all threads of a process is packed in 
+  // a single message and gathered on the owner process with one collective 
+  // call, in RUN_DATA_SUMMARY mode it is reduced to statistics on the way.
+  const bool summarize = (s_run_data_mode == RUN_DATA_SUMMARY && s_storage_mode == STORAGE_SHARED);
+  perfoscope_internal::real_time_t start_time = perfoscope_internal::get_real_time();
+  long long nthreads = 0;
+  if(summarize) {
+    nthreads = summarize_perfoscope_data(perfoscope_data_list, count, summary);
+  } else {
+    pack_perfoscope_data(perfoscope_data_list, count, buffer);
+    gather_perfoscope_data(buffer, offsets);
   }
   
-  if(run_created) {
-    for(int i = 0; i < count; ++i) {
-      if(perfoscope_data_list[i] != nullptr) {
-        add_perfoscope_data(*perfoscope_data_list[i], run_id);
+  if(db_proc_id() == s_owner_proc_id) {
+    const int nproc = db_nproc();
+    std::vector<PerfValueRow> rows;
+    std::vector<PerfPathRow> paths;
+    std::vector<PerfThreadRow> threads;
+    std::vector<PerfSampleRow> samples;
+    std::vector<PerfCallRow> calls;
+    std::vector<PerfSeriesRow> series;
+    std::vector<PerfCoverageRow> coverage;
+    std::vector<PerfMetricRow> metrics;
+    std::vector<PerfOverheadRow> overheads;
+    std::vector<PerfValueRow> compensated;
+    long long nvalues = 0;
+    if(summarize) {
+      nvalues = summary.size()/perfoscope_internal::summary_size;
+    } else {
+      for(int pi = 0; pi < nproc; ++pi) {
+        nthreads += unpack_perfoscope_data(&buffer[offsets[pi]], rows, paths, threads, samples, calls, series, coverage, 
+          metrics, overheads, compensated);
+      }
+      nvalues = rows.size();
+    }
+    perfoscope_internal::real_time_t collect_time = perfoscope_internal::get_real_time();
+    
+    // The whole run is written in a single transaction
+    if(nthreads > 0) {
+      if((sqlrc = begin_transaction()) == SQLITE_OK) {
+        if((sqlrc = create_new_run(s_profile_id, problem_size, &run_id)) == SQLITE_OK) {
+          s_modified = true;
+          if(summarize) {
+            sqlrc = insert_into_perf_summary(run_id, summary);
+          } else if((sqlrc = insert_into_perf_value(s_profile_id, run_id, rows)) == SQLITE_OK) {
+            if((sqlrc = insert_into_perf_path(run_id, paths)) == SQLITE_OK) {
+              if((sqlrc = insert_into_perf_thread(run_id, threads)) == SQLITE_OK) {
+                if((sqlrc = insert_into_perf_sample(run_id, samples)) == SQLITE_OK) {
+                  if((sqlrc = insert_into_perf_call(run_id, calls)) == SQLITE_OK) {
+                    if((sqlrc = insert_into_perf_series(run_id, series)) == SQLITE_OK) {
+                      if((sqlrc = insert_into_perf_run_event_coverage(run_id, coverage)) == SQLITE_OK) {
+                        if((sqlrc = insert_into_perf_metric(run_id, metrics)) == SQLITE_OK) {
+                          if((sqlrc = insert_into_perf_call_overhead(run_id, overheads)) == SQLITE_OK) {
+                            sqlrc = insert_into_perf_compensated_value(run_id, compensated);
+                          }
+                        }
+                      }
+                    }
+                  }
+                }
+              }
+            }
+          }
+        } else {
+          print_error(__FILE__, __LINE__, "Failed to create a new run (error: %s, code: %d)", sqlite3_errstr(sqlrc), sqlrc);
+        }
+        sqlrc = end_transaction(sqlrc);
+      }
+      
+      if(sqlrc == SQLITE_OK && s_persistence_mode == PERSIST_STREAMING) {
+        if(++s_runs_since_checkpoint >= s_checkpoint_interval) {
+          sqlrc = checkpoint_sqlite3db();
+        }
+      }
+      
+      if(sqlrc != SQLITE_OK) {
+        print_error(__FILE__, __LINE__, "Error adding run data to db (error: %s, code: %d)", 
+          sqlite3_errstr(sqlrc), sqlrc);
+      } else if(s_verbose) {
+        double collect_elapsed = perfoscope_internal::difftime(collect_time, start_time);
+        double insert_elapsed = perfoscope_internal::difftime(perfoscope_internal::get_real_time(), collect_time);
+        fprintf(stdout, "Collected %lld threads from %d processes in %g s, added %lld perfdata %s "
+          "for run %lld in %g s (%g rows/s)\n", nthreads, nproc, collect_elapsed, nvalues, 
+          (summarize ? "summaries" : "values"), 
+          run_id, insert_elapsed, (insert_elapsed > 0.0 ? nvalues/insert_elapsed : 0.0));
       }
     }
   }
@@ -271,10 +982,29 @@ int PerfoscopeUtil::open_sqlite3db() {
   s_sqldb = nullptr;
   int sqlrc = SQLITE_ERROR;
   
-  if(perfoscope_internal::iproc() == s_owner_proc_id) {
+  if(db_proc_id() == s_owner_proc_id) {
     char *sqlem;
     
-    if((sqlrc = sqlite3_open(":memory:", &s_sqldb)) != SQLITE_OK) {
+    if(s_persistence_mode == PERSIST_STREAMING) {
+      // Runs are written to the db file directly, the db is opened in 
+      // exclusive locking mode since WAL needs shared memory otherwise
+      if((sqlrc = sqlite3_open_v2(get_dbfilename(), &s_sqldb, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, get_dbvfs())) != SQLITE_OK) {
+        print_error(__FILE__, __LINE__, "Could not open database file '%s' (error: %s, code: %d)", 
+          get_dbfilename(), sqlite3_errstr(sqlrc), sqlrc);
+        sqlite3_close(s_sqldb);
+        s_sqldb = nullptr;
+      } else if((sqlrc = sqlite3_exec(s_sqldb, "PRAGMA locking_mode = exclusive; "
+          "PRAGMA journal_mode = wal; PRAGMA synchronous = normal;", NULL, NULL, &sqlem)) != SQLITE_OK) {
+        print_error(__FILE__, __LINE__, "Could not enable WAL journal: %s", sqlem);
+        sqlite3_free(sqlem);
+        sqlite3_close(s_sqldb);
+        s_sqldb = nullptr;
+      } else {
+        fprintf(stdout, "Streaming sqlite3 db to file '%s'\n", get_dbfilename());
+        sqlite3_wal_autocheckpoint(s_sqldb, 0);
+        s_runs_since_checkpoint = 0;
+      }
+    } else if((sqlrc = sqlite3_open(":memory:", &s_sqldb)) != SQLITE_OK) {
       print_error(__FILE__, __LINE__, "Could not open database (error: %s, code: %d)", 
         sqlite3_errstr(sqlrc), sqlrc);
       s_sqldb = nullptr;
@@ -293,7 +1023,7 @@ int PerfoscopeUtil::open_sqlite3db() {
     sqlrc = (s_sqldb == nullptr ? SQLITE_ERROR : SQLITE_OK);
   }
 #ifdef USING_MPIC
-  MPI_Bcast(&sqlrc, 1, MPI_INT, s_owner_proc_id, MPI_COMM_WORLD);
+  MPI_Bcast(&sqlrc, 1, MPI_INT, s_owner_proc_id, s_db_comm);
 #endif // USING_MPIC
   return sqlrc;
 }
@@ -302,11 +1032,11 @@ int PerfoscopeUtil::open_sqlite3db() {
 #ifdef USING_PERFOSCOPE_DBSTORE
 int PerfoscopeUtil::close_sqlite3db() {
   int sqlrc = SQLITE_ERROR;
-  if(perfoscope_internal::iproc() == s_owner_proc_id) {
+  if(db_proc_id() == s_owner_proc_id) {
     sqlrc = sqlite3_close(s_sqldb);
   }
 #ifdef USING_MPIC
-  MPI_Bcast(&sqlrc, 1, MPI_INT, s_owner_proc_id, MPI_COMM_WORLD);
+  MPI_Bcast(&sqlrc, 1, MPI_INT, s_owner_proc_id, s_db_comm);
 #endif // USING_MPIC
   return sqlrc;
 }
@@ -315,7 +1045,9 @@ int PerfoscopeUtil::close_sqlite3db() {
 #ifdef USING_PERFOSCOPE_DBSTORE
 int PerfoscopeUtil::load_sqlite3db() {
   int sqlrc = SQLITE_ERROR;
-  if(perfoscope_internal::iproc() == s_owner_proc_id) {
+  if(s_persistence_mode == PERSIST_STREAMING) {
+    sqlrc = SQLITE_OK;
+  } else if(db_proc_id() == s_owner_proc_id) {
     sqlite3 *filedb;
     if((sqlrc = sqlite3_open_v2(get_dbfilename(), &filedb, SQLITE_OPEN_READONLY, get_dbvfs())) == SQLITE_OK) {
       fprintf(stdout, "Reading sqlite3 db from file '%s'\n", get_dbfilename());
@@ -340,7 +1072,7 @@ int PerfoscopeUtil::load_sqlite3db() {
     sqlite3_close(filedb);
   }
 #ifdef USING_MPIC
-  MPI_Bcast(&sqlrc, 1, MPI_INT, s_owner_proc_id, MPI_COMM_WORLD);
+  MPI_Bcast(&sqlrc, 1, MPI_INT, s_owner_proc_id, s_db_comm);
 #endif // USING_MPIC
   return sqlrc;
 }
@@ -349,7 +1081,7 @@ int PerfoscopeUtil::load_sqlite3db() {
 #ifdef USING_PERFOSCOPE_DBSTORE
 int PerfoscopeUtil::store_sqlite3db() {
   int sqlrc = SQLITE_ERROR;
-  if(perfoscope_internal::iproc() == s_owner_proc_id) {
+  if(db_proc_id() == s_owner_proc_id) {
     sqlite3 *filedb;
     if((sqlrc = sqlite3_open_v2(get_dbfilename(), &filedb, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, get_dbvfs())) == SQLITE_OK) {
       fprintf(stdout, "Writing sqlite3 db to file '%s'\n", get_dbfilename());
@@ -375,7 +1107,43 @@ int PerfoscopeUtil::store_sqlite3db() {
     sqlite3_close(filedb);
   }
 #ifdef USING_MPIC
-  MPI_Bcast(&sqlrc, 1, MPI_INT, s_owner_proc_id, MPI_COMM_WORLD);
+  MPI_Bcast(&sqlrc, 1, MPI_INT, s_owner_proc_id, s_db_comm);
+#endif // USING_MPIC
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::checkpoint_sqlite3db() {
+  int sqlrc, nlog, ncheckpointed;
+  if((sqlrc = sqlite3_wal_checkpoint_v2(s_sqldb, NULL, SQLITE_CHECKPOINT_TRUNCATE, &nlog, &ncheckpointed)) != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not checkpoint sqlite3 db file '%s' (error: %s, code: %d)", 
+      get_dbfilename(), sqlite3_errstr(sqlrc), sqlrc);
+  }
+  s_runs_since_checkpoint = 0;
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::prepare_sqlite3_statements() {
+  int sqlrc = SQLITE_OK;
+  if(db_proc_id() == s_owner_proc_id) {
+    s_insert_values_query = perf_value_insert_query(s_insert_values_batch);
+    
+    if((sqlrc = sqlite3_prepare_v2(s_sqldb, s_create_new_run_query, -1, &s_create_new_run_stmt, NULL)) != SQLITE_OK) {
+      print_error(__FILE__, __LINE__, "Could not create statement for creating new perfdata run (error: %s, code: %d)", sqlite3_errstr(sqlrc), sqlrc);
+      print_error(__FILE__, __LINE__, "Query: %s", s_create_new_run_query);
+    } else if((sqlrc = sqlite3_prepare_v2(s_sqldb, s_insert_value_query, -1, &s_insert_value_stmt, NULL)) != SQLITE_OK) {
+      print_error(__FILE__, __LINE__, "Could not create statement for inserting perfdata value (error: %s, code: %d)", sqlite3_errstr(sqlrc), sqlrc);
+      print_error(__FILE__, __LINE__, "Query: %s", s_insert_value_query);
+    } else if((sqlrc = sqlite3_prepare_v2(s_sqldb, s_insert_values_query.c_str(), -1, &s_insert_values_stmt, NULL)) != SQLITE_OK) {
+      print_error(__FILE__, __LINE__, "Could not create statement for inserting perfdata values (error: %s, code: %d)", sqlite3_errstr(sqlrc), sqlrc);
+      print_error(__FILE__, __LINE__, "Query: %s", s_insert_values_query.c_str());
+    }
+  }
+#ifdef USING_MPIC
+  MPI_Bcast(&sqlrc, 1, MPI_INT, s_owner_proc_id, s_db_comm);
 #endif // USING_MPIC
   return sqlrc;
 }
@@ -488,12 +1256,12 @@ int PerfoscopeUtil::create_table_perf_event() {
 #endif // USING_PERFOSCOPE_DBSTORE
 
 #ifdef USING_PERFOSCOPE_DBSTORE
-int PerfoscopeUtil::insert_into_perf_event(const char *profile_name, const char *event_name) {
+int PerfoscopeUtil::insert_if_not_exists_into_perf_event(const char *profile_name, const char *event_name) {
   std::stringstream strm;
   int sqlrc = SQLITE_OK;
   char *sqlem;
   
-  strm << "insert into perf_event(name, profile_id) values(" << 
+  strm << "insert or ignore into perf_event(name, profile_id) values(" << 
     "'" << event_name << "'," <<
     "(select id from perf_profile p where p.name='" << profile_name << "'));";
   
@@ -509,10 +1277,35 @@ int PerfoscopeUtil::insert_into_perf_event(const char *profile_name, const char
 #endif // USING_PERFOSCOPE_DBSTORE
 
 #ifdef USING_PERFOSCOPE_DBSTORE
-int PerfoscopeUtil::create_table_perf_run() {
-  char *query, *sqlem;
-  int sqlrc = SQLITE_OK;
-  
+// The events of the data followed by the events of the other event groups 
+// and the time
+std::vector<std::string> PerfoscopeUtil::profile_event_names(const PerfoscopeData &data) {
+  std::vector<std::string> events;
+  const int nevents = data.events_count();
+  for(int ei = 0; ei < nevents; ++ei) {
+    events.push_back(data.event_name(ei));
+  }
+#ifdef USING_PERFOSCOPE_HWC
+  for(size_t gi = 0; gi < s_event_groups.size(); ++gi) {
+    for(size_t ei = 0; ei < s_event_groups[gi].size(); ++ei) {
+      if(std::find(events.begin(), events.end(), s_event_groups[gi][ei]) == events.end()) {
+        events.push_back(s_event_groups[gi][ei]);
+      }
+    }
+  }
+#endif // USING_PERFOSCOPE_HWC
+#ifdef USING_PERFOSCOPE_WCT
+  events.push_back("time");
+#endif // #ifdef USING_PERFOSCOPE_WCT
+  return events;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::create_table_perf_run() {
+  char *query, *sqlem;
+  int sqlrc = SQLITE_OK;
+  
   if(s_forkeyon) {
     query = "create table if not exists perf_run("
       "id integer primary key autoincrement, "
@@ -541,32 +1334,276 @@ int PerfoscopeUtil::create_table_perf_run() {
 #endif // USING_PERFOSCOPE_DBSTORE
 
 #ifdef USING_PERFOSCOPE_DBSTORE
-int PerfoscopeUtil::create_new_run(const char *profile_name, const long long problem_size, long long *run_id) {
+int PerfoscopeUtil::create_new_run(const long long profile_id, const long long problem_size, long long *run_id) {
   int sqlrc = SQLITE_OK;
   
   if((sqlrc = sqlite3_reset(s_create_new_run_stmt)) == SQLITE_OK) {
     if((sqlrc = sqlite3_bind_int(s_create_new_run_stmt, 1, problem_size)) == SQLITE_OK) {
-      if((sqlrc = sqlite3_bind_text(s_create_new_run_stmt, 2, profile_name, -1, SQLITE_STATIC)) == SQLITE_OK) {
+      if((sqlrc = sqlite3_bind_int64(s_create_new_run_stmt, 2, profile_id)) == SQLITE_OK) {
         if((sqlrc = sqlite3_step(s_create_new_run_stmt)) == SQLITE_DONE) {
           *run_id = sqlite3_last_insert_rowid(s_sqldb);
           //fprintf(stdout, "run_id: %d\n", *run_id);
           sqlrc = SQLITE_OK;
+#ifdef USING_PERFOSCOPE_HWC
+          if(s_event_group >= 0) {
+            sqlrc = insert_into_perf_run_event_group(*run_id, s_event_group);
+          }
+#endif // USING_PERFOSCOPE_HWC
+          if(sqlrc == SQLITE_OK && s_machine_id >= 0) {
+            sqlrc = insert_into_perf_run_machine(*run_id, s_machine_id);
+          }
         }
       }
     }
   }
   
   if(sqlrc != SQLITE_OK) {
-    print_error(__FILE__, __LINE__, "Could not create a new run for profile '%s', "
-      "(error: %s, code: %d)", profile_name, sqlite3_errstr(sqlrc), sqlrc);
-    print_error(__FILE__, __LINE__, "Query: %s with 1:problem_size=%d, 2:profile_name=%s", 
-      s_create_new_run_query, problem_size, profile_name);
+    print_error(__FILE__, __LINE__, "Could not create a new run for profile %lld, "
+      "(error: %s, code: %d)", profile_id, sqlite3_errstr(sqlrc), sqlrc);
+    print_error(__FILE__, __LINE__, "Query: %s with 1:problem_size=%lld, 2:profile_id=%lld", 
+      s_create_new_run_query, problem_size, profile_id);
   }
   
   return sqlrc;
 }
 #endif // #ifdef USING_PERFOSCOPE_DBSTORE
 
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::create_table_perf_run_event_group() {
+  char *query, *sqlem;
+  int sqlrc = SQLITE_OK;
+  
+  if(s_forkeyon) {
+    query = "create table if not exists perf_run_event_group("
+      "run_id integer primary key references perf_run(id), "
+      "event_group int not null);";
+  } else {
+    query = "create table if not exists perf_run_event_group("
+      "run_id integer primary key, "
+      "event_group int not null);";
+  }
+  
+  sqlrc = sqlite3_exec(s_sqldb, query, NULL, NULL, &sqlem);
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not create table 'perf_run_event_group': %s", sqlem);
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+    sqlite3_free(sqlem);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::insert_into_perf_run_event_group(long long run_id, int event_group) {
+  int sqlrc = SQLITE_OK;
+  sqlite3_stmt *stmt = nullptr;
+  const char *query = "insert into perf_run_event_group(run_id, event_group) values (?1, ?2);";
+  
+  if((sqlrc = sqlite3_prepare_v2(s_sqldb, query, -1, &stmt, NULL)) == SQLITE_OK) {
+    sqlite3_bind_int64(stmt, 1, run_id);
+    sqlite3_bind_int(stmt, 2, event_group);
+    if((sqlrc = sqlite3_step(stmt)) == SQLITE_DONE) {
+      sqlrc = SQLITE_OK;
+    }
+  }
+  sqlite3_finalize(stmt);
+  
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not insert values into table 'perf_run_event_group'"
+      " (error: %s, code:%d)", sqlite3_errstr(sqlrc), sqlrc);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+// Event group of the last run of the profile, -1 if it has none
+int PerfoscopeUtil::select_last_event_group(const char *profile_name, int *event_group) {
+  int sqlrc = SQLITE_OK;
+  sqlite3_stmt *stmt = nullptr;
+  const char *query = "select g.event_group from perf_run_event_group g, perf_run r, perf_profile p "
+    "where g.run_id=r.id and r.profile_id=p.id and p.name=?1 order by r.id desc limit 1;";
+  
+  *event_group = -1;
+  if((sqlrc = sqlite3_prepare_v2(s_sqldb, query, -1, &stmt, NULL)) == SQLITE_OK) {
+    sqlite3_bind_text(stmt, 1, profile_name, -1, SQLITE_STATIC);
+    if((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      *event_group = sqlite3_column_int(stmt, 0);
+      sqlrc = SQLITE_OK;
+    } else if(sqlrc == SQLITE_DONE) {
+      sqlrc = SQLITE_OK;
+    }
+  }
+  sqlite3_finalize(stmt);
+  
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not select the last event group of profile '%s'"
+      " (error: %s, code:%d)", profile_name, sqlite3_errstr(sqlrc), sqlrc);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+// Peaks of a host measured by the kernels of Roofline, sizes in bytes per 
+// thread and bandwidths in GB/s. A host has peaks for every Roofline::build 
+// of the kernels.
+int PerfoscopeUtil::create_table_perf_machine() {
+  char *query, *sqlem;
+  int sqlrc = SQLITE_OK;
+  
+  query = "create table if not exists perf_machine("
+    "id integer primary key autoincrement, "
+    "host text not null, "
+    "build text not null, "
+    "nthreads int not null, "
+    "gflops numeric not null, "
+    "l1_size integer not null, "
+    "l1_gbs numeric not null, "
+    "l2_size integer not null, "
+    "l2_gbs numeric not null, "
+    "l3_size integer not null, "
+    "l3_gbs numeric not null, "
+    "memory_size integer not null, "
+    "memory_gbs numeric not null, "
+    "constraint uk_host unique(host, build));";
+  
+  sqlrc = sqlite3_exec(s_sqldb, query, NULL, NULL, &sqlem);
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not create table 'perf_machine': %s", sqlem);
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+    sqlite3_free(sqlem);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+// machine_id is -1 if the db has no peaks of the host measured by the build
+int PerfoscopeUtil::select_perf_machine(const char *host, const char *build, 
+    MachinePeaks &peaks, long long *machine_id) {
+  int sqlrc = SQLITE_OK;
+  sqlite3_stmt *stmt = nullptr;
+  const char *query = "select id, nthreads, gflops, l1_size, l1_gbs, l2_size, l2_gbs, "
+    "l3_size, l3_gbs, memory_size, memory_gbs from perf_machine where host=?1 and build=?2;";
+  
+  *machine_id = -1;
+  if((sqlrc = sqlite3_prepare_v2(s_sqldb, query, -1, &stmt, NULL)) == SQLITE_OK) {
+    sqlite3_bind_text(stmt, 1, host, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, build, -1, SQLITE_STATIC);
+    if((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      *machine_id = sqlite3_column_int64(stmt, 0);
+      peaks.host = host;
+      peaks.build = build;
+      peaks.nthreads = sqlite3_column_int(stmt, 1);
+      peaks.gflops = sqlite3_column_double(stmt, 2);
+      for(int li = 0; li < MachinePeaks::nlevels; ++li) {
+        peaks.level_sizes[li] = sqlite3_column_int64(stmt, 3+2*li);
+        peaks.bandwidths[li] = sqlite3_column_double(stmt, 4+2*li);
+      }
+      sqlrc = SQLITE_OK;
+    } else if(sqlrc == SQLITE_DONE) {
+      sqlrc = SQLITE_OK;
+    }
+  }
+  sqlite3_finalize(stmt);
+  
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not select the peaks of host '%s'"
+      " (error: %s, code:%d)", host, sqlite3_errstr(sqlrc), sqlrc);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::insert_into_perf_machine(const MachinePeaks &peaks, long long *machine_id) {
+  int sqlrc = SQLITE_OK;
+  sqlite3_stmt *stmt = nullptr;
+  const char *query = "insert into perf_machine(host, build, nthreads, gflops, l1_size, l1_gbs, "
+    "l2_size, l2_gbs, l3_size, l3_gbs, memory_size, memory_gbs) "
+    "values (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12);";
+  
+  if((sqlrc = sqlite3_prepare_v2(s_sqldb, query, -1, &stmt, NULL)) == SQLITE_OK) {
+    sqlite3_bind_text(stmt, 1, peaks.host.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, peaks.build.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 3, peaks.nthreads);
+    sqlite3_bind_double(stmt, 4, peaks.gflops);
+    for(int li = 0; li < MachinePeaks::nlevels; ++li) {
+      sqlite3_bind_int64(stmt, 5+2*li, peaks.level_sizes[li]);
+      sqlite3_bind_double(stmt, 6+2*li, peaks.bandwidths[li]);
+    }
+    if((sqlrc = sqlite3_step(stmt)) == SQLITE_DONE) {
+      *machine_id = sqlite3_last_insert_rowid(s_sqldb);
+      sqlrc = SQLITE_OK;
+    }
+  }
+  sqlite3_finalize(stmt);
+  
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not insert values into table 'perf_machine'"
+      " (error: %s, code:%d)", sqlite3_errstr(sqlrc), sqlrc);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::create_table_perf_run_machine() {
+  char *query, *sqlem;
+  int sqlrc = SQLITE_OK;
+  
+  if(s_forkeyon) {
+    query = "create table if not exists perf_run_machine("
+      "run_id integer primary key references perf_run(id), "
+      "machine_id integer not null references perf_machine(id));";
+  } else {
+    query = "create table if not exists perf_run_machine("
+      "run_id integer primary key, "
+      "machine_id integer not null);";
+  }
+  
+  sqlrc = sqlite3_exec(s_sqldb, query, NULL, NULL, &sqlem);
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not create table 'perf_run_machine': %s", sqlem);
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+    sqlite3_free(sqlem);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::insert_into_perf_run_machine(long long run_id, long long machine_id) {
+  int sqlrc = SQLITE_OK;
+  sqlite3_stmt *stmt = nullptr;
+  const char *query = "insert into perf_run_machine(run_id, machine_id) values (?1, ?2);";
+  
+  if((sqlrc = sqlite3_prepare_v2(s_sqldb, query, -1, &stmt, NULL)) == SQLITE_OK) {
+    sqlite3_bind_int64(stmt, 1, run_id);
+    sqlite3_bind_int64(stmt, 2, machine_id);
+    if((sqlrc = sqlite3_step(stmt)) == SQLITE_DONE) {
+      sqlrc = SQLITE_OK;
+    }
+  }
+  sqlite3_finalize(stmt);
+  
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not insert values into table 'perf_run_machine'"
+      " (error: %s, code:%d)", sqlite3_errstr(sqlrc), sqlrc);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
 #ifdef USING_PERFOSCOPE_DBSTORE
 int PerfoscopeUtil::create_table_perf_value() {
   char *query, *sqlem;
@@ -606,38 +1643,149 @@ int PerfoscopeUtil::create_table_perf_value() {
 #endif // #ifdef USING_PERFOSCOPE_DBSTORE
 
 #ifdef USING_PERFOSCOPE_DBSTORE
-int PerfoscopeUtil::insert_into_perf_value(int proc_id, int thread_id, 
-    const char *profile_name, const char *category_name, const char *event_name, 
-    long long run_id, long long value) {
+std::string PerfoscopeUtil::perf_value_insert_query(int nrows) {
+  std::stringstream strm;
+  
+  strm << "insert into perf_value(proc_id, thread_id, profile_id, category_id, event_id, run_id, value) values ";
+  for(int ri = 0; ri < nrows; ++ri) {
+    const int pi = 3 + 5*ri;
+    strm << (ri == 0 ? "" : ", ") << "(?" << pi << ", ?" << pi+1 << ", ?1, ?" << pi+2 << ", ?" << pi+3 << ", ?2, ?" << pi+4 << ")";
+  }
+  strm << ";";
+  
+  return strm.str();
+}
+#endif // #ifdef USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::begin_transaction() {
+  char *sqlem;
+  int sqlrc = sqlite3_exec(s_sqldb, "begin transaction;", NULL, NULL, &sqlem);
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not begin transaction: %s", sqlem);
+    sqlite3_free(sqlem);
+  }
+  return sqlrc;
+}
+#endif // #ifdef USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::end_transaction(int sqlrc) {
+  char *sqlem;
+  if(sqlite3_get_autocommit(s_sqldb)) {
+    return sqlrc;
+  }
+  if(sqlrc == SQLITE_OK) {
+    if((sqlrc = sqlite3_exec(s_sqldb, "commit transaction;", NULL, NULL, &sqlem)) != SQLITE_OK) {
+      print_error(__FILE__, __LINE__, "Could not commit transaction: %s", sqlem);
+      sqlite3_free(sqlem);
+    }
+  }
+  if(sqlrc != SQLITE_OK) {
+    if(sqlite3_exec(s_sqldb, "rollback transaction;", NULL, NULL, &sqlem) != SQLITE_OK) {
+      print_error(__FILE__, __LINE__, "Could not rollback transaction: %s", sqlem);
+      sqlite3_free(sqlem);
+    }
+  }
+  return sqlrc;
+}
+#endif // #ifdef USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::select_perfoscope_data_ids(const PerfoscopeData &data, 
+    long long *profile_id, std::vector<long long> &category_ids, 
+    std::vector<long long> &event_ids) {
   int sqlrc = SQLITE_OK;
+  sqlite3_stmt *stmt;
+  const char *query;
+  const std::string &profile_name = data.profile_name();
   
-  if((sqlrc = sqlite3_reset(s_insert_value_stmt)) == SQLITE_OK) {
-    if((sqlrc = sqlite3_bind_int(s_insert_value_stmt, 1, proc_id)) == SQLITE_OK) {
-      if((sqlrc = sqlite3_bind_int(s_insert_value_stmt, 2, thread_id)) == SQLITE_OK) {
-        if((sqlrc = sqlite3_bind_int64(s_insert_value_stmt, 3, run_id)) == SQLITE_OK) {
-          if((sqlrc = sqlite3_bind_int64(s_insert_value_stmt, 4, value)) == SQLITE_OK) {
-            if((sqlrc = sqlite3_bind_text(s_insert_value_stmt, 5, profile_name, -1, SQLITE_STATIC)) == SQLITE_OK) {
-              if((sqlrc = sqlite3_bind_text(s_insert_value_stmt, 6, category_name, -1, SQLITE_STATIC)) == SQLITE_OK) {
-                if((sqlrc = sqlite3_bind_text(s_insert_value_stmt, 7, event_name, -1, SQLITE_STATIC)) == SQLITE_OK) {
-                  if((sqlrc = sqlite3_step(s_insert_value_stmt)) == SQLITE_DONE) {
-                    sqlrc = SQLITE_OK;
-                  }
-                }
+  const int ncategories = data.categories_count();
+  category_ids.assign(ncategories, -1);
+  
+  const int nevents = data.events_count();
+  std::vector<std::string> events(nevents);
+  for(int ei = 0; ei < nevents; ++ei) {
+    events[ei] = data.event_name(ei);
+  }
+#ifdef USING_PERFOSCOPE_WCT
+  events.push_back("time");
+#endif // #ifdef USING_PERFOSCOPE_WCT
+  event_ids.assign(events.size(), -1);
+  
+  *profile_id = -1;
+  query = "select id from perf_profile where name=?;";
+  if((sqlrc = sqlite3_prepare_v2(s_sqldb, query, -1, &stmt, NULL)) == SQLITE_OK) {
+    if((sqlrc = sqlite3_bind_text(stmt, 1, profile_name.c_str(), -1, SQLITE_STATIC)) == SQLITE_OK) {
+      if((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        *profile_id = sqlite3_column_int64(stmt, 0);
+        sqlrc = SQLITE_OK;
+      }
+    }
+    sqlite3_finalize(stmt);
+  }
+  
+  if(sqlrc == SQLITE_OK) {
+    query = "select id from perf_category where name=?;";
+    if((sqlrc = sqlite3_prepare_v2(s_sqldb, query, -1, &stmt, NULL)) == SQLITE_OK) {
+      for(int ci = 0; ci < ncategories && sqlrc == SQLITE_OK; ++ci) {
+        if((sqlrc = sqlite3_reset(stmt)) == SQLITE_OK) {
+          if((sqlrc = sqlite3_bind_text(stmt, 1, data.category_name(ci).c_str(), -1, SQLITE_STATIC)) == SQLITE_OK) {
+            if((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+              category_ids[ci] = sqlite3_column_int64(stmt, 0);
+              sqlrc = SQLITE_OK;
+            }
+          }
+        }
+      }
+      sqlite3_finalize(stmt);
+    }
+  }
+  
+  if(sqlrc == SQLITE_OK) {
+    query = "select id from perf_event where name=? and profile_id=?;";
+    if((sqlrc = sqlite3_prepare_v2(s_sqldb, query, -1, &stmt, NULL)) == SQLITE_OK) {
+      for(size_t ei = 0; ei < events.size() && sqlrc == SQLITE_OK; ++ei) {
+        if((sqlrc = sqlite3_reset(stmt)) == SQLITE_OK) {
+          if((sqlrc = sqlite3_bind_text(stmt, 1, events[ei].c_str(), -1, SQLITE_STATIC)) == SQLITE_OK) {
+            if((sqlrc = sqlite3_bind_int64(stmt, 2, *profile_id)) == SQLITE_OK) {
+              if((sqlrc = sqlite3_step(stmt)) == SQLITE_ROW) {
+                event_ids[ei] = sqlite3_column_int64(stmt, 0);
+                sqlrc = SQLITE_OK;
               }
             }
           }
         }
       }
+      sqlite3_finalize(stmt);
     }
   }
   
   if(sqlrc != SQLITE_OK) {
-    print_error(__FILE__, __LINE__, "Could not insert values into table 'perf_value'"
-      " (error: %s, code:%d)", sqlite3_errstr(sqlrc), sqlrc);
-    print_error(__FILE__, __LINE__, "Query: %s with 1:proc_id=%d, 2:thread_id=%d, "
-      "3:run_id=%ll, 4:value=%ll, 5:profile_name=%s, 6:category_name=%s, "
-      "7:event_name=%s", s_insert_value_query, proc_id, thread_id, run_id, 
-      value, profile_name, category_name, event_name);
+    if(sqlrc == SQLITE_DONE) {
+      sqlrc = SQLITE_NOTFOUND;
+    }
+    print_error(__FILE__, __LINE__, "Could not resolve perfdata ids for profile '%s' (error: %s, code: %d)", 
+      profile_name.c_str(), sqlite3_errstr(sqlrc), sqlrc);
+  }
+  
+  return sqlrc;
+}
+#endif // #ifdef USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::insert_into_perf_value(long long profile_id, long long run_id, 
+    const std::vector<PerfValueRow> &rows) {
+  int sqlrc = SQLITE_OK;
+  const int nrows = rows.size();
+  const int nbatched = nrows - nrows%s_insert_values_batch;
+  
+  int ri = 0;
+  for(; ri < nbatched && sqlrc == SQLITE_OK; ri += s_insert_values_batch) {
+    sqlrc = insert_into_perf_value(s_insert_values_stmt, profile_id, run_id, &rows[ri], s_insert_values_batch);
+  }
+  for(; ri < nrows && sqlrc == SQLITE_OK; ++ri) {
+    sqlrc = insert_into_perf_value(s_insert_value_stmt, profile_id, run_id, &rows[ri], 1);
   }
   
   return sqlrc;
@@ -645,27 +1793,35 @@ int PerfoscopeUtil::insert_into_perf_value(int proc_id, int thread_id,
 #endif // #ifdef USING_PERFOSCOPE_DBSTORE
 
 #ifdef USING_PERFOSCOPE_DBSTORE
-int PerfoscopeUtil::insert_into_perf_value(int proc_id, int thread_id, 
-    const char *profile_name, const char *category_name, const char *event_name, 
-    long long run_id, double value) {
+int PerfoscopeUtil::insert_into_perf_value(sqlite3_stmt *stmt, 
+    long long profile_id, long long run_id, const PerfValueRow *rows, int nrows) {
   int sqlrc = SQLITE_OK;
   
-  if((sqlrc = sqlite3_reset(s_insert_value_stmt)) == SQLITE_OK) {
-    if((sqlrc = sqlite3_bind_int(s_insert_value_stmt, 1, proc_id)) == SQLITE_OK) {
-      if((sqlrc = sqlite3_bind_int(s_insert_value_stmt, 2, thread_id)) == SQLITE_OK) {
-        if((sqlrc = sqlite3_bind_int64(s_insert_value_stmt, 3, run_id)) == SQLITE_OK) {
-          if((sqlrc = sqlite3_bind_double(s_insert_value_stmt, 4, value)) == SQLITE_OK) {
-            if((sqlrc = sqlite3_bind_text(s_insert_value_stmt, 5, profile_name, -1, SQLITE_STATIC)) == SQLITE_OK) {
-              if((sqlrc = sqlite3_bind_text(s_insert_value_stmt, 6, category_name, -1, SQLITE_STATIC)) == SQLITE_OK) {
-                if((sqlrc = sqlite3_bind_text(s_insert_value_stmt, 7, event_name, -1, SQLITE_STATIC)) == SQLITE_OK) {
-                  if((sqlrc = sqlite3_step(s_insert_value_stmt)) == SQLITE_DONE) {
-                    sqlrc = SQLITE_OK;
+  if((sqlrc = sqlite3_reset(stmt)) == SQLITE_OK) {
+    if((sqlrc = sqlite3_bind_int64(stmt, 1, profile_id)) == SQLITE_OK) {
+      if((sqlrc = sqlite3_bind_int64(stmt, 2, run_id)) == SQLITE_OK) {
+        for(int ri = 0; ri < nrows && sqlrc == SQLITE_OK; ++ri) {
+          const PerfValueRow &row = rows[ri];
+          const int pi = 3 + 5*ri;
+          if((sqlrc = sqlite3_bind_int(stmt, pi, row.proc_id)) == SQLITE_OK) {
+            if((sqlrc = sqlite3_bind_int(stmt, pi+1, row.thread_id)) == SQLITE_OK) {
+              if((sqlrc = sqlite3_bind_int64(stmt, pi+2, row.category_id)) == SQLITE_OK) {
+                if((sqlrc = sqlite3_bind_int64(stmt, pi+3, row.event_id)) == SQLITE_OK) {
+                  if(row.is_real) {
+                    sqlrc = sqlite3_bind_double(stmt, pi+4, row.real_value);
+                  } else {
+                    sqlrc = sqlite3_bind_int64(stmt, pi+4, row.int_value);
                   }
                 }
               }
             }
           }
         }
+        if(sqlrc == SQLITE_OK) {
+          if((sqlrc = sqlite3_step(stmt)) == SQLITE_DONE) {
+            sqlrc = SQLITE_OK;
+          }
+        }
       }
     }
   }
@@ -673,10 +1829,8 @@ int PerfoscopeUtil::insert_into_perf_value(int proc_id, int thread_id,
   if(sqlrc != SQLITE_OK) {
     print_error(__FILE__, __LINE__, "Could not insert values into table 'perf_value'"
       " (error: %s, code:%d)", sqlite3_errstr(sqlrc), sqlrc);
-    print_error(__FILE__, __LINE__, "Query: %s with 1:proc_id=%d, 2:thread_id=%d, "
-      "3:run_id=%ll, 4:value=%ll, 5:profile_name=%s, 6:category_name=%s, "
-      "7:event_name=%s", s_insert_value_query, proc_id, thread_id, run_id,
-      value, profile_name, category_name, event_name);
+    print_error(__FILE__, __LINE__, "Query: %s with 1:profile_id=%lld, 2:run_id=%lld, "
+      "%d rows", sqlite3_sql(stmt), profile_id, run_id, nrows);
   }
   
   return sqlrc;
@@ -697,15 +1851,7 @@ int PerfoscopeUtil::check_if_perfoscope_data_profile_exists(const PerfoscopeData
     categories[i] = data.category_name(i);
   }
   
-  int events_count = data.events_count();
-  std::vector<std::string> events(events_count);
-  for(int i = 0; i < events_count; ++i) {
-    events[i] = data.event_name(i);
-  }
-#ifdef USING_PERFOSCOPE_WCT
-  events_count++;
-  events.push_back("time");
-#endif // #ifdef USING_PERFOSCOPE_WCT
+  std::vector<std::string> events = profile_event_names(data);
   
   query = "select name from perf_category;";
   if((sqlrc = sqlite3_prepare_v2(s_sqldb, query, -1, &stmt, NULL)) == SQLITE_OK) {
@@ -783,15 +1929,11 @@ int PerfoscopeUtil::check_if_perfoscope_data_profile_exists(const PerfoscopeData
         }
       }
       sqlite3_finalize(stmt);
+      // Events missing in an existing profile are added to it
       if(sqlrc == SQLITE_DONE) {
+        sqlrc = SQLITE_OK;
         if(events.size() == 0) {
-          sqlrc = SQLITE_OK;
           *exist_mask |= 4;
-        } else if(events.size() == events_count) {
-          sqlrc = SQLITE_OK;
-        } else {
-          print_error(__FILE__, __LINE__, "Inconsistency in perfdata events");
-          sqlrc = SQLITE_ERROR;
         }
       } else {
         print_error(__FILE__, __LINE__, "Could not check perfdata events (error: %s, code: %d)", sqlite3_errstr(sqlrc), sqlrc);
@@ -811,29 +1953,21 @@ int PerfoscopeUtil::check_if_perfoscope_data_profile_exists(const PerfoscopeData
 #ifdef USING_PERFOSCOPE_DBSTORE
 int PerfoscopeUtil::insert_perfoscope_data_profile(const PerfoscopeData &data) {
   int sqlrc = SQLITE_ERROR;
-  if(perfoscope_internal::iproc() == s_owner_proc_id) {
+  if(db_proc_id() == s_owner_proc_id) {
     int exist_mask = 0;
     if((sqlrc = check_if_perfoscope_data_profile_exists(data, &exist_mask)) == SQLITE_OK) {
-      if(((exist_mask & 2) >> 1) == ((exist_mask & 4) >> 2)) {
-        if((exist_mask & 6) == 0) {
-          if((sqlrc = insert_into_perf_profile(data.profile_name().c_str())) == SQLITE_OK) {
-            const int nevents = data.events_count();
-            for(int ei = 0; ei < nevents; ++ei) {
-              if((sqlrc = insert_into_perf_event(data.profile_name().c_str(), data.event_name(ei).c_str())) != SQLITE_OK) {
-                break;
-              }
-            }
-#ifdef USING_PERFOSCOPE_WCT
-            if(sqlrc == SQLITE_OK) {
-              sqlrc = insert_into_perf_event(data.profile_name().c_str(), "time");
-            }
-#endif // #ifdef USING_PERFOSCOPE_WCT
+      // The events of a profile are the events of all its runs, so runs 
+      // with other events (e.g. another event group) add theirs to it
+      if((exist_mask & 2) == 0) {
+        sqlrc = insert_into_perf_profile(data.profile_name().c_str());
+      }
+      if(sqlrc == SQLITE_OK && (exist_mask & 4) == 0) {
+        const std::vector<std::string> events = profile_event_names(data);
+        for(size_t ei = 0; ei < events.size(); ++ei) {
+          if((sqlrc = insert_if_not_exists_into_perf_event(data.profile_name().c_str(), events[ei].c_str())) != SQLITE_OK) {
+            break;
           }
         }
-      } else {
-        print_error(__FILE__, __LINE__, "Profile with same name but with different "
-          "event set exists in perfdata. Change profile name and try again.");
-        sqlrc = SQLITE_ERROR;
       }
       
       if(sqlrc == SQLITE_OK) {
@@ -846,58 +1980,1632 @@ int PerfoscopeUtil::insert_perfoscope_data_profile(const PerfoscopeData &data) {
           }
         }
       }
+      
+      // Ids are resolved once here and bound as plain integers afterwards
+      if(sqlrc == SQLITE_OK) {
+        sqlrc = select_perfoscope_data_ids(data, &s_profile_id, s_category_ids, s_event_ids);
+      }
     }
   }
 #ifdef USING_MPIC
-  MPI_Bcast(&sqlrc, 1, MPI_INT, s_owner_proc_id, MPI_COMM_WORLD);
+  MPI_Bcast(&sqlrc, 1, MPI_INT, s_owner_proc_id, s_db_comm);
 #endif // USING_MPIC
   return sqlrc;
 }
 #endif  // USING_PERFOSCOPE_DBSTORE
 
 #ifdef USING_PERFOSCOPE_DBSTORE
-int PerfoscopeUtil::insert_perfoscope_data(
-    int proc_id, 
-    const PerfoscopeData &data, 
-    long long run_id, 
-    const long long *counter_values, 
-    const double *real_time) {
-  const int ncategories = data.categories_count();
-  const int nevents = data.events_count();
-  const int array_size = ncategories*nevents;
-  int sqlrc = SQLITE_OK;
+// Packed layout of the data of one process:
+//   long long proc_id, nthreads
+//   double seconds_per_tick
+//   nthreads x {
+//     long long thread_id, ncategories, nevents, npaths, cpu, numa_node, 
+//       nsamples, ncalls, nseries
+//     long long values[ncategories*(nevents+1)], the values of 
+//       PerfoscopeData, per category the counter values and the real time 
+//       in ticks
+//     double coverage[nevents]
+//     double overhead[nevents+1], the calibrated cost of a call, the real 
+//       time in ticks
+//     npaths x {
+//       long long parent, category, count
+//       long long inclusive_values[nevents], exclusive_values[nevents]
+//       double inclusive_time, exclusive_time
+//     }
+//     nsamples x {
+//       long long category, count, symbol_size, stack_size
+//       char symbol[symbol_size], stack[stack_size]
+//     }
+//     ncalls x { (one per category that was called)
+//       long long category, count, flat_count, min_time, max_time 
+//         (nanoseconds), nbuckets
+//       double mean_time, variance_time (seconds)
+//       long long buckets[2*nbuckets], (bucket, count) of the non-empty 
+//         buckets of the duration histogram
+//     }
+//     nseries x {
+//       long long iteration
+//       long long values[ncategories*(nevents+1)], the snapshot of the 
+//         values at the end of the iteration
+//     }
+//   }
+void PerfoscopeUtil::pack_perfoscope_data(
+    const PerfoscopeData* perfoscope_data_list[], 
+    const int count, 
+    std::vector<char> &buffer) {
+  long long nthreads = 0;
+  size_t size = 2*sizeof(long long) + sizeof(double);
   
-  int cvi = 0, rti = 0;
-  for(int ci = 0; ci < ncategories; ++ci) {
-#ifdef USING_PERFOSCOPE_HWC
-    for(int ei = 0; ei < nevents; ++ei) {
-      if((sqlrc = insert_into_perf_value(
-        proc_id, 
-        data.thread_id(), 
-        data.profile_name().c_str(), 
-        data.category_name(ci).c_str(), 
-        data.event_name(ei).c_str(), 
-        run_id, 
-        counter_values[cvi++]
-      )) != SQLITE_OK) {
-        break;
+  // Samples are symbolized here, where the addresses are valid
+  std::vector<std::vector<PerfSampleRow> > samples(count);
+  for(int i = 0; i < count; ++i) {
+    if(perfoscope_data_list[i] != nullptr) {
+      const long long ncategories = perfoscope_data_list[i]->categories_count();
+      const long long nevents = perfoscope_data_list[i]->events_count();
+      const long long npaths = perfoscope_data_list[i]->paths_count();
+      const long long nseries = perfoscope_data_list[i]->series_count();
+      size += 9*sizeof(long long) + ncategories*(nevents+1)*sizeof(long long) + (2*nevents+1)*sizeof(double);
+      size += nseries*(1 + ncategories*(nevents+1))*sizeof(long long);
+      size += npaths*((3 + 2*nevents)*sizeof(long long) + 2*sizeof(double));
+      count_samples(*perfoscope_data_list[i], samples[i]);
+      for(size_t si = 0; si < samples[i].size(); ++si) {
+        size += 4*sizeof(long long) + samples[i][si].symbol.size() + samples[i][si].stack.size();
+      }
+      for(int ci = 0; ci < ncategories; ++ci) {
+        if(perfoscope_data_list[i]->call_stats(ci).count > 0) {
+          size += 6*sizeof(long long) + 2*sizeof(double);
+          size += 2*count_call_buckets(*perfoscope_data_list[i], ci)*sizeof(long long);
+        }
+      }
+      ++nthreads;
+    }
+  }
+  
+  buffer.resize(size);
+  char *ptr = &buffer[0];
+  const long long process_header[2] = {perfoscope_internal::iproc(), nthreads};
+  std::memcpy(ptr, process_header, sizeof(process_header));
+  ptr += sizeof(process_header);
+  const double seconds_per_tick = perfoscope_internal::ticks_to_seconds(1);
+  std::memcpy(ptr, &seconds_per_tick, sizeof(double));
+  ptr += sizeof(double);
+  
+  for(int i = 0; i < count; ++i) {
+    if(perfoscope_data_list[i] != nullptr) {
+      const PerfoscopeData &data = *perfoscope_data_list[i];
+      long long ncalls = 0;
+      for(int ci = 0; ci < data.categories_count(); ++ci) {
+        ncalls += (data.call_stats(ci).count > 0 ? 1 : 0);
+      }
+      const long long header[9] = {data.thread_id(), data.categories_count(), data.events_count(), 
+        data.paths_count(), data.cpu(), data.numa_node(), (long long)samples[i].size(), ncalls, 
+        data.series_count()};
+      std::memcpy(ptr, header, sizeof(header));
+      ptr += sizeof(header);
+      
+      std::memcpy(ptr, data.values(), header[1]*data.values_stride()*sizeof(long long));
+      ptr += header[1]*data.values_stride()*sizeof(long long);
+      
+      for(int ei = 0; ei < header[2]; ++ei) {
+        const double coverage = data.event_coverage(ei);
+        std::memcpy(ptr, &coverage, sizeof(double));
+        ptr += sizeof(double);
+      }
+      for(int vi = 0; vi <= header[2]; ++vi) {
+        const double overhead = data.call_overhead(vi);
+        std::memcpy(ptr, &overhead, sizeof(double));
+        ptr += sizeof(double);
+      }
+      
+      for(int pi = 0; pi < header[3]; ++pi) {
+        const long long path_header[3] = {data.path_parent(pi), data.path_category(pi), data.path_count(pi)};
+        const double path_time[2] = {data.path_inclusive_time(pi), data.path_exclusive_time(pi)};
+        std::memcpy(ptr, path_header, sizeof(path_header));
+        ptr += sizeof(path_header);
+        if(header[2] > 0) {
+          std::memcpy(ptr, data.path_inclusive_values(pi), header[2]*sizeof(long long));
+          ptr += header[2]*sizeof(long long);
+          std::memcpy(ptr, data.path_exclusive_values(pi), header[2]*sizeof(long long));
+          ptr += header[2]*sizeof(long long);
+        }
+        std::memcpy(ptr, path_time, sizeof(path_time));
+        ptr += sizeof(path_time);
+      }
+      
+      for(int si = 0; si < header[6]; ++si) {
+        const PerfSampleRow &sample = samples[i][si];
+        const long long sample_header[4] = {sample.category_id, sample.count, 
+          (long long)sample.symbol.size(), (long long)sample.stack.size()};
+        std::memcpy(ptr, sample_header, sizeof(sample_header));
+        ptr += sizeof(sample_header);
+        std::memcpy(ptr, sample.symbol.data(), sample.symbol.size());
+        ptr += sample.symbol.size();
+        std::memcpy(ptr, sample.stack.data(), sample.stack.size());
+        ptr += sample.stack.size();
+      }
+      
+      for(int ci = 0; ci < header[1]; ++ci) {
+        const PerfoscopeData::CallStats &stats = data.call_stats(ci);
+        if(stats.count == 0) {
+          continue;
+        }
+#ifdef USING_PERFOSCOPE_WCT
+        const long long call_header[6] = {ci, stats.count, stats.flat_count, stats.min_time, 
+          stats.max_time, count_call_buckets(data, ci)};
+        const double call_moments[2] = {data.call_time_mean(ci), data.call_time_variance(ci)};
+#else // USING_PERFOSCOPE_WCT
+        const long long call_header[6] = {ci, stats.count, stats.flat_count, 0, 0, 0};
+        const double call_moments[2] = {0.0, 0.0};
+#endif // USING_PERFOSCOPE_WCT
+        std::memcpy(ptr, call_header, sizeof(call_header));
+        ptr += sizeof(call_header);
+        std::memcpy(ptr, call_moments, sizeof(call_moments));
+        ptr += sizeof(call_moments);
+#ifdef USING_PERFOSCOPE_WCT
+        for(int bi = 0; bi < perfoscope_internal::duration_histogram_size; ++bi) {
+          if(stats.histogram[bi] > 0) {
+            const long long bucket[2] = {bi, stats.histogram[bi]};
+            std::memcpy(ptr, bucket, sizeof(bucket));
+            ptr += sizeof(bucket);
+          }
+        }
+#endif // USING_PERFOSCOPE_WCT
+      }
+      
+      for(long long si = 0; si < header[8]; ++si) {
+        const long long iteration = data.series_iteration(si);
+        std::memcpy(ptr, &iteration, sizeof(long long));
+        ptr += sizeof(long long);
+        std::memcpy(ptr, data.series_values(si), header[1]*data.values_stride()*sizeof(long long));
+        ptr += header[1]*data.values_stride()*sizeof(long long);
+      }
+    }
+  }
+}
+
+long long PerfoscopeUtil::count_call_buckets(const PerfoscopeData &data, int ci) {
+  long long nbuckets = 0;
+#ifdef USING_PERFOSCOPE_WCT
+  const PerfoscopeData::CallStats &stats = data.call_stats(ci);
+  for(int bi = 0; bi < perfoscope_internal::duration_histogram_size; ++bi) {
+    nbuckets += (stats.histogram[bi] > 0 ? 1 : 0);
+  }
+#endif // USING_PERFOSCOPE_WCT
+  return nbuckets;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+#ifdef USING_PERFOSCOPE_SAMPLING
+static std::string symbolize_frame(void *ip) {
+  char name[64];
+  Dl_info info;
+  if(dladdr(ip, &info) != 0) {
+    if(info.dli_sname != nullptr) {
+      int status;
+      char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+      std::string symbol(status == 0 ? demangled : info.dli_sname);
+      free(demangled);
+      return symbol;
+    } else if(info.dli_fname != nullptr) {
+      const char *module = std::strrchr(info.dli_fname, '/');
+      snprintf(name, sizeof(name), "+0x%lx", 
+        (unsigned long)((char*)ip - (char*)info.dli_fbase));
+      return std::string(module != nullptr ? module+1 : info.dli_fname) + name;
+    }
+  }
+  snprintf(name, sizeof(name), "%p", ip);
+  return name;
+}
+#endif // USING_PERFOSCOPE_SAMPLING
+
+void PerfoscopeUtil::count_samples(
+    const PerfoscopeData &data, 
+    std::vector<PerfSampleRow> &samples) {
+#ifdef USING_PERFOSCOPE_SAMPLING
+  const SampleBuffer *buffer = data.samples();
+  if(buffer == nullptr) {
+    return;
+  }
+  
+  std::map<void*, std::string> symbols;
+  std::map<std::pair<int, std::string>, size_t> index;
+  const long long nsamples = buffer->count();
+  for(long long si = 0; si < nsamples; ++si) {
+    void * const *frames = buffer->frames(si);
+    const int nframes = buffer->frames_count(si);
+    if(nframes == 0) {
+      continue;
+    }
+    
+    // Folded stack, outermost frame first
+    std::string stack;
+    for(int fi = nframes-1; fi >= 0; --fi) {
+      std::map<void*, std::string>::iterator symbol = symbols.find(frames[fi]);
+      if(symbol == symbols.end()) {
+        symbol = symbols.insert(std::make_pair(frames[fi], symbolize_frame(frames[fi]))).first;
+      }
+      if(!stack.empty()) {
+        stack += ';';
+      }
+      stack += symbol->second;
+    }
+    
+    const std::pair<int, std::string> key(buffer->category(si), stack);
+    std::map<std::pair<int, std::string>, size_t>::iterator it = index.find(key);
+    if(it == index.end()) {
+      index.insert(std::make_pair(key, samples.size()));
+      samples.push_back({perfoscope_internal::iproc(), data.thread_id(), key.first, 
+        symbols[frames[0]], stack, 1});
+    } else {
+      samples[it->second].count += 1;
+    }
+  }
+  
+  if(buffer->dropped() > 0) {
+    print_error(__FILE__, __LINE__, "Thread %d dropped %lld samples, increase the sampling capacity", 
+      data.thread_id(), buffer->dropped());
+  }
+#endif // USING_PERFOSCOPE_SAMPLING
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+void PerfoscopeUtil::gather_perfoscope_data(std::vector<char> &buffer, 
+    std::vector<size_t> &offsets) {
+  const int nproc = db_nproc();
+  offsets.assign(nproc+1, 0);
+  
+#ifdef USING_MPIC
+  // MPI counts and displacements are int, so the buffers are gathered with 
+  // one MPI_Gatherv while their total fits in an int and sent to the owner 
+  // in chunks of at most INT_MAX bytes otherwise.
+  const bool owner = (db_proc_id() == s_owner_proc_id);
+  long long size = buffer.size();
+  std::vector<long long> sizes(owner ? nproc : 1);
+  MPI_Gather(&size, 1, MPI_LONG_LONG, &sizes[0], 1, MPI_LONG_LONG, s_owner_proc_id, s_db_comm);
+  
+  std::vector<char> recvbuf;
+  int chunked = 0;
+  if(owner) {
+    for(int pi = 0; pi < nproc; ++pi) {
+      offsets[pi+1] = offsets[pi] + sizes[pi];
+    }
+    chunked = (offsets[nproc] > (size_t)INT_MAX);
+    recvbuf.resize(offsets[nproc]);
+  }
+  MPI_Bcast(&chunked, 1, MPI_INT, s_owner_proc_id, s_db_comm);
+  
+  if(!chunked) {
+    std::vector<int> counts(owner ? nproc : 1), displs(owner ? nproc : 1);
+    if(owner) {
+      for(int pi = 0; pi < nproc; ++pi) {
+        counts[pi] = sizes[pi];
+        displs[pi] = offsets[pi];
+      }
+    }
+    MPI_Gatherv(&buffer[0], size, MPI_BYTE, 
+      (owner ? &recvbuf[0] : nullptr), &counts[0], &displs[0], MPI_BYTE, 
+      s_owner_proc_id, s_db_comm);
+  } else if(owner) {
+    std::memcpy(&recvbuf[offsets[s_owner_proc_id]], &buffer[0], size);
+    for(int pi = 0; pi < nproc; ++pi) {
+      for(long long done = 0; pi != s_owner_proc_id && done < sizes[pi]; ) {
+        const int chunk = std::min(sizes[pi] - done, (long long)INT_MAX);
+        MPI_Recv(&recvbuf[offsets[pi] + done], chunk, MPI_BYTE, pi, 0, s_db_comm, MPI_STATUS_IGNORE);
+        done += chunk;
+      }
+    }
+  } else {
+    for(long long done = 0; done < size; ) {
+      const int chunk = std::min(size - done, (long long)INT_MAX);
+      MPI_Send(&buffer[done], chunk, MPI_BYTE, s_owner_proc_id, 0, s_db_comm);
+      done += chunk;
+    }
+  }
+  buffer.swap(recvbuf);
+#else // #ifdef USING_MPIC
+  offsets[1] = buffer.size();
+#endif // #ifdef USING_MPIC
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::unpack_perfoscope_data(const char *buffer, 
+    std::vector<PerfValueRow> &rows, std::vector<PerfPathRow> &paths, 
+    std::vector<PerfThreadRow> &threads, 
+    std::vector<PerfSampleRow> &samples, 
+    std::vector<PerfCallRow> &calls, 
+    std::vector<PerfSeriesRow> &series, 
+    std::vector<PerfCoverageRow> &coverage, 
+    std::vector<PerfMetricRow> &metrics, 
+    std::vector<PerfOverheadRow> &overheads, 
+    std::vector<PerfValueRow> &compensated) {
+  long long process_header[2];
+  std::memcpy(process_header, buffer, sizeof(process_header));
+  buffer += sizeof(process_header);
+  const int proc_id = process_header[0];
+  const long long nthreads = process_header[1];
+  double seconds_per_tick;
+  std::memcpy(&seconds_per_tick, buffer, sizeof(double));
+  buffer += sizeof(double);
+  
+  std::vector<long long> values;
+  std::vector<double> overhead;
+  std::vector<long long> category_flat_calls;
+  std::vector<double> reported;
+  std::vector<long long> previous;
+  std::vector<PerfValueRow> series_rows;
+  for(long long ti = 0; ti < nthreads; ++ti) {
+    long long header[9];
+    std::memcpy(header, buffer, sizeof(header));
+    buffer += sizeof(header);
+    threads.push_back({proc_id, int(header[0]), int(header[4]), int(header[5])});
+    
+    const int ncategories = header[1];
+    const int nevents = header[2];
+    values.resize(ncategories*(nevents+1));
+    std::memcpy(values.data(), buffer, values.size()*sizeof(long long));
+    buffer += values.size()*sizeof(long long);
+    
+    append_perf_value_rows(proc_id, header[0], ncategories, nevents, 
+      values.data(), seconds_per_tick, rows);
+    
+    // The estimate is stored once per run, a thread only lowers it
+    for(int ei = 0; ei < nevents; ++ei) {
+      double estimated_coverage;
+      std::memcpy(&estimated_coverage, buffer, sizeof(double));
+      buffer += sizeof(double);
+      size_t ci = 0;
+      while(ci < coverage.size() && coverage[ci].event_id != s_event_ids[ei]) {
+        ++ci;
+      }
+      if(ci == coverage.size()) {
+        PerfCoverageRow coverage_row;
+        coverage_row.event_id = s_event_ids[ei];
+        coverage_row.estimated_coverage = estimated_coverage;
+        coverage.push_back(coverage_row);
+      } else if(estimated_coverage < coverage[ci].estimated_coverage) {
+        coverage[ci].estimated_coverage = estimated_coverage;
+      }
+    }
+    
+    overhead.resize(nevents+1);
+    std::memcpy(overhead.data(), buffer, overhead.size()*sizeof(double));
+    buffer += overhead.size()*sizeof(double);
+    overhead[nevents] *= seconds_per_tick;
+    if(s_compensate_overhead) {
+      PerfOverheadRow overhead_row;
+      overhead_row.proc_id = proc_id;
+      overhead_row.thread_id = header[0];
+#ifdef USING_PERFOSCOPE_HWC
+      for(int ei = 0; ei < nevents; ++ei) {
+        overhead_row.event_id = s_event_ids[ei];
+        overhead_row.overhead = overhead[ei];
+        overheads.push_back(overhead_row);
+      }
+#endif // USING_PERFOSCOPE_HWC
+#ifdef USING_PERFOSCOPE_WCT
+      overhead_row.event_id = s_event_ids[nevents];
+      overhead_row.overhead = overhead[nevents];
+      overheads.push_back(overhead_row);
+#endif // USING_PERFOSCOPE_WCT
+    }
+    
+    PerfPathRow path;
+    path.proc_id = proc_id;
+    path.thread_id = header[0];
+    path.inclusive_values.resize(nevents);
+    path.exclusive_values.resize(nevents);
+    for(int pi = 0; pi < header[3]; ++pi) {
+      long long path_header[3];
+      double path_time[2];
+      std::memcpy(path_header, buffer, sizeof(path_header));
+      buffer += sizeof(path_header);
+      if(nevents > 0) {
+        std::memcpy(&path.inclusive_values[0], buffer, nevents*sizeof(long long));
+        buffer += nevents*sizeof(long long);
+        std::memcpy(&path.exclusive_values[0], buffer, nevents*sizeof(long long));
+        buffer += nevents*sizeof(long long);
+      }
+      std::memcpy(path_time, buffer, sizeof(path_time));
+      buffer += sizeof(path_time);
+      
+      path.path = pi;
+      path.parent = path_header[0];
+      path.category_id = s_category_ids[path_header[1]];
+      path.count = path_header[2];
+      path.inclusive_time = path_time[0];
+      path.exclusive_time = path_time[1];
+      paths.push_back(path);
+    }
+    
+    PerfSampleRow sample;
+    sample.proc_id = proc_id;
+    sample.thread_id = header[0];
+    for(int si = 0; si < header[6]; ++si) {
+      long long sample_header[4];
+      std::memcpy(sample_header, buffer, sizeof(sample_header));
+      buffer += sizeof(sample_header);
+      sample.category_id = (sample_header[0] < 0 ? -1 : s_category_ids[sample_header[0]]);
+      sample.count = sample_header[1];
+      sample.symbol.assign(buffer, sample_header[2]);
+      buffer += sample_header[2];
+      sample.stack.assign(buffer, sample_header[3]);
+      buffer += sample_header[3];
+      samples.push_back(sample);
+    }
+    
+    PerfCallRow call;
+    call.proc_id = proc_id;
+    call.thread_id = header[0];
+    category_flat_calls.assign(ncategories, 0);
+    for(int ci = 0; ci < header[7]; ++ci) {
+      long long call_header[6];
+      double call_moments[2];
+      std::memcpy(call_header, buffer, sizeof(call_header));
+      buffer += sizeof(call_header);
+      std::memcpy(call_moments, buffer, sizeof(call_moments));
+      buffer += sizeof(call_moments);
+      call.category_id = s_category_ids[call_header[0]];
+      call.count = call_header[1];
+      category_flat_calls[call_header[0]] = call_header[2];
+      call.min_time = 1e-9*call_header[3];
+      call.max_time = 1e-9*call_header[4];
+      call.mean_time = call_moments[0];
+      call.variance_time = call_moments[1];
+      call.buckets.resize(2*call_header[5]);
+      if(call_header[5] > 0) {
+        std::memcpy(&call.buckets[0], buffer, call.buckets.size()*sizeof(long long));
+        buffer += call.buckets.size()*sizeof(long long);
+      }
+      calls.push_back(call);
+    }
+    
+    // The metrics are evaluated on the reported values, the values less the 
+    // overhead of the accumulate/stop calls with overhead compensation
+    reported.resize(values.size());
+    for(int ci = 0; ci < ncategories; ++ci) {
+      for(int vi = 0; vi <= nevents; ++vi) {
+        const double value = double(values[ci*(nevents+1)+vi])*(vi == nevents ? seconds_per_tick : 1.0);
+        const double compensated_value = value - (s_compensate_overhead ? overhead[vi]*category_flat_calls[ci] : 0.0);
+        reported[ci*(nevents+1)+vi] = (compensated_value > 0.0 ? compensated_value : 0.0);
+      }
+    }
+    append_perf_metric_rows(proc_id, header[0], ncategories, nevents, 
+      reported.data(), metrics);
+    if(s_compensate_overhead) {
+      PerfValueRow compensated_row;
+      compensated_row.proc_id = proc_id;
+      compensated_row.thread_id = header[0];
+      compensated_row.is_real = true;
+      compensated_row.int_value = 0;
+      for(int ci = 0; ci < ncategories; ++ci) {
+        compensated_row.category_id = s_category_ids[ci];
+#ifdef USING_PERFOSCOPE_HWC
+        for(int ei = 0; ei < nevents; ++ei) {
+          compensated_row.event_id = s_event_ids[ei];
+          compensated_row.real_value = reported[ci*(nevents+1)+ei];
+          compensated.push_back(compensated_row);
+        }
+#endif // USING_PERFOSCOPE_HWC
+#ifdef USING_PERFOSCOPE_WCT
+        compensated_row.event_id = s_event_ids[nevents];
+        compensated_row.real_value = reported[ci*(nevents+1)+nevents];
+        compensated.push_back(compensated_row);
+#endif // USING_PERFOSCOPE_WCT
+      }
+    }
+    
+    // The snapshots are cumulative, a row holds the values of the 
+    // iterations since the previous snapshot
+    PerfSeriesRow series_row;
+    long long previous_iteration = 0;
+    previous.assign(values.size(), 0);
+    for(long long si = 0; si < header[8]; ++si) {
+      std::memcpy(&series_row.iteration, buffer, sizeof(long long));
+      buffer += sizeof(long long);
+      std::memcpy(values.data(), buffer, values.size()*sizeof(long long));
+      buffer += values.size()*sizeof(long long);
+      for(size_t vi = 0; vi < values.size(); ++vi) {
+        const long long value = values[vi];
+        values[vi] -= previous[vi];
+        previous[vi] = value;
+      }
+      
+      series_row.iterations = series_row.iteration - previous_iteration;
+      previous_iteration = series_row.iteration;
+      series_rows.clear();
+      append_perf_value_rows(proc_id, header[0], ncategories, nevents, 
+        values.data(), seconds_per_tick, series_rows);
+      for(size_t ri = 0; ri < series_rows.size(); ++ri) {
+        series_row.value = series_rows[ri];
+        series.push_back(series_row);
       }
     }
+  }
+  
+  return nthreads;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+void PerfoscopeUtil::append_perf_value_rows(
+    int proc_id, 
+    int thread_id, 
+    int ncategories, 
+    int nevents, 
+    const long long *values, 
+    double seconds_per_tick, 
+    std::vector<PerfValueRow> &rows) {
+  PerfValueRow row;
+  row.proc_id = proc_id;
+  row.thread_id = thread_id;
+  
+  for(int ci = 0; ci < ncategories; ++ci) {
+    const long long *category_values = values + ci*(nevents+1);
+    row.category_id = s_category_ids[ci];
+#ifdef USING_PERFOSCOPE_HWC
+    row.is_real = false;
+    for(int ei = 0; ei < nevents; ++ei) {
+      row.event_id = s_event_ids[ei];
+      row.int_value = category_values[ei];
+      rows.push_back(row);
+    }
 #endif // #ifdef USING_PERFOSCOPE_HWC
     
 #ifdef USING_PERFOSCOPE_WCT
-    if(sqlrc == SQLITE_OK) {
-      sqlrc = insert_into_perf_value(
-        proc_id, 
-        data.thread_id(), 
-        data.profile_name().c_str(), 
-        data.category_name(ci).c_str(), 
-        "time", 
-        run_id, 
-        real_time[rti++]
-      );
+    row.is_real = true;
+    row.event_id = s_event_ids[nevents];
+    row.real_value = double(category_values[nevents])*seconds_per_tick;
+    rows.push_back(row);
+#endif // #ifdef USING_PERFOSCOPE_WCT
+  }
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+// A metric that divides by zero in a category, e.g. a ratio of two events 
+// that did not occur, has no row for that category
+void PerfoscopeUtil::append_perf_metric_rows(
+    int proc_id, 
+    int thread_id, 
+    int ncategories, 
+    int nevents, 
+    const double *values, 
+    std::vector<PerfMetricRow> &metrics) {
+  PerfMetricRow metric;
+  metric.proc_id = proc_id;
+  metric.thread_id = thread_id;
+  
+  for(int ci = 0; ci < ncategories; ++ci) {
+    const double *row = values + ci*(nevents+1);
+    metric.category_id = s_category_ids[ci];
+    for(size_t bi = 0; bi < s_bound_metrics.size(); ++bi) {
+      metric.metric = s_bound_metrics[bi].metric;
+      metric.value = evaluate_metric(s_bound_metrics[bi], row);
+      if(std::isfinite(metric.value)) {
+        metrics.push_back(metric);
+      }
+    }
+  }
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+long long PerfoscopeUtil::summarize_perfoscope_data(
+    const PerfoscopeData* perfoscope_data_list[], 
+    const int count, 
+    std::vector<double> &summary) {
+  using namespace perfoscope_internal;
+  const int ncategories = s_template.categories_count();
+  const int nevents = s_template.events_count();
+#ifdef USING_PERFOSCOPE_WCT
+  const int nvalues = nevents+1;
+#else // USING_PERFOSCOPE_WCT
+  const int nvalues = nevents;
+#endif // USING_PERFOSCOPE_WCT
+  const int nsummaries = ncategories*nvalues;
+  const double iproc = perfoscope_internal::iproc();
+  
+  std::vector<double> local(nsummaries*summary_size, 0.0);
+  long long nthreads = 0;
+  
+  for(int i = 0; i < count; ++i) {
+    if(perfoscope_data_list[i] != nullptr) {
+      const PerfoscopeData &data = *perfoscope_data_list[i];
+      ++nthreads;
+      for(int ci = 0; ci < ncategories; ++ci) {
+        const long long *values = data.category_values(ci);
+        for(int vi = 0; vi < nvalues; ++vi) {
+          double value = (vi < nevents ? double(values[vi]) : data.category_real_time(ci));
+          double *entry = &local[(ci*nvalues+vi)*summary_size];
+          if(entry[summary_count] == 0.0 || value < entry[summary_min]) {
+            entry[summary_min] = value;
+            entry[summary_min_proc] = iproc;
+          }
+          if(entry[summary_count] == 0.0 || value > entry[summary_max]) {
+            entry[summary_max] = value;
+            entry[summary_max_proc] = iproc;
+          }
+          entry[summary_count] += 1.0;
+          entry[summary_sum] += value;
+          const double delta = value - entry[summary_mean];
+          entry[summary_mean] += delta/entry[summary_count];
+          entry[summary_m2] += delta*(value - entry[summary_mean]);
+          entry[summary_histogram+log_histogram_bucket(value)] += 1.0;
+        }
+      }
+    }
+  }
+  
+#ifdef USING_MPIC
+  // One reduction of the whole summary with a custom operation
+  MPI_Datatype summary_type;
+  MPI_Op summary_op;
+  MPI_Type_contiguous(summary_size, MPI_DOUBLE, &summary_type);
+  MPI_Type_commit(&summary_type);
+  MPI_Op_create(summary_reduce, 1, &summary_op);
+  
+  if(db_proc_id() == s_owner_proc_id) {
+    summary.assign(local.size(), 0.0);
+  }
+  MPI_Reduce(&local[0], (summary.empty() ? nullptr : &summary[0]), nsummaries, 
+    summary_type, summary_op, s_owner_proc_id, s_db_comm);
+  
+  MPI_Op_free(&summary_op);
+  MPI_Type_free(&summary_type);
+  
+  long long total_threads = 0;
+  MPI_Reduce(&nthreads, &total_threads, 1, MPI_LONG_LONG, MPI_SUM, s_owner_proc_id, s_db_comm);
+  return total_threads;
+#else // USING_MPIC
+  summary.swap(local);
+  return nthreads;
+#endif // USING_MPIC
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::insert_into_perf_summary(long long run_id, 
+    const std::vector<double> &summary) {
+  using namespace perfoscope_internal;
+  int sqlrc = SQLITE_OK;
+  sqlite3_stmt *stmt;
+  const char *query = "insert into perf_summary(profile_id, category_id, event_id, run_id, "
+    "count, min_proc_id, max_proc_id, min, max, sum, sumsq, mean, stddev, p50, p90, p99, sketch) "
+    "values (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13, ?14, ?15, ?16, ?17);";
+  const int ncategories = s_template.categories_count();
+  const int nvalues = s_event_ids.size();
+  
+  if((sqlrc = sqlite3_prepare_v2(s_sqldb, query, -1, &stmt, NULL)) != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not create statement for inserting perfdata summary (error: %s, code: %d)", sqlite3_errstr(sqlrc), sqlrc);
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+    return sqlrc;
+  }
+  
+  // The sketch is stored sparse as (bucket, count) pairs of 32 bit integers
+  std::vector<int> sketch;
+  for(int ci = 0; ci < ncategories && sqlrc == SQLITE_OK; ++ci) {
+    for(int vi = 0; vi < nvalues && sqlrc == SQLITE_OK; ++vi) {
+      const double *entry = &summary[(ci*nvalues+vi)*summary_size];
+      const double n = entry[summary_count];
+      const double mean = entry[summary_mean];
+      const double variance = (n > 1.0 ? entry[summary_m2]/(n-1.0) : 0.0);
+      
+      sketch.clear();
+      for(int bi = 0; bi < log_histogram_size; ++bi) {
+        if(entry[summary_histogram+bi] > 0.0) {
+          sketch.push_back(bi);
+          sketch.push_back(int(entry[summary_histogram+bi]));
+        }
+      }
+      
+      const long long int_values[] = {
+        s_profile_id, s_category_ids[ci], s_event_ids[vi], run_id, (long long)n, 
+        (long long)entry[summary_min_proc], (long long)entry[summary_max_proc]
+      };
+      const double real_values[] = {
+        entry[summary_min], entry[summary_max], entry[summary_sum], entry[summary_m2] + n*mean*mean, 
+        mean, (variance > 0.0 ? std::sqrt(variance) : 0.0), summary_quantile(entry, 0.5), 
+        summary_quantile(entry, 0.9), summary_quantile(entry, 0.99)
+      };
+      const int nint_values = sizeof(int_values)/sizeof(int_values[0]);
+      const int nreal_values = sizeof(real_values)/sizeof(real_values[0]);
+      
+      if((sqlrc = sqlite3_reset(stmt)) == SQLITE_OK) {
+        for(int pi = 0; pi < nint_values && sqlrc == SQLITE_OK; ++pi) {
+          sqlrc = sqlite3_bind_int64(stmt, 1+pi, int_values[pi]);
+        }
+        for(int pi = 0; pi < nreal_values && sqlrc == SQLITE_OK; ++pi) {
+          sqlrc = sqlite3_bind_double(stmt, 1+nint_values+pi, real_values[pi]);
+        }
+        if(sqlrc == SQLITE_OK) {
+          sqlrc = sqlite3_bind_blob(stmt, 1+nint_values+nreal_values, 
+            (sketch.empty() ? "" : (const void*)&sketch[0]), sketch.size()*sizeof(int), SQLITE_TRANSIENT);
+        }
+        if(sqlrc == SQLITE_OK) {
+          if((sqlrc = sqlite3_step(stmt)) == SQLITE_DONE) {
+            sqlrc = SQLITE_OK;
+          }
+        }
+      }
+    }
+  }
+  sqlite3_finalize(stmt);
+  
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not insert values into table 'perf_summary'"
+      " (error: %s, code:%d)", sqlite3_errstr(sqlrc), sqlrc);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::create_table_perf_thread() {
+  char *query, *sqlem;
+  int sqlrc = SQLITE_OK;
+  
+  if(s_forkeyon) {
+    query = "create table if not exists perf_thread("
+      "id integer primary key autoincrement, "
+      "run_id integer not null references perf_run(id), "
+      "proc_id int not null, "
+      "thread_id int not null, "
+      "cpu int not null, "
+      "numa_node int not null);";
+  } else {
+    query = "create table if not exists perf_thread("
+      "id integer primary key autoincrement, "
+      "run_id integer not null, "
+      "proc_id int not null, "
+      "thread_id int not null, "
+      "cpu int not null, "
+      "numa_node int not null);";
+  }
+  
+  sqlrc = sqlite3_exec(s_sqldb, query, NULL, NULL, &sqlem);
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not create table 'perf_thread': %s", sqlem);
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+    sqlite3_free(sqlem);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::insert_into_perf_thread(long long run_id, 
+    const std::vector<PerfThreadRow> &threads) {
+  int sqlrc = SQLITE_OK;
+  sqlite3_stmt *stmt = nullptr;
+  const char *query = "insert into perf_thread(run_id, proc_id, thread_id, cpu, numa_node) "
+    "values (?1, ?2, ?3, ?4, ?5);";
+  
+  if((sqlrc = sqlite3_prepare_v2(s_sqldb, query, -1, &stmt, NULL)) != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+  }
+  for(size_t ti = 0; ti < threads.size() && sqlrc == SQLITE_OK; ++ti) {
+    sqlite3_reset(stmt);
+    sqlite3_bind_int64(stmt, 1, run_id);
+    sqlite3_bind_int(stmt, 2, threads[ti].proc_id);
+    sqlite3_bind_int(stmt, 3, threads[ti].thread_id);
+    sqlite3_bind_int(stmt, 4, threads[ti].cpu);
+    sqlite3_bind_int(stmt, 5, threads[ti].numa_node);
+    if((sqlrc = sqlite3_step(stmt)) == SQLITE_DONE) {
+      sqlrc = SQLITE_OK;
+    }
+  }
+  sqlite3_finalize(stmt);
+  
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not insert values into table 'perf_thread'"
+      " (error: %s, code:%d)", sqlite3_errstr(sqlrc), sqlrc);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::create_table_perf_run_event_coverage() {
+  char *query, *sqlem;
+  int sqlrc = SQLITE_OK;
+  
+  if(s_forkeyon) {
+    query = "create table if not exists perf_run_event_coverage("
+      "run_id integer not null references perf_run(id), "
+      "event_id integer not null references perf_event(id), "
+      "estimated_coverage numeric not null, "
+      "primary key(run_id, event_id));";
+  } else {
+    query = "create table if not exists perf_run_event_coverage("
+      "run_id integer not null, "
+      "event_id integer not null, "
+      "estimated_coverage numeric not null, "
+      "primary key(run_id, event_id));";
+  }
+  
+  sqlrc = sqlite3_exec(s_sqldb, query, NULL, NULL, &sqlem);
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not create table 'perf_run_event_coverage': %s", sqlem);
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+    sqlite3_free(sqlem);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::insert_into_perf_run_event_coverage(long long run_id, 
+    const std::vector<PerfCoverageRow> &coverage) {
+  int sqlrc = SQLITE_OK;
+  sqlite3_stmt *stmt = nullptr;
+  const char *query = "insert into perf_run_event_coverage(run_id, event_id, estimated_coverage) "
+    "values (?1, ?2, ?3);";
+  
+  if(coverage.empty()) {
+    return SQLITE_OK;
+  }
+  
+  if((sqlrc = sqlite3_prepare_v2(s_sqldb, query, -1, &stmt, NULL)) != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+  }
+  for(size_t ri = 0; ri < coverage.size() && sqlrc == SQLITE_OK; ++ri) {
+    sqlite3_reset(stmt);
+    sqlite3_bind_int64(stmt, 1, run_id);
+    sqlite3_bind_int64(stmt, 2, coverage[ri].event_id);
+    sqlite3_bind_double(stmt, 3, coverage[ri].estimated_coverage);
+    if((sqlrc = sqlite3_step(stmt)) == SQLITE_DONE) {
+      sqlrc = SQLITE_OK;
+    }
+  }
+  sqlite3_finalize(stmt);
+  
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not insert values into table 'perf_run_event_coverage'"
+      " (error: %s, code:%d)", sqlite3_errstr(sqlrc), sqlrc);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+// Cost of one accumulate call of a thread, counts for an event and seconds 
+// for the time
+int PerfoscopeUtil::create_table_perf_call_overhead() {
+  char *query, *sqlem;
+  int sqlrc = SQLITE_OK;
+  
+  if(s_forkeyon) {
+    query = "create table if not exists perf_call_overhead("
+      "id integer primary key autoincrement, "
+      "run_id integer not null references perf_run(id), "
+      "proc_id int not null, "
+      "thread_id int not null, "
+      "event_id integer not null references perf_event(id), "
+      "overhead numeric not null);";
+  } else {
+    query = "create table if not exists perf_call_overhead("
+      "id integer primary key autoincrement, "
+      "run_id integer not null, "
+      "proc_id int not null, "
+      "thread_id int not null, "
+      "event_id integer not null, "
+      "overhead numeric not null);";
+  }
+  
+  sqlrc = sqlite3_exec(s_sqldb, query, NULL, NULL, &sqlem);
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not create table 'perf_call_overhead': %s", sqlem);
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+    sqlite3_free(sqlem);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::insert_into_perf_call_overhead(long long run_id, 
+    const std::vector<PerfOverheadRow> &overheads) {
+  int sqlrc = SQLITE_OK;
+  sqlite3_stmt *stmt = nullptr;
+  const char *query = "insert into perf_call_overhead(run_id, proc_id, thread_id, event_id, overhead) "
+    "values (?1, ?2, ?3, ?4, ?5);";
+  
+  if(overheads.empty()) {
+    return SQLITE_OK;
+  }
+  
+  if((sqlrc = sqlite3_prepare_v2(s_sqldb, query, -1, &stmt, NULL)) != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+  }
+  for(size_t ri = 0; ri < overheads.size() && sqlrc == SQLITE_OK; ++ri) {
+    sqlite3_reset(stmt);
+    sqlite3_bind_int64(stmt, 1, run_id);
+    sqlite3_bind_int(stmt, 2, overheads[ri].proc_id);
+    sqlite3_bind_int(stmt, 3, overheads[ri].thread_id);
+    sqlite3_bind_int64(stmt, 4, overheads[ri].event_id);
+    sqlite3_bind_double(stmt, 5, overheads[ri].overhead);
+    if((sqlrc = sqlite3_step(stmt)) == SQLITE_DONE) {
+      sqlrc = SQLITE_OK;
+    }
+  }
+  sqlite3_finalize(stmt);
+  
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not insert values into table 'perf_call_overhead'"
+      " (error: %s, code:%d)", sqlite3_errstr(sqlrc), sqlrc);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+// The values of perf_value less the overhead of the calls of a category, 
+// not negative
+int PerfoscopeUtil::create_table_perf_compensated_value() {
+  char *query, *sqlem;
+  int sqlrc = SQLITE_OK;
+  
+  if(s_forkeyon) {
+    query = "create table if not exists perf_compensated_value("
+      "id integer primary key autoincrement, "
+      "run_id integer not null references perf_run(id), "
+      "proc_id int not null, "
+      "thread_id int not null, "
+      "category_id integer not null references perf_category(id), "
+      "event_id integer not null references perf_event(id), "
+      "value numeric not null);";
+  } else {
+    query = "create table if not exists perf_compensated_value("
+      "id integer primary key autoincrement, "
+      "run_id integer not null, "
+      "proc_id int not null, "
+      "thread_id int not null, "
+      "category_id integer not null, "
+      "event_id integer not null, "
+      "value numeric not null);";
+  }
+  
+  sqlrc = sqlite3_exec(s_sqldb, query, NULL, NULL, &sqlem);
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not create table 'perf_compensated_value': %s", sqlem);
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+    sqlite3_free(sqlem);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::insert_into_perf_compensated_value(long long run_id, 
+    const std::vector<PerfValueRow> &compensated) {
+  int sqlrc = SQLITE_OK;
+  sqlite3_stmt *stmt = nullptr;
+  const char *query = "insert into perf_compensated_value(run_id, proc_id, thread_id, category_id, event_id, value) "
+    "values (?1, ?2, ?3, ?4, ?5, ?6);";
+  
+  if(compensated.empty()) {
+    return SQLITE_OK;
+  }
+  
+  if((sqlrc = sqlite3_prepare_v2(s_sqldb, query, -1, &stmt, NULL)) != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+  }
+  for(size_t ri = 0; ri < compensated.size() && sqlrc == SQLITE_OK; ++ri) {
+    sqlite3_reset(stmt);
+    sqlite3_bind_int64(stmt, 1, run_id);
+    sqlite3_bind_int(stmt, 2, compensated[ri].proc_id);
+    sqlite3_bind_int(stmt, 3, compensated[ri].thread_id);
+    sqlite3_bind_int64(stmt, 4, compensated[ri].category_id);
+    sqlite3_bind_int64(stmt, 5, compensated[ri].event_id);
+    sqlite3_bind_double(stmt, 6, compensated[ri].real_value);
+    if((sqlrc = sqlite3_step(stmt)) == SQLITE_DONE) {
+      sqlrc = SQLITE_OK;
+    }
+  }
+  sqlite3_finalize(stmt);
+  
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not insert values into table 'perf_compensated_value'"
+      " (error: %s, code:%d)", sqlite3_errstr(sqlrc), sqlrc);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::create_table_perf_metric_name() {
+  char *query, *sqlem;
+  int sqlrc = SQLITE_OK;
+  
+  query = "create table if not exists perf_metric_name("
+    "id integer primary key autoincrement, "
+    "name text not null unique);";
+  
+  sqlrc = sqlite3_exec(s_sqldb, query, NULL, NULL, &sqlem);
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not create table 'perf_metric_name': %s", sqlem);
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+    sqlite3_free(sqlem);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+// The bound metrics get their name ids once, s_metric_name_ids is indexed 
+// by the defined metrics like PerfMetricRow::metric
+int PerfoscopeUtil::insert_perf_metric_names() {
+  int sqlrc = SQLITE_OK;
+  if(db_proc_id() == s_owner_proc_id) {
+    sqlite3_stmt *insert_stmt = nullptr, *select_stmt = nullptr;
+    s_metric_name_ids.assign(metrics_count(), -1);
+    if((sqlrc = sqlite3_prepare_v2(s_sqldb, "insert or ignore into perf_metric_name(name) values(?1);", -1, &insert_stmt, NULL)) == SQLITE_OK && 
+        (sqlrc = sqlite3_prepare_v2(s_sqldb, "select id from perf_metric_name where name=?1;", -1, &select_stmt, NULL)) == SQLITE_OK) {
+      for(size_t bi = 0; bi < s_bound_metrics.size() && sqlrc == SQLITE_OK; ++bi) {
+        const int mi = s_bound_metrics[bi].metric;
+        sqlite3_reset(insert_stmt);
+        sqlite3_bind_text(insert_stmt, 1, metric_name(mi).c_str(), -1, SQLITE_STATIC);
+        if((sqlrc = sqlite3_step(insert_stmt)) == SQLITE_DONE) {
+          sqlite3_reset(select_stmt);
+          sqlite3_bind_text(select_stmt, 1, metric_name(mi).c_str(), -1, SQLITE_STATIC);
+          if((sqlrc = sqlite3_step(select_stmt)) == SQLITE_ROW) {
+            s_metric_name_ids[mi] = sqlite3_column_int64(select_stmt, 0);
+            sqlrc = SQLITE_OK;
+          }
+        }
+      }
+    }
+    sqlite3_finalize(insert_stmt);
+    sqlite3_finalize(select_stmt);
+    
+    if(sqlrc != SQLITE_OK) {
+      if(sqlrc == SQLITE_DONE) {
+        sqlrc = SQLITE_NOTFOUND;
+      }
+      print_error(__FILE__, __LINE__, "Could not insert values into table 'perf_metric_name'"
+        " (error: %s, code:%d)", sqlite3_errstr(sqlrc), sqlrc);
+    }
+  }
+#ifdef USING_MPIC
+  MPI_Bcast(&sqlrc, 1, MPI_INT, s_owner_proc_id, s_db_comm);
+#endif // USING_MPIC
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::create_table_perf_metric() {
+  char *query, *sqlem;
+  int sqlrc = SQLITE_OK;
+  
+  if(s_forkeyon) {
+    query = "create table if not exists perf_metric("
+      "id integer primary key autoincrement, "
+      "run_id integer not null references perf_run(id), "
+      "proc_id int not null, "
+      "thread_id int not null, "
+      "category_id integer not null references perf_category(id), "
+      "name_id integer not null references perf_metric_name(id), "
+      "value numeric not null);";
+  } else {
+    query = "create table if not exists perf_metric("
+      "id integer primary key autoincrement, "
+      "run_id integer not null, "
+      "proc_id int not null, "
+      "thread_id int not null, "
+      "category_id integer not null, "
+      "name_id integer not null, "
+      "value numeric not null);";
+  }
+  
+  sqlrc = sqlite3_exec(s_sqldb, query, NULL, NULL, &sqlem);
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not create table 'perf_metric': %s", sqlem);
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+    sqlite3_free(sqlem);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::insert_into_perf_metric(long long run_id, 
+    const std::vector<PerfMetricRow> &metrics) {
+  int sqlrc = SQLITE_OK;
+  sqlite3_stmt *stmt = nullptr;
+  const char *query = "insert into perf_metric(run_id, proc_id, thread_id, category_id, name_id, value) "
+    "values (?1, ?2, ?3, ?4, ?5, ?6);";
+  
+  if(metrics.empty()) {
+    return SQLITE_OK;
+  }
+  
+  if((sqlrc = sqlite3_prepare_v2(s_sqldb, query, -1, &stmt, NULL)) != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+  }
+  for(size_t ri = 0; ri < metrics.size() && sqlrc == SQLITE_OK; ++ri) {
+    sqlite3_reset(stmt);
+    sqlite3_bind_int64(stmt, 1, run_id);
+    sqlite3_bind_int(stmt, 2, metrics[ri].proc_id);
+    sqlite3_bind_int(stmt, 3, metrics[ri].thread_id);
+    sqlite3_bind_int64(stmt, 4, metrics[ri].category_id);
+    sqlite3_bind_int64(stmt, 5, s_metric_name_ids[metrics[ri].metric]);
+    sqlite3_bind_double(stmt, 6, metrics[ri].value);
+    if((sqlrc = sqlite3_step(stmt)) == SQLITE_DONE) {
+      sqlrc = SQLITE_OK;
+    }
+  }
+  sqlite3_finalize(stmt);
+  
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not insert values into table 'perf_metric'"
+      " (error: %s, code:%d)", sqlite3_errstr(sqlrc), sqlrc);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::create_table_perf_sample() {
+  char *query, *sqlem;
+  int sqlrc = SQLITE_OK;
+  
+  if(s_forkeyon) {
+    query = "create table if not exists perf_sample("
+      "id integer primary key autoincrement, "
+      "run_id integer not null references perf_run(id), "
+      "proc_id int not null, "
+      "thread_id int not null, "
+      "category_id integer references perf_category(id), "
+      "symbol text not null, "
+      "stack text not null, "
+      "count integer not null);";
+  } else {
+    query = "create table if not exists perf_sample("
+      "id integer primary key autoincrement, "
+      "run_id integer not null, "
+      "proc_id int not null, "
+      "thread_id int not null, "
+      "category_id integer, "
+      "symbol text not null, "
+      "stack text not null, "
+      "count integer not null);";
+  }
+  
+  sqlrc = sqlite3_exec(s_sqldb, query, NULL, NULL, &sqlem);
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not create table 'perf_sample': %s", sqlem);
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+    sqlite3_free(sqlem);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::insert_into_perf_sample(long long run_id, 
+    const std::vector<PerfSampleRow> &samples) {
+  int sqlrc = SQLITE_OK;
+  sqlite3_stmt *stmt = nullptr;
+  const char *query = "insert into perf_sample(run_id, proc_id, thread_id, category_id, symbol, stack, count) "
+    "values (?1, ?2, ?3, ?4, ?5, ?6, ?7);";
+  
+  if(samples.empty()) {
+    return SQLITE_OK;
+  }
+  
+  if((sqlrc = sqlite3_prepare_v2(s_sqldb, query, -1, &stmt, NULL)) != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+  }
+  for(size_t si = 0; si < samples.size() && sqlrc == SQLITE_OK; ++si) {
+    sqlite3_reset(stmt);
+    sqlite3_bind_int64(stmt, 1, run_id);
+    sqlite3_bind_int(stmt, 2, samples[si].proc_id);
+    sqlite3_bind_int(stmt, 3, samples[si].thread_id);
+    if(samples[si].category_id < 0) {
+      sqlite3_bind_null(stmt, 4);
+    } else {
+      sqlite3_bind_int64(stmt, 4, samples[si].category_id);
+    }
+    sqlite3_bind_text(stmt, 5, samples[si].symbol.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 6, samples[si].stack.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 7, samples[si].count);
+    if((sqlrc = sqlite3_step(stmt)) == SQLITE_DONE) {
+      sqlrc = SQLITE_OK;
+    }
+  }
+  sqlite3_finalize(stmt);
+  
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not insert values into table 'perf_sample'"
+      " (error: %s, code:%d)", sqlite3_errstr(sqlrc), sqlrc);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::create_table_perf_call() {
+  char *query, *sqlem;
+  int sqlrc = SQLITE_OK;
+  
+  if(s_forkeyon) {
+    query = "create table if not exists perf_call("
+      "id integer primary key autoincrement, "
+      "run_id integer not null references perf_run(id), "
+      "proc_id int not null, "
+      "thread_id int not null, "
+      "category_id integer not null references perf_category(id), "
+      "count integer not null, "
+      "min numeric not null, "
+      "max numeric not null, "
+      "mean numeric not null, "
+      "variance numeric not null);";
+  } else {
+    query = "create table if not exists perf_call("
+      "id integer primary key autoincrement, "
+      "run_id integer not null, "
+      "proc_id int not null, "
+      "thread_id int not null, "
+      "category_id integer not null, "
+      "count integer not null, "
+      "min numeric not null, "
+      "max numeric not null, "
+      "mean numeric not null, "
+      "variance numeric not null);";
+  }
+  
+  sqlrc = sqlite3_exec(s_sqldb, query, NULL, NULL, &sqlem);
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not create table 'perf_call': %s", sqlem);
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+    sqlite3_free(sqlem);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::create_table_perf_call_bucket() {
+  char *query, *sqlem;
+  int sqlrc = SQLITE_OK;
+  
+  if(s_forkeyon) {
+    query = "create table if not exists perf_call_bucket("
+      "id integer primary key autoincrement, "
+      "call_id integer not null references perf_call(id), "
+      "bucket int not null, "
+      "lower numeric not null, "
+      "upper numeric not null, "
+      "count integer not null);";
+  } else {
+    query = "create table if not exists perf_call_bucket("
+      "id integer primary key autoincrement, "
+      "call_id integer not null, "
+      "bucket int not null, "
+      "lower numeric not null, "
+      "upper numeric not null, "
+      "count integer not null);";
+  }
+  
+  sqlrc = sqlite3_exec(s_sqldb, query, NULL, NULL, &sqlem);
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not create table 'perf_call_bucket': %s", sqlem);
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+    sqlite3_free(sqlem);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::insert_into_perf_call(long long run_id, 
+    const std::vector<PerfCallRow> &calls) {
+  int sqlrc = SQLITE_OK;
+  sqlite3_stmt *call_stmt = nullptr;
+  sqlite3_stmt *bucket_stmt = nullptr;
+  const char *call_query = "insert into perf_call(run_id, proc_id, thread_id, category_id, "
+    "count, min, max, mean, variance) values (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9);";
+  const char *bucket_query = "insert into perf_call_bucket(call_id, bucket, lower, upper, count) "
+    "values (?1, ?2, ?3, ?4, ?5);";
+  
+  if(calls.empty()) {
+    return SQLITE_OK;
+  }
+  
+  if((sqlrc = sqlite3_prepare_v2(s_sqldb, call_query, -1, &call_stmt, NULL)) != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Query: %s", call_query);
+  } else if((sqlrc = sqlite3_prepare_v2(s_sqldb, bucket_query, -1, &bucket_stmt, NULL)) != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Query: %s", bucket_query);
+  }
+  
+  for(size_t ri = 0; ri < calls.size() && sqlrc == SQLITE_OK; ++ri) {
+    const PerfCallRow &call = calls[ri];
+    sqlite3_reset(call_stmt);
+    sqlite3_bind_int64(call_stmt, 1, run_id);
+    sqlite3_bind_int(call_stmt, 2, call.proc_id);
+    sqlite3_bind_int(call_stmt, 3, call.thread_id);
+    sqlite3_bind_int64(call_stmt, 4, call.category_id);
+    sqlite3_bind_int64(call_stmt, 5, call.count);
+    sqlite3_bind_double(call_stmt, 6, call.min_time);
+    sqlite3_bind_double(call_stmt, 7, call.max_time);
+    sqlite3_bind_double(call_stmt, 8, call.mean_time);
+    sqlite3_bind_double(call_stmt, 9, call.variance_time);
+    if((sqlrc = sqlite3_step(call_stmt)) != SQLITE_DONE) {
+      break;
+    }
+    sqlrc = SQLITE_OK;
+    const long long call_id = sqlite3_last_insert_rowid(s_sqldb);
+    
+    for(size_t bi = 0; bi < call.buckets.size() && sqlrc == SQLITE_OK; bi += 2) {
+      const int bucket = call.buckets[bi];
+      sqlite3_reset(bucket_stmt);
+      sqlite3_bind_int64(bucket_stmt, 1, call_id);
+      sqlite3_bind_int(bucket_stmt, 2, bucket);
+      sqlite3_bind_double(bucket_stmt, 3, 1e-9*perfoscope_internal::duration_histogram_lower(bucket));
+      sqlite3_bind_double(bucket_stmt, 4, 1e-9*perfoscope_internal::duration_histogram_upper(bucket));
+      sqlite3_bind_int64(bucket_stmt, 5, call.buckets[bi+1]);
+      if((sqlrc = sqlite3_step(bucket_stmt)) == SQLITE_DONE) {
+        sqlrc = SQLITE_OK;
+      }
+    }
+  }
+  sqlite3_finalize(bucket_stmt);
+  sqlite3_finalize(call_stmt);
+  
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not insert values into table 'perf_call'"
+      " (error: %s, code:%d)", sqlite3_errstr(sqlrc), sqlrc);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::create_table_perf_series() {
+  char *query, *sqlem;
+  int sqlrc = SQLITE_OK;
+  
+  if(s_forkeyon) {
+    query = "create table if not exists perf_series("
+      "id integer primary key autoincrement, "
+      "run_id integer not null references perf_run(id), "
+      "proc_id int not null, "
+      "thread_id int not null, "
+      "iteration integer not null, "
+      "iterations integer not null, "
+      "category_id integer not null references perf_category(id), "
+      "event_id integer not null references perf_event(id), "
+      "value numeric not null);";
+  } else {
+    query = "create table if not exists perf_series("
+      "id integer primary key autoincrement, "
+      "run_id integer not null, "
+      "proc_id int not null, "
+      "thread_id int not null, "
+      "iteration integer not null, "
+      "iterations integer not null, "
+      "category_id integer not null, "
+      "event_id integer not null, "
+      "value numeric not null);";
+  }
+  
+  sqlrc = sqlite3_exec(s_sqldb, query, NULL, NULL, &sqlem);
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not create table 'perf_series': %s", sqlem);
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+    sqlite3_free(sqlem);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::insert_into_perf_series(long long run_id, 
+    const std::vector<PerfSeriesRow> &series) {
+  int sqlrc = SQLITE_OK;
+  sqlite3_stmt *stmt = nullptr;
+  const char *query = "insert into perf_series(run_id, proc_id, thread_id, iteration, iterations, "
+    "category_id, event_id, value) values (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8);";
+  
+  if(series.empty()) {
+    return SQLITE_OK;
+  }
+  
+  if((sqlrc = sqlite3_prepare_v2(s_sqldb, query, -1, &stmt, NULL)) != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+  }
+  
+  for(size_t ri = 0; ri < series.size() && sqlrc == SQLITE_OK; ++ri) {
+    const PerfSeriesRow &row = series[ri];
+    sqlite3_reset(stmt);
+    sqlite3_bind_int64(stmt, 1, run_id);
+    sqlite3_bind_int(stmt, 2, row.value.proc_id);
+    sqlite3_bind_int(stmt, 3, row.value.thread_id);
+    sqlite3_bind_int64(stmt, 4, row.iteration);
+    sqlite3_bind_int64(stmt, 5, row.iterations);
+    sqlite3_bind_int64(stmt, 6, row.value.category_id);
+    sqlite3_bind_int64(stmt, 7, row.value.event_id);
+    if(row.value.is_real) {
+      sqlite3_bind_double(stmt, 8, row.value.real_value);
+    } else {
+      sqlite3_bind_int64(stmt, 8, row.value.int_value);
+    }
+    if((sqlrc = sqlite3_step(stmt)) == SQLITE_DONE) {
+      sqlrc = SQLITE_OK;
+    }
+  }
+  sqlite3_finalize(stmt);
+  
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not insert values into table 'perf_series'"
+      " (error: %s, code:%d)", sqlite3_errstr(sqlrc), sqlrc);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::create_table_perf_path() {
+  char *query, *sqlem;
+  int sqlrc = SQLITE_OK;
+  
+  if(s_forkeyon) {
+    query = "create table if not exists perf_path("
+      "id integer primary key autoincrement, "
+      "run_id integer not null references perf_run(id), "
+      "proc_id int not null, "
+      "thread_id int not null, "
+      "category_id integer not null references perf_category(id), "
+      "parent_id integer references perf_path(id), "
+      "count integer not null);";
+  } else {
+    query = "create table if not exists perf_path("
+      "id integer primary key autoincrement, "
+      "run_id integer not null, "
+      "proc_id int not null, "
+      "thread_id int not null, "
+      "category_id integer not null, "
+      "parent_id integer, "
+      "count integer not null);";
+  }
+  
+  sqlrc = sqlite3_exec(s_sqldb, query, NULL, NULL, &sqlem);
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not create table 'perf_path': %s", sqlem);
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+    sqlite3_free(sqlem);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::create_table_perf_path_value() {
+  char *query, *sqlem;
+  int sqlrc = SQLITE_OK;
+  
+  if(s_forkeyon) {
+    query = "create table if not exists perf_path_value("
+      "id integer primary key autoincrement, "
+      "path_id integer not null references perf_path(id), "
+      "event_id integer not null references perf_event(id), "
+      "inclusive numeric not null, "
+      "exclusive numeric not null);";
+  } else {
+    query = "create table if not exists perf_path_value("
+      "id integer primary key autoincrement, "
+      "path_id integer not null, "
+      "event_id integer not null, "
+      "inclusive numeric not null, "
+      "exclusive numeric not null);";
+  }
+  
+  sqlrc = sqlite3_exec(s_sqldb, query, NULL, NULL, &sqlem);
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not create table 'perf_path_value': %s", sqlem);
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+    sqlite3_free(sqlem);
+  }
+  
+  return sqlrc;
+}
+#endif // USING_PERFOSCOPE_DBSTORE
+
+#ifdef USING_PERFOSCOPE_DBSTORE
+int PerfoscopeUtil::insert_into_perf_path(long long run_id, 
+    const std::vector<PerfPathRow> &paths) {
+  int sqlrc = SQLITE_OK;
+  sqlite3_stmt *path_stmt = nullptr;
+  sqlite3_stmt *value_stmt = nullptr;
+  const char *path_query = "insert into perf_path(run_id, proc_id, thread_id, category_id, parent_id, count) "
+    "values (?1, ?2, ?3, ?4, ?5, ?6);";
+  const char *value_query = "insert into perf_path_value(path_id, event_id, inclusive, exclusive) "
+    "values (?1, ?2, ?3, ?4);";
+  
+  if(paths.empty()) {
+    return SQLITE_OK;
+  }
+  
+  if((sqlrc = sqlite3_prepare_v2(s_sqldb, path_query, -1, &path_stmt, NULL)) != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Query: %s", path_query);
+  } else if((sqlrc = sqlite3_prepare_v2(s_sqldb, value_query, -1, &value_stmt, NULL)) != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Query: %s", value_query);
+  }
+  
+  // The paths of a thread are consecutive and every parent precedes its 
+  // children, parent_id refers to the row inserted for the parent.
+  std::vector<long long> path_ids(paths.size());
+  size_t thread_start = 0;
+  const int nevents = s_template.events_count();
+  for(size_t ri = 0; ri < paths.size() && sqlrc == SQLITE_OK; ++ri) {
+    const PerfPathRow &path = paths[ri];
+    if(path.path == 0) {
+      thread_start = ri;
+    }
+    
+    sqlite3_reset(path_stmt);
+    sqlite3_bind_int64(path_stmt, 1, run_id);
+    sqlite3_bind_int(path_stmt, 2, path.proc_id);
+    sqlite3_bind_int(path_stmt, 3, path.thread_id);
+    sqlite3_bind_int64(path_stmt, 4, path.category_id);
+    if(path.parent < 0) {
+      sqlite3_bind_null(path_stmt, 5);
+    } else {
+      sqlite3_bind_int64(path_stmt, 5, path_ids[thread_start + path.parent]);
+    }
+    sqlite3_bind_int64(path_stmt, 6, path.count);
+    if((sqlrc = sqlite3_step(path_stmt)) != SQLITE_DONE) {
+      break;
+    }
+    sqlrc = SQLITE_OK;
+    path_ids[ri] = sqlite3_last_insert_rowid(s_sqldb);
+    
+    for(int ei = 0; ei < int(s_event_ids.size()) && sqlrc == SQLITE_OK; ++ei) {
+      sqlite3_reset(value_stmt);
+      sqlite3_bind_int64(value_stmt, 1, path_ids[ri]);
+      sqlite3_bind_int64(value_stmt, 2, s_event_ids[ei]);
+      if(ei < nevents) {
+        sqlite3_bind_int64(value_stmt, 3, path.inclusive_values[ei]);
+        sqlite3_bind_int64(value_stmt, 4, path.exclusive_values[ei]);
+      } else {
+        sqlite3_bind_double(value_stmt, 3, path.inclusive_time);
+        sqlite3_bind_double(value_stmt, 4, path.exclusive_time);
+      }
+      if((sqlrc = sqlite3_step(value_stmt)) == SQLITE_DONE) {
+        sqlrc = SQLITE_OK;
+      }
     }
-#endif // #ifdef USING_PERFOSCOPE_WCT
+  }
+  sqlite3_finalize(value_stmt);
+  sqlite3_finalize(path_stmt);
+  
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not insert values into table 'perf_path'"
+      " (error: %s, code:%d)", sqlite3_errstr(sqlrc), sqlrc);
   }
   
   return sqlrc;
@@ -905,84 +3613,143 @@ int PerfoscopeUtil::insert_perfoscope_data(
 #endif // USING_PERFOSCOPE_DBSTORE
 
 #ifdef USING_PERFOSCOPE_DBSTORE
-void PerfoscopeUtil::extract_perfoscope_data_to_arrays(
-    const PerfoscopeData &data, long long *counter_values, double *real_time) {
-  int cvi = 0, rti = 0;
-  for(int ci = 0; ci < data.categories_count(); ++ci) {
-    const long long *values = data.category_values(ci);
-    for(int ei = 0; ei < data.events_count(); ++ei) {
-      counter_values[cvi++] = values[ei];
-    }
-    real_time[rti++] = data.category_real_time(ci);
+int PerfoscopeUtil::create_table_perf_summary() {
+  char *query, *sqlem;
+  int sqlrc = SQLITE_OK;
+  
+  if(s_forkeyon) {
+    query = "create table if not exists perf_summary("
+      "id integer primary key autoincrement, "
+      "profile_id integer not null references perf_profile(id), "
+      "category_id integer not null references perf_category(id), "
+      "event_id integer not null references perf_event(id), "
+      "run_id integer not null references perf_run(id), "
+      "count integer not null, "
+      "min numeric not null, "
+      "min_proc_id int not null, "
+      "max numeric not null, "
+      "max_proc_id int not null, "
+      "sum numeric not null, "
+      "sumsq numeric not null, "
+      "mean numeric not null, "
+      "stddev numeric not null, "
+      "p50 numeric not null, "
+      "p90 numeric not null, "
+      "p99 numeric not null, "
+      "sketch blob not null);";
+  } else {
+    query = "create table if not exists perf_summary("
+      "id integer primary key autoincrement, "
+      "profile_id integer not null, "
+      "category_id integer not null, "
+      "event_id integer not null, "
+      "run_id integer not null, "
+      "count integer not null, "
+      "min numeric not null, "
+      "min_proc_id int not null, "
+      "max numeric not null, "
+      "max_proc_id int not null, "
+      "sum numeric not null, "
+      "sumsq numeric not null, "
+      "mean numeric not null, "
+      "stddev numeric not null, "
+      "p50 numeric not null, "
+      "p90 numeric not null, "
+      "p99 numeric not null, "
+      "sketch blob not null);";
   }
+  
+  sqlrc = sqlite3_exec(s_sqldb, query, NULL, NULL, &sqlem);
+  if(sqlrc != SQLITE_OK) {
+    print_error(__FILE__, __LINE__, "Could not create table 'perf_summary': %s", sqlem);
+    print_error(__FILE__, __LINE__, "Query: %s", query);
+    sqlite3_free(sqlem);
+  }
+  
+  return sqlrc;
 }
 #endif // USING_PERFOSCOPE_DBSTORE
 
 #ifdef USING_PERFOSCOPE_DBSTORE
 int PerfoscopeUtil::create_perfoscope_data_schema() {
   int sqlrc = SQLITE_OK;
-  if(perfoscope_internal::iproc() == s_owner_proc_id) {
+  if(db_proc_id() == s_owner_proc_id) {
     if((sqlrc = create_table_perf_profile()) == SQLITE_OK) {
       if((sqlrc = create_table_perf_category()) == SQLITE_OK) {
         if((sqlrc = create_table_perf_event()) == SQLITE_OK) {
           if((sqlrc = create_table_perf_run()) == SQLITE_OK) {
-            sqlrc = create_table_perf_value();
+            if((sqlrc = create_table_perf_value()) == SQLITE_OK) {
+              if((sqlrc = create_table_perf_summary()) == SQLITE_OK) {
+                if((sqlrc = create_table_perf_path()) == SQLITE_OK) {
+                  if((sqlrc = create_table_perf_path_value()) == SQLITE_OK) {
+                    if((sqlrc = create_table_perf_thread()) == SQLITE_OK) {
+                      if((sqlrc = create_table_perf_sample()) == SQLITE_OK) {
+                        if((sqlrc = create_table_perf_call()) == SQLITE_OK) {
+                          if((sqlrc = create_table_perf_call_bucket()) == SQLITE_OK) {
+                            if((sqlrc = create_table_perf_series()) == SQLITE_OK) {
+                              if((sqlrc = create_table_perf_run_event_coverage()) == SQLITE_OK) {
+                                if((sqlrc = create_table_perf_run_event_group()) == SQLITE_OK) {
+                                  if((sqlrc = create_table_perf_metric_name()) == SQLITE_OK) {
+                                    sqlrc = create_table_perf_metric();
+                                  }
+                                  if(sqlrc == SQLITE_OK) {
+                                    if((sqlrc = create_table_perf_machine()) == SQLITE_OK) {
+                                      if((sqlrc = create_table_perf_run_machine()) == SQLITE_OK) {
+                                        if((sqlrc = create_table_perf_call_overhead()) == SQLITE_OK) {
+                                          sqlrc = create_table_perf_compensated_value();
+                                        }
+                                      }
+                                    }
+                                  }
+                                }
+                              }
+                            }
+                          }
+                        }
+                      }
+                    }
+                  }
+                }
+              }
+            }
           }
         }
       }
     }
   }
 #ifdef USING_MPIC
-  MPI_Bcast(&sqlrc, 1, MPI_INT, s_owner_proc_id, MPI_COMM_WORLD);
+  MPI_Bcast(&sqlrc, 1, MPI_INT, s_owner_proc_id, s_db_comm);
 #endif // USING_MPIC
   return sqlrc;
 }
 #endif // USING_PERFOSCOPE_DBSTORE
 
-#ifdef USING_PERFOSCOPE_DBSTORE
-void PerfoscopeUtil::add_perfoscope_data(const PerfoscopeData &data, 
-    long long run_id) {
-  int sqlrc = SQLITE_OK;
-  const int ncategories = data.categories_count();
-  const int nevents = data.events_count();
-  const int array_size = ncategories*nevents;
-  std::vector<long long> counter_values(array_size);
-  std::vector<double> real_time(ncategories);
-  
-  extract_perfoscope_data_to_arrays(data, &counter_values[0], &real_time[0]);
+/**---------------------------------------------------------------------------*/
+
+void Perfoscope::init(const char *file, const int line) {
+  unsigned int cpu, numa_node;
+  if(syscall(SYS_getcpu, &cpu, &numa_node, nullptr) == 0) {
+    m_data->m_cpu = cpu;
+    m_data->m_numa_node = numa_node;
+  }
   
-  if(perfoscope_internal::iproc() == s_owner_proc_id) {
-    sqlrc = insert_perfoscope_data(perfoscope_internal::iproc(), data, run_id, &counter_values[0], &real_time[0]);
-    if(sqlrc != SQLITE_OK) {
-      print_error(__FILE__, __LINE__, "Error adding perfoscope data to db for process %d (error: %s, code: %d)", 
-        perfoscope_internal::iproc(), sqlite3_errstr(sqlrc), sqlrc);
+#ifdef USING_PERFOSCOPE_SAMPLING
+  if(PerfoscopeUtil::sampling_interval() > 0) {
+    if(m_data->m_samples == nullptr) {
+      m_data->m_samples = new SampleBuffer();
     }
-    
-#ifdef USING_MPIC
-    MPI_Status status;
-    for(int pi  = 0; pi < perfoscope_internal::nproc(); ++pi) {
-      if(pi != s_owner_proc_id) {
-        MPI_Recv(&counter_values[0], array_size, MPI_LONG_LONG, pi, 0, MPI_COMM_WORLD, &status);
-        MPI_Recv(&real_time[0], ncategories, MPI_DOUBLE, pi, 1, MPI_COMM_WORLD, &status);
-        sqlrc = insert_perfoscope_data(pi, data, run_id, &counter_values[0], &real_time[0]);
-        if(sqlrc != SQLITE_OK) {
-          print_error(__FILE__, __LINE__, "Error adding perfoscope data to db for process %d (error: %s, code: %d)", 
-            pi, sqlite3_errstr(sqlrc), sqlrc);
-        }
-      }
+    int sampleerr = m_data->m_samples->open(PerfoscopeUtil::sampling_capacity(), PerfoscopeUtil::sampling_frames());
+    if(sampleerr == 0) {
+      sampleerr = m_data->m_samples->start(PerfoscopeUtil::sampling_interval());
+    }
+    if(sampleerr != 0) {
+      PerfoscopeUtil::print_error(file, line, "%s - could not start sampling (error: %s)", 
+        __PRETTY_FUNCTION__, strerror(sampleerr));
+      perfoscope_internal::abort(sampleerr);
     }
-  } else {
-    MPI_Status status;
-    MPI_Send(&counter_values[0], array_size, MPI_LONG_LONG, s_owner_proc_id, 0, MPI_COMM_WORLD);
-    MPI_Send(&real_time[0], ncategories, MPI_DOUBLE, s_owner_proc_id, 1, MPI_COMM_WORLD);
-#endif // USING_MPIC
   }
-}
-#endif // USING_PERFOSCOPE_DBSTORE
-
-/**---------------------------------------------------------------------------*/
-
-void Perfoscope::init(const char *file, const int line) {
+#endif // USING_PERFOSCOPE_SAMPLING
+  
 #ifdef USING_PERFOSCOPE_HWC
   int errcode;
   const int nevents = m_data->m_event_codes.size();
@@ -1010,6 +3777,20 @@ void Perfoscope::init(const char *file, const int line) {
     perfoscope_internal::abort(errcode);
   }
   
+  // A multiplexed eventset must be bound to the CPU component before it is 
+  // made multiplexed
+  if(PerfoscopeUtil::multiplex()) {
+    errcode = PAPI_assign_eventset_component(m_eventset, 0);
+    if(errcode == PAPI_OK) {
+      errcode = PAPI_set_multiplex(m_eventset);
+    }
+    if(errcode != PAPI_OK) {
+      PerfoscopeUtil::print_error(file, line, "%s - %s, PAPI errorcode: %d, PAPI error: %s", 
+        __PRETTY_FUNCTION__, "could not multiplex eventset", errcode, PAPI_strerror(errcode));
+      perfoscope_internal::abort(errcode);
+    }
+  }
+  
   // Add events to eventset
   for(int i = 0; i < nevents; ++i) {
     errcode = PAPI_add_event(m_eventset, m_data->m_event_codes[i]);
@@ -1023,6 +3804,21 @@ void Perfoscope::init(const char *file, const int line) {
       perfoscope_internal::abort(errcode);
     }
   }
+  m_stop_values.resize(nevents);
+  
+  // PAPI does not report how long a multiplexed event was counted. With 
+  // round-robin scheduling every event gets about the share of the counters 
+  // that the native events of the eventset need.
+  if(PerfoscopeUtil::multiplex()) {
+    int nnative = 0;
+    for(int i = 0; i < nevents; ++i) {
+      PAPI_event_info_t info;
+      nnative += (PAPI_get_event_info(m_data->m_event_codes[i], &info) == PAPI_OK && info.count > 0 ? info.count : 1);
+    }
+    const int ncounters = PAPI_num_cmp_hwctrs(0);
+    const double coverage = (ncounters > 0 && nnative > ncounters ? double(ncounters)/nnative : 1.0);
+    m_data->m_event_coverage.assign(nevents, coverage);
+  }
   
   //errcode = PAPI_add_events(m_eventset, &m_data->m_event_codes[0], nevents);
   //if(errcode != PAPI_OK) {
@@ -1031,6 +3827,76 @@ void Perfoscope::init(const char *file, const int line) {
   //  perfoscope_internal::abort(errcode);
   //}
 #endif // USING_PERFOSCOPE_HWC
+  
+#ifdef USING_PERFOSCOPE_TRACE
+  const int ntrace_categories = m_data->categories_count();
+  const int ntrace_events = m_data->events_count();
+  std::vector<std::string> category_names(ntrace_categories);
+  std::vector<std::string> event_names(ntrace_events);
+  for(int ci = 0; ci < ntrace_categories; ++ci) {
+    category_names[ci] = m_data->category_name(ci);
+  }
+  for(int ei = 0; ei < ntrace_events; ++ei) {
+    event_names[ei] = m_data->event_name(ei, file, line);
+  }
+  
+  std::stringstream filename;
+  filename << (PerfoscopeUtil::trace_file_prefix().length() == 0 ? 
+      m_data->profile_name() : PerfoscopeUtil::trace_file_prefix())
+    << ".p" << perfoscope_internal::iproc() << ".t" << m_data->thread_id() << ".trace";
+  
+  m_trace = new TraceBuffer();
+  m_trace_deltas.resize(ntrace_events);
+  int traceerr = m_trace->open(filename.str().c_str(), perfoscope_internal::iproc(), 
+    m_data->thread_id(), m_data->profile_name(), category_names, event_names, 
+    PerfoscopeUtil::trace_capacity());
+  if(traceerr != 0) {
+    PerfoscopeUtil::print_error(file, line, "%s - could not open trace file %s (error: %s)", 
+      __PRETTY_FUNCTION__, filename.str().c_str(), strerror(traceerr));
+    perfoscope_internal::abort(traceerr);
+  }
+#endif // USING_PERFOSCOPE_TRACE
+  
+  if(PerfoscopeUtil::compensate_overhead()) {
+    calibrate(file, line);
+  }
+}
+
+// Consecutive accumulate calls measure nothing but the cost of a call. The 
+// calibration is the smallest mean of a batch of calls, which drops batches 
+// that were interrupted. The calls go to category 0, which is cleared 
+// afterwards.
+void Perfoscope::calibrate(const char *file, const int line) {
+  const int nbatches = 16;
+  const int ncalls = 64;
+  const int nvalues = m_data->values_stride();
+  const long long *row = m_data->category_values(0);
+  
+  if(m_data->categories_count() == 0) {
+    return;
+  }
+  
+  start(file, line);
+  // The first batch warms up
+  for(int bi = 0; bi <= nbatches; ++bi) {
+    accumulate(0, file, line);
+    m_data->reset_counter_values(0);
+    for(int i = 0; i < ncalls; ++i) {
+      accumulate(0, file, line);
+    }
+    for(int vi = 0; vi < nvalues && bi > 0; ++vi) {
+      const double overhead = double(row[vi])/ncalls;
+      if(bi == 1 || overhead < m_data->m_call_overhead[vi]) {
+        m_data->m_call_overhead[vi] = overhead;
+      }
+    }
+  }
+  stop(file, line);
+  
+  m_data->reset_counter_values(0);
+#ifdef USING_PERFOSCOPE_TRACE
+  m_trace->clear();
+#endif // USING_PERFOSCOPE_TRACE
 }
 
 void Perfoscope::start(const char *file, const int line) {
@@ -1050,6 +3916,9 @@ void Perfoscope::start(const char *file, const int line) {
 
 void Perfoscope::reset(const char *file, const int line) {
 #ifdef USING_PERFOSCOPE_HWC
+  if(m_region_depth > 0) {
+    save_region_counters(file, line);
+  }
   int errcode = PAPI_reset(m_eventset);
   if(errcode != PAPI_OK) {
     PerfoscopeUtil::print_error(file, line, "%s - %s, PAPI errorcode: %d, PAPI error: %s",
@@ -1063,52 +3932,6 @@ void Perfoscope::reset(const char *file, const int line) {
 #endif // USING_PERFOSCOPE_WCT
 }
 
-void Perfoscope::accumulate(const int ci, const char *file, const int line) {
-#ifdef USING_PERFOSCOPE_WCT
-  perfoscope_internal::real_time_t temp = perfoscope_internal::get_real_time();
-  m_data->m_category_data[ci].real_time += perfoscope_internal::difftime(temp, m_real_time);
-  m_real_time = temp;
-#endif // USING_PERFOSCOPE_WCT
-  
-#ifdef USING_PERFOSCOPE_HWC
-  int errcode = PAPI_accum(m_eventset, &m_data->m_category_data[ci].counter_values[0]);
-  if(errcode != PAPI_OK) {
-    PerfoscopeUtil::print_error(file, line, "%s - %s, PAPI errorcode: %d, PAPI error: %s",
-      __PRETTY_FUNCTION__, "could not accumulate PAPI counters", errcode, PAPI_strerror(errcode));
-    perfoscope_internal::abort(errcode);
-  }
-#endif // USING_PERFOSCOPE_HWC
-}
-
-void Perfoscope::stop(const int ci, const char *file, const int line) {
-#ifdef USING_PERFOSCOPE_WCT
-  perfoscope_internal::real_time_t temp = perfoscope_internal::get_real_time();
-  m_data->m_category_data[ci].real_time += perfoscope_internal::difftime(temp, m_real_time);
-  m_real_time = temp;
-#endif // USING_PERFOSCOPE_WCT
-  
-#ifdef USING_PERFOSCOPE_HWC
-  int errcode = PAPI_stop(m_eventset, &m_data->m_category_data[ci].counter_values[0]);
-  if(errcode != PAPI_OK) {
-    PerfoscopeUtil::print_error(file, line, "%s - %s, PAPI errorcode: %d, PAPI error: %s",
-      __PRETTY_FUNCTION__, "could not stop PAPI counters", errcode, PAPI_strerror(errcode));
-    perfoscope_internal::abort(errcode);
-  }
-#endif // USING_PERFOSCOPE_HWC
-}
-
-void Perfoscope::stop(const char *file, const int line) {
-#ifdef USING_PERFOSCOPE_HWC
-  std::vector<long long> temp(m_data->events_count());
-  int errcode = PAPI_stop(m_eventset, &temp[0]);
-  if(errcode != PAPI_OK) {
-    PerfoscopeUtil::print_error(file, line, "%s - %s, PAPI errorcode: %d, PAPI error: %s",
-      __PRETTY_FUNCTION__, "could not stop PAPI counters", errcode, PAPI_strerror(errcode));
-    perfoscope_internal::abort(errcode);
-  }
-#endif // USING_PERFOSCOPE_HWC
-}
-
 void Perfoscope::destroy(const char *file, const int line) {
 #ifdef USING_PERFOSCOPE_HWC
   int errcode;
@@ -1138,19 +3961,170 @@ void Perfoscope::destroy(const char *file, const int line) {
     perfoscope_internal::abort(errcode);
   }
 #endif // USING_PERFOSCOPE_HWC
+  
+#ifdef USING_PERFOSCOPE_TRACE
+  delete m_trace;
+  m_trace = nullptr;
+#endif // USING_PERFOSCOPE_TRACE
+  
+#ifdef USING_PERFOSCOPE_SAMPLING
+  // The samples stay in the PerfoscopeData until it is deleted
+  if(m_data->m_samples != nullptr) {
+    m_data->m_samples->stop();
+  }
+#endif // USING_PERFOSCOPE_SAMPLING
+}
+
+void Perfoscope::fail(const char *function, const char *what, int errcode, 
+    const char *file, const int line) {
+  PerfoscopeUtil::print_error(file, line, "%s - %s", function, what);
+  perfoscope_internal::abort(errcode);
 }
 
+#ifdef USING_PERFOSCOPE_HWC
+void Perfoscope::fail_papi(const char *function, const char *what, int errcode, 
+    const char *file, const int line) {
+  PerfoscopeUtil::print_error(file, line, "%s - %s, PAPI errorcode: %d, PAPI error: %s",
+    function, what, errcode, PAPI_strerror(errcode));
+  perfoscope_internal::abort(errcode);
+}
+#endif // USING_PERFOSCOPE_HWC
+
 PerfoscopeData **all_pscope_data = nullptr;
 int all_pscope_data_count = 0;
 
 /**---------------------------------------------------------------------------*/
 
+const PerfoscopeData * PerfoscopeThreads::s_template = nullptr;
+std::atomic<PerfoscopeThreads::ThreadNode*> PerfoscopeThreads::s_threads(nullptr);
+std::atomic<int> PerfoscopeThreads::s_nthreads(0);
+thread_local Perfoscope * PerfoscopeThreads::s_current = nullptr;
+thread_local PerfoscopeThreads::ThreadNode * PerfoscopeThreads::s_node = nullptr;
+
+const PerfoscopeData& PerfoscopeThreads::init(
+    const char *profile,
+    const char *categories[],
+    const int ncategories,
+    const char *events[],
+    const int nevents,
+    const char *dbfilename, 
+    const char *dbvfs, 
+    const char *file, 
+    const int line) {
+  s_template = &PerfoscopeUtil::init(profile, categories, ncategories, 
+    events, nevents, dbfilename, dbvfs, file, line);
+  return *s_template;
+}
+
+void PerfoscopeThreads::finalize(const char *file, const int line) {
+  detach();
+  
+  ThreadNode *node = s_threads.exchange(nullptr, std::memory_order_acquire);
+  while(node != nullptr) {
+    // Once the node is orphaned the thread may free it any time, so nothing 
+    // is read from it after the exchange
+    ThreadNode *next = node->next;
+    const int thread_id = node->data->thread_id();
+    if(node->state.exchange(NODE_ORPHANED, std::memory_order_acq_rel) == NODE_DETACHED) {
+      delete node->data;
+      delete node;
+    } else {
+      // The thread is still running, its Perfoscope can only be destroyed by 
+      // the thread itself, which frees the node when it exits
+      PerfoscopeUtil::print_error(file, line, "%s - thread %d is still attached", 
+        __PRETTY_FUNCTION__, thread_id);
+    }
+    node = next;
+  }
+  s_nthreads.store(0, std::memory_order_release);
+  
+  PerfoscopeUtil::finalize(file, line);
+}
+
+Perfoscope * PerfoscopeThreads::attach() {
+  static thread_local ThreadExit thread_exit;
+  (void)thread_exit;
+  
+  ThreadNode *node = new ThreadNode();
+  node->state.store(NODE_ATTACHED, std::memory_order_relaxed);
+  node->data = s_template->clone(s_nthreads.fetch_add(1, std::memory_order_acq_rel));
+  node->pscope = new Perfoscope(node->data);
+  node->pscope->init(__FILE__, __LINE__);
+  node->pscope->start(__FILE__, __LINE__);
+  
+  // Push onto the list of threads
+  node->next = s_threads.load(std::memory_order_relaxed);
+  while(!s_threads.compare_exchange_weak(node->next, node, 
+      std::memory_order_release, std::memory_order_relaxed)) {
+  }
+  
+  s_node = node;
+  s_current = node->pscope;
+  return s_current;
+}
+
+void PerfoscopeThreads::detach() {
+  if(s_node != nullptr) {
+    Perfoscope *pscope = s_node->pscope;
+    pscope->stop(__FILE__, __LINE__);
+    pscope->destroy(__FILE__, __LINE__);
+    s_node->pscope = nullptr;
+    delete pscope;
+    // finalize has already unlinked the node
+    if(s_node->state.exchange(NODE_DETACHED, std::memory_order_acq_rel) == NODE_ORPHANED) {
+      delete s_node->data;
+      delete s_node;
+    }
+    s_node = nullptr;
+    s_current = nullptr;
+  }
+}
+
+// The attached threads ordered by thread id
+std::vector<PerfoscopeThreads::ThreadNode*> PerfoscopeThreads::nodes() {
+  std::vector<ThreadNode*> list;
+  for(ThreadNode *node = s_threads.load(std::memory_order_acquire); node != nullptr; node = node->next) {
+    list.push_back(node);
+  }
+  std::sort(list.begin(), list.end(), [](const ThreadNode *lhs, const ThreadNode *rhs) {
+    return lhs->data->thread_id() < rhs->data->thread_id();
+  });
+  return list;
+}
+
+void PerfoscopeThreads::add_run_data(const int problem_size) {
+  std::vector<ThreadNode*> list = nodes();
+  std::vector<const PerfoscopeData*> data_list(list.size());
+  for(size_t ti = 0; ti < list.size(); ++ti) {
+    data_list[ti] = list[ti]->data;
+  }
+  PerfoscopeUtil::add_run_data(data_list.data(), data_list.size(), problem_size);
+}
+
+void PerfoscopeThreads::reset_counter_values() {
+  std::vector<ThreadNode*> list = nodes();
+  for(size_t ti = 0; ti < list.size(); ++ti) {
+    list[ti]->data->reset_counter_values();
+  }
+}
+
+void PerfoscopeThreads::mark_iteration() {
+  std::vector<ThreadNode*> list = nodes();
+  for(size_t ti = 0; ti < list.size(); ++ti) {
+    list[ti]->data->mark_iteration();
+  }
+}
+
+/**---------------------------------------------------------------------------*/
+
 TextTable * create_texttable(const PerfoscopeData &data) {
   int nevents = data.events_count();
   int ncategories = data.categories_count();
   int ei = 0;
+  const std::vector<PerfoscopeUtil::BoundMetric> metrics = PerfoscopeUtil::bind_metrics(data);
+  const int nmetrics = metrics.size();
   
-  TextTable *table = new TextTable(nevents+2, ncategories+1, 2);
+  TextTable *table = new TextTable(nevents+2+nmetrics, ncategories+1, 2);
   
   for(int ci = 0; ci < ncategories; ++ci) {
     table->at(0, ci+1) = data.category_name(ci);
@@ -1166,21 +4140,245 @@ TextTable * create_texttable(const PerfoscopeData &data) {
   table->at(ei+1, 0) = "time";
 #endif // #ifdef USING_PERFOSCOPE_WCT
   
+  for(int mi = 0; mi < nmetrics; ++mi) {
+    table->at(nevents+2+mi, 0) = PerfoscopeUtil::metric_name(metrics[mi].metric);
+  }
+  
+  // With overhead compensation the values less the overhead of the calls
+  const bool compensate = PerfoscopeUtil::compensate_overhead();
+  std::vector<double> row(nevents+1);
   for(int ci = 0; ci < ncategories; ++ci) {
+    for(ei = 0; ei < nevents; ++ei) {
+      row[ei] = (compensate ? data.compensated_value(ci, ei) : double(data.category_values(ci)[ei]));
+    }
+    row[nevents] = (compensate ? data.compensated_real_time(ci) : data.category_real_time(ci));
+    
     ei = 0;
 #ifdef USING_PERFOSCOPE_HWC
-    const long long *values = data.category_values(ci);
     for(ei = 0; ei < nevents; ++ei) {
       std::stringstream valuestrm;
-      valuestrm << values[ei];
+      valuestrm << std::llround(row[ei]);
       table->at(ei+1, ci+1) = valuestrm.str();
     }
 #endif // #ifdef USING_PERFOSCOPE_HWC
 #ifdef USING_PERFOSCOPE_WCT
     std::stringstream real_time_strm;
-    real_time_strm << data.category_real_time(ci);
+    real_time_strm << row[nevents];
     table->at(ei+1, ci+1) = real_time_strm.str();
 #endif // #ifdef USING_PERFOSCOPE_WCT
+    
+    for(int mi = 0; mi < nmetrics; ++mi) {
+      const double value = PerfoscopeUtil::evaluate_metric(metrics[mi], row.data());
+      if(std::isfinite(value)) {
+        std::stringstream metricstrm;
+        metricstrm << value;
+        table->at(nevents+2+mi, ci+1) = metricstrm.str();
+      }
+    }
+  }
+  
+  return table;
+}
+
+TextTable * create_path_texttable(const PerfoscopeData &data) {
+  int npaths = data.paths_count();
+  
+  // Only the columns of the time and events that are measured, col is the 
+  // first column of the events
+#ifdef USING_PERFOSCOPE_WCT
+  const int col = 4;
+#else // USING_PERFOSCOPE_WCT
+  const int col = 2;
+#endif // USING_PERFOSCOPE_WCT
+#ifdef USING_PERFOSCOPE_HWC
+  const int nevents = data.events_count();
+  const int ncolumns = col + 2*nevents;
+#else // USING_PERFOSCOPE_HWC
+  const int ncolumns = col;
+#endif // USING_PERFOSCOPE_HWC
+  
+  TextTable *table = new TextTable(npaths+1, ncolumns, 2);
+  
+  table->at(0, 0) = "path";
+  table->at(0, 1) = "count";
+#ifdef USING_PERFOSCOPE_WCT
+  table->at(0, 2) = "time (incl)";
+  table->at(0, 3) = "time (excl)";
+#endif // #ifdef USING_PERFOSCOPE_WCT
+#ifdef USING_PERFOSCOPE_HWC
+  for(int ei = 0; ei < nevents; ++ei) {
+    table->at(0, col+2*ei) = data.event_name(ei) + " (incl)";
+    table->at(0, col+2*ei+1) = data.event_name(ei) + " (excl)";
+  }
+#endif // #ifdef USING_PERFOSCOPE_HWC
+  
+  // Parents precede their children, so the names of the call paths are 
+  // built in one pass
+  std::vector<std::string> names(npaths);
+  for(int pi = 0; pi < npaths; ++pi) {
+    const int parent = data.path_parent(pi);
+    names[pi] = (parent < 0 ? "" : names[parent] + "/") + data.category_name(data.path_category(pi));
+    
+    std::stringstream countstrm;
+    countstrm << data.path_count(pi);
+    table->at(pi+1, 0) = names[pi];
+    table->at(pi+1, 1) = countstrm.str();
+#ifdef USING_PERFOSCOPE_WCT
+    std::stringstream inclusive_strm, exclusive_strm;
+    inclusive_strm << data.path_inclusive_time(pi);
+    exclusive_strm << data.path_exclusive_time(pi);
+    table->at(pi+1, 2) = inclusive_strm.str();
+    table->at(pi+1, 3) = exclusive_strm.str();
+#endif // #ifdef USING_PERFOSCOPE_WCT
+#ifdef USING_PERFOSCOPE_HWC
+    for(int ei = 0; ei < nevents; ++ei) {
+      std::stringstream inclusive_strm, exclusive_strm;
+      inclusive_strm << data.path_inclusive_values(pi)[ei];
+      exclusive_strm << data.path_exclusive_values(pi)[ei];
+      table->at(pi+1, col+2*ei) = inclusive_strm.str();
+      table->at(pi+1, col+2*ei+1) = exclusive_strm.str();
+    }
+#endif // #ifdef USING_PERFOSCOPE_HWC
+  }
+  
+  return table;
+}
+
+TextTable * create_call_texttable(const PerfoscopeData &data) {
+  int ncategories = data.categories_count();
+  const char *columns[] = {"category", "count", "min", "mean", "stddev", "max", "p50", "p99", "p999"};
+#ifdef USING_PERFOSCOPE_WCT
+  const int ncolumns = 9;
+#else // USING_PERFOSCOPE_WCT
+  const int ncolumns = 2;
+#endif // USING_PERFOSCOPE_WCT
+  
+  TextTable *table = new TextTable(ncategories+1, ncolumns, 2);
+  
+  for(int col = 0; col < ncolumns; ++col) {
+    table->at(0, col) = columns[col];
+  }
+  
+  for(int ci = 0; ci < ncategories; ++ci) {
+    const PerfoscopeData::CallStats &stats = data.call_stats(ci);
+    std::stringstream countstrm;
+    countstrm << stats.count;
+    table->at(ci+1, 0) = data.category_name(ci);
+    table->at(ci+1, 1) = countstrm.str();
+#ifdef USING_PERFOSCOPE_WCT
+    const double values[7] = {1e-9*stats.min_time, data.call_time_mean(ci), 
+      std::sqrt(data.call_time_variance(ci)), 1e-9*stats.max_time, 
+      data.call_time_quantile(ci, 0.5), data.call_time_quantile(ci, 0.99), 
+      data.call_time_quantile(ci, 0.999)};
+    for(int vi = 0; vi < 7; ++vi) {
+      std::stringstream valuestrm;
+      valuestrm << values[vi];
+      table->at(ci+1, vi+2) = valuestrm.str();
+    }
+#endif // #ifdef USING_PERFOSCOPE_WCT
+  }
+  
+  return table;
+}
+
+// Places the categories on the roofline of the share of a thread of the 
+// machine peaks. FLOP and bytes are the metrics "FLOP" and "<level> bytes", 
+// or the roofline estimates of a category times its calls if FLOP is not 
+// measured. The calls are the call_stats count, the regions and the 
+// accumulate/stop calls of the category, unlike the flat_count of the 
+// overhead compensation. The intensity is the one of the deepest level with 
+// bytes.
+TextTable * create_roofline_texttable(const PerfoscopeData &data) {
+  int nevents = data.events_count();
+  int ncategories = data.categories_count();
+  const char *columns[] = {"category", "time", "GFLOP/s", "FLOP/byte", "bound GFLOP/s", "bound by", "% of bound"};
+  const int ncolumns = 7;
+  
+  const std::vector<PerfoscopeUtil::BoundMetric> metrics = PerfoscopeUtil::bind_metrics(data);
+  int flop_metric = -1;
+  int bytes_metrics[MachinePeaks::nlevels];
+  for(int li = 0; li < MachinePeaks::nlevels; ++li) {
+    bytes_metrics[li] = -1;
+  }
+  for(size_t mi = 0; mi < metrics.size(); ++mi) {
+    const std::string &name = PerfoscopeUtil::metric_name(metrics[mi].metric);
+    if(name == "FLOP") {
+      flop_metric = mi;
+    }
+    for(int li = 0; li < MachinePeaks::nlevels; ++li) {
+      if(name == std::string(Roofline::level_name(li)) + " bytes") {
+        bytes_metrics[li] = mi;
+      }
+    }
+  }
+  
+  MachinePeaks peaks = PerfoscopeUtil::machine_peaks();
+  if(peaks.nthreads > 1) {
+    peaks.gflops /= peaks.nthreads;
+    for(int li = 0; li < MachinePeaks::nlevels; ++li) {
+      peaks.bandwidths[li] /= peaks.nthreads;
+    }
+  }
+  
+  TextTable *table = new TextTable(ncategories+1, ncolumns, 2);
+  
+  for(int col = 0; col < ncolumns; ++col) {
+    table->at(0, col) = columns[col];
+  }
+  
+  std::vector<double> row(nevents+1);
+  for(int ci = 0; ci < ncategories; ++ci) {
+    for(int ei = 0; ei < nevents; ++ei) {
+      row[ei] = double(data.category_values(ci)[ei]);
+    }
+    row[nevents] = data.category_real_time(ci);
+    
+    double flop = 0.0;
+    double bytes[MachinePeaks::nlevels] = {0.0};
+    double flop_per_call, bytes_per_call;
+    if(flop_metric >= 0) {
+      flop = PerfoscopeUtil::evaluate_metric(metrics[flop_metric], row.data());
+      for(int li = 0; li < MachinePeaks::nlevels; ++li) {
+        if(bytes_metrics[li] >= 0) {
+          bytes[li] = PerfoscopeUtil::evaluate_metric(metrics[bytes_metrics[li]], row.data());
+        }
+      }
+    } else if(PerfoscopeUtil::roofline_estimate(data.category_name(ci), &flop_per_call, &bytes_per_call)) {
+      const long long ncalls = data.call_stats(ci).count;
+      flop = flop_per_call*ncalls;
+      bytes[MachinePeaks::nlevels-1] = bytes_per_call*ncalls;
+    }
+    
+    std::stringstream timestrm;
+    timestrm << row[nevents];
+    table->at(ci+1, 0) = data.category_name(ci);
+    table->at(ci+1, 1) = timestrm.str();
+    if(flop <= 0.0 || row[nevents] <= 0.0) {
+      continue;
+    }
+    
+    const double gflops = 1e-9*flop/row[nevents];
+    std::stringstream gflopsstrm;
+    gflopsstrm << gflops;
+    table->at(ci+1, 2) = gflopsstrm.str();
+    for(int li = MachinePeaks::nlevels-1; li >= 0; --li) {
+      if(bytes[li] > 0.0) {
+        std::stringstream intensitystrm;
+        intensitystrm << flop/bytes[li];
+        table->at(ci+1, 3) = intensitystrm.str();
+        break;
+      }
+    }
+    if(peaks.gflops > 0.0) {
+      int limit;
+      const double bound = Roofline::bound(peaks, flop, bytes, &limit);
+      std::stringstream boundstrm, percentstrm;
+      boundstrm << bound;
+      percentstrm << 100.0*gflops/bound;
+      table->at(ci+1, 4) = boundstrm.str();
+      table->at(ci+1, 5) = (limit < 0 ? "compute" : Roofline::level_name(limit));
+      table->at(ci+1, 6) = percentstrm.str();
+    }
   }
   
   return table;
@@ -2,6 +2,8 @@
 #define _PERFOSCOPE_HPP_
 
 #include "texttablefwd.hpp"
+#include "metricformula.hpp"
+#include "roofline.hpp"
 #include "common.hpp"
 
 #ifdef USING_PERFOSCOPE_HWC
@@ -12,9 +14,25 @@
 #include <sqlite3.h>
 #endif // USING_PERFOSCOPE_DBSTORE
 
+#ifdef USING_PERFOSCOPE_TRACE
+#ifndef USING_PERFOSCOPE_WCT
+#error "USING_PERFOSCOPE_TRACE requires USING_PERFOSCOPE_WCT"
+#endif // USING_PERFOSCOPE_WCT
+#include "tracebuffer.hpp"
+#endif // USING_PERFOSCOPE_TRACE
+
+#ifdef USING_PERFOSCOPE_SAMPLING
+#include "samplebuffer.hpp"
+#endif // USING_PERFOSCOPE_SAMPLING
+
 #include <string>
 #include <vector>
 #include <sstream>
+#include <type_traits>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <cstdlib>
 
 /**---------------------------------------------------------------------------*/
 
@@ -37,11 +55,278 @@ public:
   
   static void finalize(const char *file = "\0", const int line = 0); // main, sync
   
+  // Adds a run with the data of the count threads of this process, null 
+  // entries of the list are skipped. In RUN_DATA_SUMMARY mode only the 
+  // statistics in perf_summary are stored, the per-thread values, paths, 
+  // call statistics, time series, samples, coverage, metrics and overhead 
+  // compensation of the run are dropped.
   static void add_run_data(
     const PerfoscopeData* perfoscope_data_list[], 
     const int count, 
     const int problem_size = -1); // main, sync
   
+  // RUN_DATA_ALL stores the values of every process and thread, 
+  // RUN_DATA_SUMMARY reduces them across processes and threads and stores 
+  // only statistics per category and event in perf_summary.
+  enum RunDataMode {
+    RUN_DATA_ALL, 
+    RUN_DATA_SUMMARY
+  };
+  
+  static void run_data_mode(RunDataMode mode) {
+    s_run_data_mode = mode;
+  }
+  
+  static RunDataMode run_data_mode() {
+    return s_run_data_mode;
+  }
+  
+  // Prints the timer chosen by init, the collect and insert times of every 
+  // run added to the db and the peaks measured by the roofline kernels
+  static void verbose(bool enabled) {
+    s_verbose = enabled;
+  }
+  
+  static bool verbose() {
+    return s_verbose;
+  }
+  
+  // PERSIST_AT_FINALIZE keeps the db in memory and writes it to the db file 
+  // at finalize, PERSIST_STREAMING writes every run to the db file (WAL 
+  // journal) in one transaction as it is added and checkpoints the journal 
+  // every checkpoint_interval runs. Must be set before init.
+  enum PersistenceMode {
+    PERSIST_AT_FINALIZE, 
+    PERSIST_STREAMING
+  };
+  
+  static void persistence_mode(PersistenceMode mode, int checkpoint_interval = 1) {
+    s_persistence_mode = mode;
+    s_checkpoint_interval = (checkpoint_interval < 1 ? 1 : checkpoint_interval);
+  }
+  
+  static PersistenceMode persistence_mode() {
+    return s_persistence_mode;
+  }
+  
+  // STORAGE_SHARED writes all data to one db on the owner process, 
+  // STORAGE_SHARD_PER_NODE and STORAGE_SHARD_PER_PROCESS write one db per 
+  // node (written by the node leader) or per process, named 
+  // <dbfilename>.shard<proc_id of the writer>. Adding run data to a per 
+  // process shard needs no communication. Shards are combined with 
+  // perfoscope-merge, summaries need all processes so sharded storage 
+  // always stores all values. Must be set before init.
+  enum StorageMode {
+    STORAGE_SHARED, 
+    STORAGE_SHARD_PER_NODE, 
+    STORAGE_SHARD_PER_PROCESS
+  };
+  
+  static void storage_mode(StorageMode mode) {
+    s_storage_mode = mode;
+  }
+  
+  static StorageMode storage_mode() {
+    return s_storage_mode;
+  }
+  
+  // Every cloned PerfoscopeData keeps up to capacity snapshots of its 
+  // values, one per iteration marked with perfoscope_iteration (0 disables 
+  // the series). A full series drops every second snapshot and from then on 
+  // records every second iteration. Must be set before the PerfoscopeData 
+  // are cloned.
+  static void series_capacity(long long capacity) {
+    s_series_capacity = (capacity <= 0 ? 0 : (capacity < 2 ? 2 : capacity + (capacity & 1)));
+  }
+  
+  static long long series_capacity() {
+    return s_series_capacity;
+  }
+  
+  // Derived metrics are formulas (see MetricFormula) over the event names 
+  // and time, the real time in seconds. They are evaluated per process, 
+  // thread and category when run data is added, stored in perf_metric and 
+  // shown by create_texttable. A metric with a variable that is not 
+  // measured is skipped. Common metrics over PAPI presets are defined by 
+  // default, adding a metric with the name of a defined one replaces its 
+  // formula. Must be set before init.
+  static void add_metric(const char *name, const char *formula, 
+    const char *file = "\0", const int line = 0);
+  
+  static void clear_metrics() {
+    metric_registry().clear();
+  }
+  
+  static int metrics_count() {
+    return metric_registry().size();
+  }
+  
+  static const std::string & metric_name(const int mi) {
+    return metric_registry()[mi].name;
+  }
+  
+  static const MetricFormula & metric_formula(const int mi) {
+    return metric_registry()[mi].formula;
+  }
+  
+  // A metric whose variables are all in a row of values of a 
+  // PerfoscopeData, the counter values of its events followed by the real 
+  // time in seconds
+  struct BoundMetric {
+    int metric;
+    std::vector<int> columns;
+  };
+  
+  static std::vector<BoundMetric> bind_metrics(const PerfoscopeData &data);
+  
+  static double evaluate_metric(const BoundMetric &metric, const double *row) {
+    return metric_formula(metric.metric).evaluate(row, metric.columns.data());
+  }
+  
+  // Measures the peaks of the machine with the kernels of Roofline at init, 
+  // unless perf_machine already holds the peaks of the host. The db owner 
+  // process measures them and shares them with the processes of its db. 
+  // Must be set before init.
+  static void roofline(bool enabled) {
+    s_roofline = enabled;
+  }
+  
+  static bool roofline() {
+    return s_roofline;
+  }
+  
+  static const MachinePeaks & machine_peaks() {
+    return s_machine_peaks;
+  }
+  
+  // FLOP and bytes moved from memory per call of a category, the roofline 
+  // of a category uses them when the FLOP metric is not measured. A call is 
+  // a region of the category or an accumulate/stop of it.
+  static void roofline_estimate(const char *category, double flop, double bytes);
+  
+  static bool roofline_estimate(const std::string &category, double *flop, double *bytes);
+  
+  // Perfoscope::init calibrates the cost of an accumulate call of its 
+  // thread, for the time and every event, which the reports then subtract 
+  // once per call from the values of a category. perf_value keeps the raw 
+  // values, perf_compensated_value holds the compensated ones and 
+  // perf_call_overhead the calibration. Must be set before Perfoscope::init.
+  static void compensate_overhead(bool enabled) {
+    s_compensate_overhead = enabled;
+  }
+  
+  static bool compensate_overhead() {
+    return s_compensate_overhead;
+  }
+  
+#ifdef USING_PERFOSCOPE_HWC
+  // Multiplexes the eventset of every Perfoscope, so that it can hold more 
+  // events than the PMU has counters. PAPI switches the counted events 
+  // every time_slice_us microseconds (0 keeps the PAPI default) and scales 
+  // the values to the whole time. Must be set before init.
+  static void multiplex(bool enabled, long long time_slice_us = 0) {
+    s_multiplex = enabled;
+    s_multiplex_time_slice = (time_slice_us < 0 ? 0 : time_slice_us);
+  }
+  
+  static bool multiplex() {
+    return s_multiplex;
+  }
+  
+  static long long multiplex_time_slice() {
+    return s_multiplex_time_slice;
+  }
+  
+  // Splits the events passed to init into groups of group_sizes[i] events, 
+  // an invocation measures one group. init dry-runs every group on an 
+  // eventset and picks the first group that fits after the group of the 
+  // last run of the profile in the db, so that repeated invocations cover 
+  // all events under one profile. Must be set before init.
+  static void event_groups(const int group_sizes[], const int ngroups) {
+    s_event_group_sizes.assign(group_sizes, group_sizes + ngroups);
+  }
+  
+  // Group measured by this invocation, -1 without event groups
+  static int event_group() {
+    return s_event_group;
+  }
+#endif // USING_PERFOSCOPE_HWC
+  
+#ifdef USING_PERFOSCOPE_TRACE
+  // Every Perfoscope writes its records to 
+  // <prefix>.p<proc_id>.t<thread_id>.trace, the prefix defaults to the 
+  // profile name. The ring buffer keeps the last capacity records of a 
+  // thread. Must be set before Perfoscope::init.
+  static void trace_file_prefix(std::string prefix) {
+    s_trace_file_prefix = prefix;
+  }
+  
+  static const std::string & trace_file_prefix() {
+    return s_trace_file_prefix;
+  }
+  
+  static void trace_capacity(long long capacity) {
+    s_trace_capacity = capacity;
+  }
+  
+  static long long trace_capacity() {
+    return s_trace_capacity;
+  }
+#endif // USING_PERFOSCOPE_TRACE
+  
+#ifdef USING_PERFOSCOPE_SAMPLING
+  // Every Perfoscope samples its thread every interval_us microseconds of 
+  // CPU time (0 disables sampling), a sample holds up to frames instruction 
+  // pointers, and a thread keeps up to capacity samples between resets of 
+  // its counter values. Must be set before Perfoscope::init.
+  static void sampling(long long interval_us, long long capacity = 1LL << 14, int frames = 8) {
+    s_sampling_interval = interval_us;
+    s_sampling_capacity = capacity;
+    s_sampling_frames = (frames < 1 ? 1 : frames);
+  }
+  
+  static long long sampling_interval() {
+    return s_sampling_interval;
+  }
+  
+  static long long sampling_capacity() {
+    return s_sampling_capacity;
+  }
+  
+  static int sampling_frames() {
+    return s_sampling_frames;
+  }
+#endif // USING_PERFOSCOPE_SAMPLING
+  
+  // Registers a region name (see PERFOSCOPE_REGION) and returns its dense 
+  // region id, registering a name twice returns the same id. Called during 
+  // static initialization, init adds the regions to the categories and 
+  // aborts if two names have the same hash. The categories are fixed at 
+  // init, so registering a new name after init aborts.
+  static int register_region(const char *name, unsigned long long hash);
+  
+  static int regions_count() {
+    return region_registry().size();
+  }
+  
+  // Category of a registered region, valid after init
+  static int region_category(const int region_id) {
+    PERFOSCOPE_CHECK(region_id < int(s_region_categories.size()), fail_region(region_id));
+    return s_region_categories[region_id];
+  }
+  
+  // Cache line aligned allocation, the per-thread objects are allocated 
+  // with it so that no two threads write to the same cache line
+  static void * allocate_aligned(size_t size) {
+    void *ptr = nullptr;
+    size = ((size + PERFOSCOPE_CACHE_LINE-1)/PERFOSCOPE_CACHE_LINE)*PERFOSCOPE_CACHE_LINE;
+    if(posix_memalign(&ptr, PERFOSCOPE_CACHE_LINE, (size == 0 ? PERFOSCOPE_CACHE_LINE : size)) != 0) {
+      print_error(__FILE__, __LINE__, "%s - could not allocate %zu bytes", __PRETTY_FUNCTION__, size);
+      perfoscope_internal::abort(1);
+    }
+    return ptr;
+  }
+  
   template<typename... Targs>
   static void print_error(const char *file, const int line, 
       const char *format, Targs... args) {
@@ -59,15 +344,114 @@ public:
   
   static int store_sqlite3db(); // main, sync
   
+  static int checkpoint_sqlite3db(); // main
+  
   static int create_perfoscope_data_schema(); // main, sync
   
-  static int insert_perfoscope_data_profile(const PerfoscopeData &data); // main, sync
+  static int prepare_sqlite3_statements(); // main, sync
   
-  static void add_perfoscope_data(const PerfoscopeData &data, long long run_id); // main, sync
+  static int insert_perfoscope_data_profile(const PerfoscopeData &data); // main, sync
 #endif // USING_PERFOSCOPE_DBSTORE
   
 private:
 #ifdef USING_PERFOSCOPE_DBSTORE
+  // One row of perf_value, profile_id and run_id are shared by all rows of a 
+  // bulk insert.
+  struct PerfValueRow {
+    int proc_id;
+    int thread_id;
+    long long category_id;
+    long long event_id;
+    bool is_real;
+    long long int_value;
+    double real_value;
+  };
+  
+  // Where a thread ran when its Perfoscope was initialized
+  struct PerfThreadRow {
+    int proc_id;
+    int thread_id;
+    int cpu;
+    int numa_node;
+  };
+  
+  // Estimated fraction of the time an event was counted in a run, the lowest 
+  // estimate of all threads, 1 if no eventset is multiplexed
+  struct PerfCoverageRow {
+    long long event_id;
+    double estimated_coverage;
+  };
+  
+  // Call statistics of one category of one thread, times in seconds, 
+  // buckets holds (bucket, count) pairs of the non-empty buckets of the 
+  // duration histogram
+  struct PerfCallRow {
+    int proc_id;
+    int thread_id;
+    long long category_id;
+    long long count;
+    double min_time;
+    double max_time;
+    double mean_time;
+    double variance_time;
+    std::vector<long long> buckets;
+  };
+  
+  // Values of one category and event of one thread in the iterations of a 
+  // series that end at iteration, iterations long
+  struct PerfSeriesRow {
+    long long iteration;
+    long long iterations;
+    PerfValueRow value;
+  };
+  
+  // Number of samples of one thread with the same category and stack, the 
+  // stack is folded (outermost frame first, separated by ';') and symbol is 
+  // its innermost frame. category_id is -1 if no region was active.
+  struct PerfSampleRow {
+    int proc_id;
+    int thread_id;
+    long long category_id;
+    std::string symbol;
+    std::string stack;
+    long long count;
+  };
+  
+  // Calibrated cost of one accumulate call of a thread, in counts for an 
+  // event and in seconds for the time
+  struct PerfOverheadRow {
+    int proc_id;
+    int thread_id;
+    long long event_id;
+    double overhead;
+  };
+  
+  // Value of one metric of one category of one thread, metric indexes the 
+  // defined metrics
+  struct PerfMetricRow {
+    int proc_id;
+    int thread_id;
+    long long category_id;
+    int metric;
+    double value;
+  };
+  
+  // One call path of one thread, the values are ordered like the events
+  struct PerfPathRow {
+    int proc_id;
+    int thread_id;
+    int path;
+    int parent;
+    long long category_id;
+    long long count;
+    std::vector<long long> inclusive_values;
+    std::vector<long long> exclusive_values;
+    double inclusive_time;
+    double exclusive_time;
+  };
+  
+  static std::string perf_value_insert_query(int nrows); // main
+  
   static int check_if_perfoscope_data_profile_exists(
     const PerfoscopeData &data, int *exists
   ); // main
@@ -82,11 +466,6 @@ private:
   
   static int create_table_perf_event(); // main
   
-  static int insert_into_perf_event(
-    const char *profile_name, 
-    const char *event_name
-  ); // main
-  
   static int insert_if_not_exists_into_perf_event(
     const char *profile_name, 
     const char *event_name
@@ -94,46 +473,197 @@ private:
   
   static int create_table_perf_run(); // main
   
+  static int create_table_perf_run_event_group(); // main
+  
+  static int insert_into_perf_run_event_group(long long run_id, int event_group); // main
+  
+  static int select_last_event_group(const char *profile_name, int *event_group); // main
+  
+  static int create_table_perf_machine(); // main
+  
+  static int select_perf_machine(
+    const char *host, 
+    const char *build, 
+    MachinePeaks &peaks, 
+    long long *machine_id
+  ); // main
+  
+  static int insert_into_perf_machine(const MachinePeaks &peaks, long long *machine_id); // main
+  
+  static int create_table_perf_run_machine(); // main
+  
+  static int insert_into_perf_run_machine(long long run_id, long long machine_id); // main
+  
+  static std::vector<std::string> profile_event_names(const PerfoscopeData &data); // main
+  
   static int create_new_run(
-    const char *profile_name, 
+    const long long profile_id, 
     const long long problem_size, 
     long long *run_id
   ); // main
   
   static int create_table_perf_value(); // main
   
+  static int begin_transaction(); // main
+  
+  static int end_transaction(int sqlrc); // main
+  
+  static int select_perfoscope_data_ids(
+    const PerfoscopeData &data, 
+    long long *profile_id, 
+    std::vector<long long> &category_ids, 
+    std::vector<long long> &event_ids
+  ); // main
+  
   static int insert_into_perf_value(
-    int proc_id, 
-    int thread_id, 
-    const char *profile_name, 
-    const char *category_name, 
-    const char *event_name, 
+    long long profile_id, 
     long long run_id, 
-    long long value
+    const std::vector<PerfValueRow> &rows
   ); // main
   
   static int insert_into_perf_value(
+    sqlite3_stmt *stmt, 
+    long long profile_id, 
+    long long run_id, 
+    const PerfValueRow *rows, 
+    int nrows
+  ); // main
+  
+  static void pack_perfoscope_data(
+    const PerfoscopeData* perfoscope_data_list[], 
+    const int count, 
+    std::vector<char> &buffer
+  ); // main
+  
+  static void gather_perfoscope_data(
+    std::vector<char> &buffer, 
+    std::vector<size_t> &offsets
+  ); // main, sync
+  
+  static int unpack_perfoscope_data(
+    const char *buffer, 
+    std::vector<PerfValueRow> &rows, 
+    std::vector<PerfPathRow> &paths, 
+    std::vector<PerfThreadRow> &threads, 
+    std::vector<PerfSampleRow> &samples, 
+    std::vector<PerfCallRow> &calls, 
+    std::vector<PerfSeriesRow> &series, 
+    std::vector<PerfCoverageRow> &coverage, 
+    std::vector<PerfMetricRow> &metrics, 
+    std::vector<PerfOverheadRow> &overheads, 
+    std::vector<PerfValueRow> &compensated
+  ); // main
+  
+  static void count_samples(
+    const PerfoscopeData &data, 
+    std::vector<PerfSampleRow> &samples
+  );
+  
+  static long long count_call_buckets(const PerfoscopeData &data, int ci);
+  
+  static void append_perf_value_rows(
     int proc_id, 
     int thread_id, 
-    const char *profile_name, 
-    const char *category_name, 
-    const char *event_name, 
-    long long run_id, 
-    double value
+    int ncategories, 
+    int nevents, 
+    const long long *values, 
+    double seconds_per_tick, 
+    std::vector<PerfValueRow> &rows
   ); // main
   
-  static int insert_perfoscope_data(
+  // values holds a row of nevents+1 reported values per category, the 
+  // counter values and the real time in seconds
+  static void append_perf_metric_rows(
     int proc_id, 
-    const PerfoscopeData &data, 
+    int thread_id, 
+    int ncategories, 
+    int nevents, 
+    const double *values, 
+    std::vector<PerfMetricRow> &metrics
+  ); // main
+  
+  static int create_table_perf_metric_name(); // main
+  
+  static int insert_perf_metric_names(); // main, sync
+  
+  static int create_table_perf_metric(); // main
+  
+  static int create_table_perf_call_overhead(); // main
+  
+  static int insert_into_perf_call_overhead(
     long long run_id, 
-    const long long *counter_values, 
-    const double *real_time
+    const std::vector<PerfOverheadRow> &overheads
   ); // main
   
-  static void extract_perfoscope_data_to_arrays(
-    const PerfoscopeData &data, 
-    long long *counter_values, 
-    double *real_time
+  static int create_table_perf_compensated_value(); // main
+  
+  static int insert_into_perf_compensated_value(
+    long long run_id, 
+    const std::vector<PerfValueRow> &compensated
+  ); // main
+  
+  static int insert_into_perf_metric(
+    long long run_id, 
+    const std::vector<PerfMetricRow> &metrics
+  ); // main
+  
+  static int create_table_perf_thread(); // main
+  
+  static int create_table_perf_sample(); // main
+  
+  static int create_table_perf_call(); // main
+  
+  static int create_table_perf_call_bucket(); // main
+  
+  static int create_table_perf_series(); // main
+  
+  static int insert_into_perf_series(
+    long long run_id, 
+    const std::vector<PerfSeriesRow> &series
+  ); // main
+  
+  static int insert_into_perf_call(
+    long long run_id, 
+    const std::vector<PerfCallRow> &calls
+  ); // main
+  
+  static int insert_into_perf_sample(
+    long long run_id, 
+    const std::vector<PerfSampleRow> &samples
+  ); // main
+  
+  static int insert_into_perf_thread(
+    long long run_id, 
+    const std::vector<PerfThreadRow> &threads
+  ); // main
+  
+  static int create_table_perf_run_event_coverage(); // main
+  
+  static int insert_into_perf_run_event_coverage(
+    long long run_id, 
+    const std::vector<PerfCoverageRow> &coverage
+  ); // main
+  
+  static int create_table_perf_path(); // main
+  
+  static int create_table_perf_path_value(); // main
+  
+  static int insert_into_perf_path(
+    long long run_id, 
+    const std::vector<PerfPathRow> &paths
+  ); // main
+  
+  static int create_table_perf_summary(); // main
+  
+  static long long summarize_perfoscope_data(
+    const PerfoscopeData* perfoscope_data_list[], 
+    const int count, 
+    std::vector<double> &summary
+  ); // main, sync
+  
+  static int insert_into_perf_summary(
+    long long run_id, 
+    const std::vector<double> &summary
   ); // main
 #endif // USING_PERFOSCOPE_DBSTORE
   
@@ -146,85 +676,234 @@ private:
   static const char * get_dbvfs() {
     return (s_dbvfs.length() == 0 ? nullptr : s_dbvfs.c_str());
   }
+  
+  // Rank and size within the group of processes sharing a db
+  static int db_proc_id() {
+#ifdef USING_MPIC
+    int ip;
+    MPI_Comm_rank(s_db_comm, &ip);
+    return ip;
+#else // USING_MPIC
+    return 0;
+#endif // USING_MPIC
+  }
+  
+  static int db_nproc() {
+#ifdef USING_MPIC
+    int np;
+    MPI_Comm_size(s_db_comm, &np);
+    return np;
+#else // USING_MPIC
+    return 1;
+#endif // USING_MPIC
+  }
 #endif
   
+private:
+  struct RegionName {
+    std::string name;
+    unsigned long long hash;
+  };
+  
+  // Function local so that regions can be registered by static initializers 
+  // of other translation units
+  static std::vector<RegionName> & region_registry() {
+    static std::vector<RegionName> registry;
+    return registry;
+  }
+  
+  static void add_region_categories(const char *file, const int line); // main, sync
+  
+  struct Metric {
+    std::string name;
+    MetricFormula formula;
+  };
+  
+  // Defined metrics, starts with the default metrics
+  static std::vector<Metric> & metric_registry();
+  
+  static void select_machine_peaks(const char *file, const int line); // main, sync
+  
+  static void select_node_machine_peaks(const char *file, const int line); // main, sync
+  
+  static void measure_machine_peaks(); // main
+  
+  static void store_machine_peaks(const char *file, const int line); // main
+  
+  PERFOSCOPE_COLD static void fail_region(const int region_id);
+  
+  struct RooflineEstimate {
+    std::string category;
+    double flop;
+    double bytes;
+  };
+  
+#ifdef USING_PERFOSCOPE_HWC
+  static void add_event_groups(const char *events[], const int nevents, 
+    const char *file, const int line); // main, sync
+  
+  static void select_event_group(const char *file, const int line); // main, sync
+#endif // USING_PERFOSCOPE_HWC
+  
 private:
   static bool s_initialized;
   static bool s_modified;
   static int s_owner_proc_id;
+  static RunDataMode s_run_data_mode;
+  static bool s_verbose;
+  static PersistenceMode s_persistence_mode;
+  static int s_checkpoint_interval;
+  static StorageMode s_storage_mode;
+  static long long s_series_capacity;
   static PerfoscopeData s_template;
+  static std::vector<int> s_region_categories;
+  static bool s_roofline;
+  static MachinePeaks s_machine_peaks;
+  static std::vector<RooflineEstimate> s_roofline_estimates;
+  static bool s_compensate_overhead;
+#ifdef USING_PERFOSCOPE_HWC
+  static bool s_multiplex;
+  static long long s_multiplex_time_slice;
+  static std::vector<int> s_event_group_sizes;
+  static std::vector<std::vector<std::string> > s_event_groups;
+  static std::vector<int> s_event_group_fits;
+  static int s_event_group;
+#endif // USING_PERFOSCOPE_HWC
+#ifdef USING_PERFOSCOPE_TRACE
+  static std::string s_trace_file_prefix;
+  static long long s_trace_capacity;
+#endif // USING_PERFOSCOPE_TRACE
+#ifdef USING_PERFOSCOPE_SAMPLING
+  static long long s_sampling_interval;
+  static long long s_sampling_capacity;
+  static int s_sampling_frames;
+#endif // USING_PERFOSCOPE_SAMPLING
 #ifdef USING_PERFOSCOPE_DBSTORE
   static std::string s_dbfilename;
   static std::string s_dbvfs;
+#ifdef USING_MPIC
+  static MPI_Comm s_db_comm;
+#endif // USING_MPIC
   static sqlite3 *s_sqldb;
   static bool s_forkeyon;
   static const char *s_create_new_run_query;
   static sqlite3_stmt *s_create_new_run_stmt;
   static const char *s_insert_value_query;
   static sqlite3_stmt *s_insert_value_stmt;
+  static const int s_insert_values_batch = 128;
+  static int s_runs_since_checkpoint;
+  static std::string s_insert_values_query;
+  static sqlite3_stmt *s_insert_values_stmt;
+  static long long s_profile_id;
+  static std::vector<long long> s_category_ids;
+  static std::vector<long long> s_event_ids;
+  static std::vector<BoundMetric> s_bound_metrics;
+  static std::vector<long long> s_metric_name_ids;
+  static long long s_machine_id;
 #endif // #ifdef USING_PERFOSCOPE_DBSTORE
 };
 
 /**---------------------------------------------------------------------------*/
 
-class PerfoscopeData {
+// Aligned and padded to cache lines, a thread should clone its own 
+// PerfoscopeData so that the values are first touched by that thread.
+class alignas(PERFOSCOPE_CACHE_LINE) PerfoscopeData {
   friend class Perfoscope;
   friend class PerfoscopeUtil;
   
 private:
-  struct CategoryData {
-    CategoryData()
+  // Node of the call-path tree of the regions of a thread, the inclusive 
+  // values of a path include its children, the exclusive values do not.
+  struct PathData {
+    PathData(int parent, int category, int nevents) : 
+      parent(parent), 
+      category(category), 
+      count(0)
 #ifdef USING_PERFOSCOPE_WCT
-      : real_time(0)
+      , inclusive_time(0)
+      , exclusive_time(0)
 #endif // USING_PERFOSCOPE_WCT
-    {}
-    
-    CategoryData(std::string name) : name(name)
-#ifdef USING_PERFOSCOPE_WCT
-      , real_time(0)
-#endif // USING_PERFOSCOPE_WCT
-    {}
-    
-    CategoryData(const CategoryData &rhs) : name(rhs.name)
 #ifdef USING_PERFOSCOPE_HWC
-      , counter_values(rhs.counter_values)
-#endif // #ifdef USING_PERFOSCOPE_HWC
-#ifdef USING_PERFOSCOPE_WCT
-      , real_time(rhs.real_time)
-#endif // #ifdef USING_PERFOSCOPE_WCT
+      , inclusive_values(nevents, 0)
+      , exclusive_values(nevents, 0)
+#endif // USING_PERFOSCOPE_HWC
     {}
     
-    CategoryData & operator=(const CategoryData &rhs) {
-      name = rhs.name;
-      
-#ifdef USING_PERFOSCOPE_HWC
-      counter_values = rhs.counter_values;
-#endif // USING_PERFOSCOPE_HWC
-      
-#ifdef USING_PERFOSCOPE_WCT
-      real_time = rhs.real_time;
-#endif // USING_PERFOSCOPE_WCT
-      
-      return *this;
-    }
+    int parent;
+    int category;
+    long long count;
     
 #ifdef USING_PERFOSCOPE_WCT
-    double real_time;
+    long long inclusive_time; // ticks
+    long long exclusive_time; // ticks
 #endif // USING_PERFOSCOPE_WCT
     
 #ifdef USING_PERFOSCOPE_HWC
-    std::vector<long long> counter_values;
+    std::vector<long long> inclusive_values;
+    std::vector<long long> exclusive_values;
 #endif // USING_PERFOSCOPE_HWC
     
-    std::string name;
+    std::vector<int> children;
   };
   
 public:
-  PerfoscopeData() : m_thread_id(-1) {}
+  // Statistics of the calls of a category, a call is an accumulate/stop of 
+  // the category or the end of one of its regions. flat_count counts only 
+  // the accumulate/stop calls, whose cost is in the values of the category. Durations are in 
+  // nanoseconds. The variance is kept as sums of the deviations from the 
+  // first duration (shift_time), which is as stable as Welford's update 
+  // without its division. histogram holds the counts of the buckets of 
+  // perfoscope_internal::duration_histogram_bucket.
+  struct alignas(PERFOSCOPE_CACHE_LINE) CallStats {
+    long long count;
+    long long flat_count;
+#ifdef USING_PERFOSCOPE_WCT
+    long long min_time;
+    long long max_time;
+    long long shift_time;
+    double sum_time;
+    double sumsq_time;
+    long long histogram[perfoscope_internal::duration_histogram_size];
+#endif // USING_PERFOSCOPE_WCT
+  };
   
-  ~PerfoscopeData() {}
+  PerfoscopeData() : 
+    m_values(nullptr), 
+    m_call_stats(nullptr), 
+    m_values_stride(1), 
+    m_series(nullptr), 
+    m_series_iterations(nullptr), 
+    m_series_capacity(0), 
+    m_series_count(0), 
+    m_series_interval(1), 
+    m_iteration(0), 
+    m_thread_id(-1), 
+    m_cpu(-1), 
+    m_numa_node(-1) 
+#ifdef USING_PERFOSCOPE_SAMPLING
+    , m_samples(nullptr)
+#endif // USING_PERFOSCOPE_SAMPLING
+  {}
+  
+  ~PerfoscopeData() {
+    free(m_values);
+    free(m_call_stats);
+    free(m_series);
+    free(m_series_iterations);
+#ifdef USING_PERFOSCOPE_SAMPLING
+    delete m_samples;
+#endif // USING_PERFOSCOPE_SAMPLING
+  }
   
-  std::string profile_name() const {
+  static void * operator new(size_t size) {
+    return PerfoscopeUtil::allocate_aligned(size);
+  }
+  
+  static void operator delete(void *ptr) {
+    free(ptr);
+  }
+  
+  const std::string & profile_name() const {
     return m_profile_name;
   }
   
@@ -232,60 +911,243 @@ public:
     return m_thread_id;
   }
   
+  // CPU and NUMA node of the thread at Perfoscope::init, -1 if unknown
+  int cpu() const {
+    return m_cpu;
+  }
+  
+  int numa_node() const {
+    return m_numa_node;
+  }
+  
+#ifdef USING_PERFOSCOPE_SAMPLING
+  // Samples taken by the Perfoscope of the thread, nullptr if it does not 
+  // sample
+  const SampleBuffer * samples() const {
+    return m_samples;
+  }
+#endif // USING_PERFOSCOPE_SAMPLING
+  
   int categories_count() const {
-    return m_category_data.size();
+    return m_category_names.size();
   }
   
-  std::string category_name(const int ci) const {
-    return m_category_data[ci].name;
+  const std::string & category_name(const int ci) const {
+    return m_category_names[ci];
   }
   
   const long long * category_values(const int ci) const {
-#ifdef USING_PERFOSCOPE_HWC
-    return &m_category_data[ci].counter_values[0];
-#else // USING_PERFOSCOPE_HWC
-    return nullptr;
-#endif // USING_PERFOSCOPE_HWC
+    return m_values + ci*m_values_stride;
   }
   
   double category_real_time(const int ci) const {
 #ifdef USING_PERFOSCOPE_WCT
-    return m_category_data[ci].real_time;
+    return perfoscope_internal::ticks_to_seconds(m_values[ci*m_values_stride + m_values_stride-1]);
+#else // USING_PERFOSCOPE_WCT
+    return 0.0;
+#endif // USING_PERFOSCOPE_WCT
+  }
+  
+  // The values of all categories, one row of values_stride() values per 
+  // category, the counter values of the events followed by the real time 
+  // in ticks.
+  const long long * values() const {
+    return m_values;
+  }
+  
+  int values_stride() const {
+    return m_values_stride;
+  }
+  
+  // Snapshots of the values of all categories, series_values(si) is laid out 
+  // like values() and was taken at the end of iteration series_iteration(si)
+  long long series_count() const {
+    return m_series_count;
+  }
+  
+  long long series_iteration(const long long si) const {
+    return m_series_iterations[si];
+  }
+  
+  const long long * series_values(const long long si) const {
+    return m_series + si*m_category_names.size()*m_values_stride;
+  }
+  
+  // Ends an iteration and snapshots the values if the iteration is recorded, 
+  // the thread of the PerfoscopeData must not be in a region of a category.
+  void mark_iteration() {
+    ++m_iteration;
+    if(m_series_capacity == 0 || m_iteration % m_series_interval != 0) {
+      return;
+    }
+    if(m_series_count == m_series_capacity) {
+      decimate_series();
+      if(m_iteration % m_series_interval != 0) {
+        return;
+      }
+    }
+    const size_t size = m_category_names.size()*m_values_stride;
+    std::memcpy(m_series + m_series_count*size, m_values, size*sizeof(long long));
+    m_series_iterations[m_series_count] = m_iteration;
+    ++m_series_count;
+  }
+  
+  const CallStats & call_stats(const int ci) const {
+    return m_call_stats[ci];
+  }
+  
+  // Calibrated cost of one accumulate call in the unit of value vi, the real 
+  // time in ticks, 0 without overhead compensation
+  double call_overhead(const int vi) const {
+    return m_call_overhead[vi];
+  }
+  
+  // Value vi of category ci less the cost of the accumulate/stop calls of 
+  // the category
+  double compensated_value(const int ci, const int vi) const {
+    const double value = double(m_values[ci*m_values_stride + vi]) - m_call_overhead[vi]*m_call_stats[ci].flat_count;
+    return (value > 0.0 ? value : 0.0);
+  }
+  
+  double compensated_real_time(const int ci) const {
+#ifdef USING_PERFOSCOPE_WCT
+    return perfoscope_internal::ticks_to_seconds(1)*compensated_value(ci, m_values_stride-1);
+#else // USING_PERFOSCOPE_WCT
+    return 0.0;
+#endif // USING_PERFOSCOPE_WCT
+  }
+  
+  // Mean, variance and quantile q of the call durations of a category in 
+  // seconds
+  double call_time_mean(const int ci) const {
+#ifdef USING_PERFOSCOPE_WCT
+    const CallStats &stats = m_call_stats[ci];
+    return (stats.count > 0 ? 1e-9*(double(stats.shift_time) + stats.sum_time/double(stats.count)) : 0.0);
+#else // USING_PERFOSCOPE_WCT
+    return 0.0;
+#endif // USING_PERFOSCOPE_WCT
+  }
+  
+  double call_time_variance(const int ci) const {
+#ifdef USING_PERFOSCOPE_WCT
+    const CallStats &stats = m_call_stats[ci];
+    if(stats.count < 2) {
+      return 0.0;
+    }
+    const double m2 = stats.sumsq_time - stats.sum_time*stats.sum_time/double(stats.count);
+    return (m2 > 0.0 ? 1e-18*m2/double(stats.count-1) : 0.0);
+#else // USING_PERFOSCOPE_WCT
+    return 0.0;
+#endif // USING_PERFOSCOPE_WCT
+  }
+  
+  double call_time_quantile(const int ci, const double q) const {
+#ifdef USING_PERFOSCOPE_WCT
+    const CallStats &stats = m_call_stats[ci];
+    return 1e-9*perfoscope_internal::duration_histogram_quantile(stats.histogram, stats.count, 
+      double(stats.min_time), double(stats.max_time), q);
 #else // USING_PERFOSCOPE_WCT
     return 0.0;
 #endif // USING_PERFOSCOPE_WCT
   }
   
   void reset_counter_values() {
-    int ncategories = m_category_data.size();
-    for(int i = 0; i < ncategories; ++i) {
+    std::memset(m_values, 0, m_category_names.size()*m_values_stride*sizeof(long long));
+    std::memset(m_call_stats, 0, m_category_names.size()*sizeof(CallStats));
+    m_series_count = 0;
+    m_series_interval = 1;
+    m_iteration = 0;
+#ifdef USING_PERFOSCOPE_SAMPLING
+    if(m_samples != nullptr) {
+      m_samples->clear();
+    }
+#endif // USING_PERFOSCOPE_SAMPLING
+    
+    int npaths = m_path_data.size();
+    for(int pi = 0; pi < npaths; ++pi) {
+      PathData &path = m_path_data[pi];
+      path.count = 0;
+#ifdef USING_PERFOSCOPE_WCT
+      path.inclusive_time = 0;
+      path.exclusive_time = 0;
+#endif // USING_PERFOSCOPE_WCT
 #ifdef USING_PERFOSCOPE_HWC
-      std::vector<long long> &counter_values = m_category_data[i].counter_values;
-      int ncounter_values = counter_values.size();
-      for(int j = 0; j < ncounter_values; ++j) {
-        counter_values[j] = 0;
+      for(size_t ei = 0; ei < path.inclusive_values.size(); ++ei) {
+        path.inclusive_values[ei] = 0;
+        path.exclusive_values[ei] = 0;
       }
-#endif // #ifdef USING_PERFOSCOPE_HWC
-      m_category_data[i].real_time = 0.0;
+#endif // USING_PERFOSCOPE_HWC
     }
   }
   
   void reset_counter_values(const int ci) {
+    std::memset(m_values + ci*m_values_stride, 0, m_values_stride*sizeof(long long));
+    std::memset(m_call_stats + ci, 0, sizeof(CallStats));
+  }
+  
+  int events_count() const {
 #ifdef USING_PERFOSCOPE_HWC
-    std::vector<long long> &counter_values = m_category_data[ci].counter_values;
-    int ncounter_values = counter_values.size();
-    for(int j = 0; j < ncounter_values; ++j) {
-      counter_values[j] = 0;
-    }
-#endif // #ifdef USING_PERFOSCOPE_HWC
-    m_category_data[ci].real_time = 0.0;
+    return m_event_codes.size();
+#else // USING_PERFOSCOPE_HWC
+    return 0;
+#endif // USING_PERFOSCOPE_HWC
+  }
+  
+  int paths_count() const {
+    return m_path_data.size();
+  }
+  
+  int path_parent(const int pi) const {
+    return m_path_data[pi].parent;
+  }
+  
+  int path_category(const int pi) const {
+    return m_path_data[pi].category;
+  }
+  
+  long long path_count(const int pi) const {
+    return m_path_data[pi].count;
+  }
+  
+  double path_inclusive_time(const int pi) const {
+#ifdef USING_PERFOSCOPE_WCT
+    return perfoscope_internal::ticks_to_seconds(m_path_data[pi].inclusive_time);
+#else // USING_PERFOSCOPE_WCT
+    return 0.0;
+#endif // USING_PERFOSCOPE_WCT
+  }
+  
+  double path_exclusive_time(const int pi) const {
+#ifdef USING_PERFOSCOPE_WCT
+    return perfoscope_internal::ticks_to_seconds(m_path_data[pi].exclusive_time);
+#else // USING_PERFOSCOPE_WCT
+    return 0.0;
+#endif // USING_PERFOSCOPE_WCT
+  }
+  
+  const long long * path_inclusive_values(const int pi) const {
+#ifdef USING_PERFOSCOPE_HWC
+    return m_path_data[pi].inclusive_values.data();
+#else // USING_PERFOSCOPE_HWC
+    return nullptr;
+#endif // USING_PERFOSCOPE_HWC
+  }
+  
+  const long long * path_exclusive_values(const int pi) const {
+#ifdef USING_PERFOSCOPE_HWC
+    return m_path_data[pi].exclusive_values.data();
+#else // USING_PERFOSCOPE_HWC
+    return nullptr;
+#endif // USING_PERFOSCOPE_HWC
   }
   
-  int events_count() const {
+  // Estimated fraction of the time event ei was counted, set by 
+  // Perfoscope::init
+  double event_coverage(const int ei) const {
 #ifdef USING_PERFOSCOPE_HWC
-    return m_event_codes.size();
+    return m_event_coverage[ei];
 #else // USING_PERFOSCOPE_HWC
-    return 0;
+    return 1.0;
 #endif // USING_PERFOSCOPE_HWC
   }
   
@@ -309,25 +1171,12 @@ public:
     
     pobj->m_profile_name = m_profile_name;
     pobj->m_thread_id = thread_id;
-    
-    int ncategories = m_category_data.size();
-    pobj->m_category_data.resize(ncategories);
-    for(int ci = 0; ci < ncategories; ++ci) {
-      pobj->m_category_data[ci].name = m_category_data[ci].name;
-#ifdef USING_PERFOSCOPE_HWC
-      int nevents = m_event_codes.size();
-      pobj->m_event_codes = m_event_codes;
-      
-      std::vector<long long> &values = pobj->m_category_data[ci].counter_values;
-      values.resize(nevents);
-      for(int ei = 0; ei < nevents; ++ei) {
-        values[ei] = 0;
-      }
+    pobj->m_category_names = m_category_names;
+#ifdef USING_PERFOSCOPE_HWC
+    pobj->m_event_codes = m_event_codes;
 #endif // #ifdef USING_PERFOSCOPE_HWC
-#ifdef USING_PERFOSCOPE_WCT
-      pobj->m_category_data[ci].real_time = 0.0;
-#endif // #ifdef USING_PERFOSCOPE_WCT
-    }
+    pobj->allocate_values();
+    pobj->allocate_series(PerfoscopeUtil::series_capacity());
     
     return pobj;
   }
@@ -345,13 +1194,15 @@ private:
   }
   
   int add_category(std::string name) {
-    int index = m_category_data.size();
-    m_category_data.push_back(CategoryData(name));
+    int index = m_category_names.size();
+    m_category_names.push_back(name);
+    allocate_values();
     return index;
   }
   
   void clear_categories() {
-    m_category_data.clear();
+    m_category_names.clear();
+    allocate_values();
   }
   
   void add_event(std::string event_name, const char *file = "\0", const int line = 0) {
@@ -365,36 +1216,155 @@ private:
       perfoscope_internal::abort(errcode);
     }
     m_event_codes.push_back(eventcode);
+    allocate_values();
 #endif // USING_PERFOSCOPE_HWC
   }
   
   void clear_events() {
 #ifdef USING_PERFOSCOPE_HWC
     m_event_codes.clear();
+    allocate_values();
 #endif // #ifdef USING_PERFOSCOPE_HWC
   }
+  
+  // Allocates the zeroed values and call statistics of all categories, each 
+  // as one block aligned to a cache line
+  void allocate_values() {
+    free(m_values);
+    free(m_call_stats);
+    m_values_stride = events_count()+1;
+    const size_t size = m_category_names.size()*m_values_stride*sizeof(long long);
+    m_values = static_cast<long long*>(PerfoscopeUtil::allocate_aligned(size));
+    std::memset(m_values, 0, size);
+    const size_t stats_size = m_category_names.size()*sizeof(CallStats);
+    m_call_stats = static_cast<CallStats*>(PerfoscopeUtil::allocate_aligned(stats_size));
+    std::memset(m_call_stats, 0, stats_size);
+    m_call_overhead.assign(m_values_stride, 0.0);
+#ifdef USING_PERFOSCOPE_HWC
+    m_event_coverage.assign(m_event_codes.size(), 1.0);
+#endif // USING_PERFOSCOPE_HWC
+  }
+  
+  void allocate_series(const long long capacity) {
+    free(m_series);
+    free(m_series_iterations);
+    m_series = nullptr;
+    m_series_iterations = nullptr;
+    m_series_capacity = capacity;
+    m_series_count = 0;
+    m_series_interval = 1;
+    if(capacity > 0) {
+      m_series = static_cast<long long*>(PerfoscopeUtil::allocate_aligned(
+        capacity*m_category_names.size()*m_values_stride*sizeof(long long)));
+      m_series_iterations = static_cast<long long*>(PerfoscopeUtil::allocate_aligned(
+        capacity*sizeof(long long)));
+    }
+  }
+  
+  // Keeps the snapshots of every second recorded iteration, which are the 
+  // multiples of the doubled interval
+  void decimate_series() {
+    const size_t size = m_category_names.size()*m_values_stride;
+    const long long count = m_series_count/2;
+    for(long long si = 0; si < count; ++si) {
+      std::memcpy(m_series + si*size, m_series + (2*si+1)*size, size*sizeof(long long));
+      m_series_iterations[si] = m_series_iterations[2*si+1];
+    }
+    m_series_count = count;
+    m_series_interval *= 2;
+  }
+  
+  long long * category_row(const int ci) {
+    return m_values + ci*m_values_stride;
+  }
+  
+  void record_call(const int ci, const long long ticks) {
+    CallStats &stats = m_call_stats[ci];
+    stats.count += 1;
+#ifdef USING_PERFOSCOPE_WCT
+    const long long duration = perfoscope_internal::ticks_to_nanoseconds(ticks);
+    if(PERFOSCOPE_UNLIKELY(stats.count == 1)) {
+      stats.min_time = duration;
+      stats.shift_time = duration;
+    }
+    if(duration < stats.min_time) {
+      stats.min_time = duration;
+    }
+    if(duration > stats.max_time) {
+      stats.max_time = duration;
+    }
+    const double deviation = double(duration - stats.shift_time);
+    stats.sum_time += deviation;
+    stats.sumsq_time += deviation*deviation;
+    stats.histogram[perfoscope_internal::duration_histogram_bucket(duration)] += 1;
+#endif // USING_PERFOSCOPE_WCT
+  }
+  
+  // A call that adds to the values of the category
+  void record_flat_call(const int ci, const long long ticks) {
+    m_call_stats[ci].flat_count += 1;
+    record_call(ci, ticks);
+  }
+  
+  int find_or_add_path(int parent, int ci) {
+    const std::vector<int> &children = (parent < 0 ? m_root_paths : m_path_data[parent].children);
+    const int nchildren = children.size();
+    for(int i = 0; i < nchildren; ++i) {
+      if(m_path_data[children[i]].category == ci) {
+        return children[i];
+      }
+    }
+    
+    int index = m_path_data.size();
+    m_path_data.push_back(PathData(parent, ci, events_count()));
+    (parent < 0 ? m_root_paths : m_path_data[parent].children).push_back(index);
+    return index;
+  }
 
 private:
-  std::vector<CategoryData> m_category_data;
+  long long *m_values;
+  CallStats *m_call_stats;
+  int m_values_stride;
+  long long *m_series;
+  long long *m_series_iterations;
+  long long m_series_capacity;
+  long long m_series_count;
+  long long m_series_interval;
+  long long m_iteration;
+  std::vector<std::string> m_category_names;
+  std::vector<PathData> m_path_data;
+  std::vector<int> m_root_paths;
+  std::vector<double> m_call_overhead;
   std::string m_profile_name;
   int m_thread_id;
+  int m_cpu;
+  int m_numa_node;
+#ifdef USING_PERFOSCOPE_SAMPLING
+  SampleBuffer *m_samples;
+#endif // USING_PERFOSCOPE_SAMPLING
 #ifdef USING_PERFOSCOPE_HWC
   std::vector<int> m_event_codes;
+  std::vector<double> m_event_coverage;
 #endif // USING_PERFOSCOPE_HWC
 };
 
 /**---------------------------------------------------------------------------*/
 
-class Perfoscope {
+// Aligned and padded to cache lines like PerfoscopeData
+class alignas(PERFOSCOPE_CACHE_LINE) Perfoscope {
 public:
   Perfoscope(PerfoscopeData *data) : 
     m_data(data)
 #ifdef USING_PERFOSCOPE_WCT
-    , m_real_time({0,0})
+    , m_real_time()
 #endif // USING_PERFOSCOPE_WCT
 #ifdef USING_PERFOSCOPE_HWC
     , m_eventset(PAPI_NULL)
 #endif // USING_PERFOSCOPE_HWC
+#ifdef USING_PERFOSCOPE_TRACE
+    , m_trace(nullptr)
+#endif // USING_PERFOSCOPE_TRACE
+    , m_region_depth(0)
   {}
   
   Perfoscope(const Perfoscope &rhs) : 
@@ -404,12 +1374,34 @@ public:
 #endif // USING_PERFOSCOPE_WCT
 #ifdef USING_PERFOSCOPE_HWC
     , m_eventset(rhs.m_eventset)
+#endif // USING_PERFOSCOPE_HWC
+#ifdef USING_PERFOSCOPE_TRACE
+    , m_trace(nullptr)
+    , m_trace_deltas(rhs.m_trace_deltas)
+#endif // USING_PERFOSCOPE_TRACE
+    , m_regions(rhs.m_regions)
+    , m_region_depth(rhs.m_region_depth)
+#ifdef USING_PERFOSCOPE_HWC
+    , m_region_offset(rhs.m_region_offset)
+    , m_region_values(rhs.m_region_values)
+    , m_stop_values(rhs.m_stop_values)
 #endif // USING_PERFOSCOPE_HWC
   {}
   
   ~Perfoscope() {}
   
+  static void * operator new(size_t size) {
+    return PerfoscopeUtil::allocate_aligned(size);
+  }
+  
+  static void operator delete(void *ptr) {
+    free(ptr);
+  }
+  
   Perfoscope & operator=(const Perfoscope &rhs) {
+    if(this == &rhs) {
+      return *this;
+    }
     m_data = rhs.m_data;
     
 #ifdef USING_PERFOSCOPE_WCT
@@ -420,11 +1412,30 @@ public:
     m_eventset = rhs.m_eventset;
 #endif // USING_PERFOSCOPE_HWC
     
+#ifdef USING_PERFOSCOPE_TRACE
+    // The trace file belongs to the Perfoscope that opened it in init, the 
+    // one opened by this Perfoscope is closed
+    delete m_trace;
+    m_trace = nullptr;
+    m_trace_deltas = rhs.m_trace_deltas;
+#endif // USING_PERFOSCOPE_TRACE
+    
+    m_regions = rhs.m_regions;
+    m_region_depth = rhs.m_region_depth;
+#ifdef USING_PERFOSCOPE_HWC
+    m_region_offset = rhs.m_region_offset;
+    m_region_values = rhs.m_region_values;
+    m_stop_values = rhs.m_stop_values;
+#endif // USING_PERFOSCOPE_HWC
+    
     return *this;
   }
   
   void init(const char *file = "\0", const int line = 0);
   
+  // accumulate, stop, begin and end are defined inline below, they do not 
+  // allocate and their error paths are out of line
+  
   void start(const char *file = "\0", const int line = 0);
   
   void reset(const char *file = "\0", const int line = 0);
@@ -437,6 +1448,50 @@ public:
   
   void destroy(const char *file = "\0", const int line = 0);
   
+  // Nested regions, begin pushes region ci on the region stack of the thread 
+  // and end pops it, the time and counters are charged to the call path of 
+  // the region. Regions read the counters started by start and may be mixed 
+  // with accumulate/stop of the flat categories.
+  void begin(const int ci, const char *file = "\0", const int line = 0);
+  
+  void end(const char *file = "\0", const int line = 0);
+  
+private:
+  // Calibrates the call overhead of the PerfoscopeData
+  void calibrate(const char *file, const int line);
+  
+  PERFOSCOPE_COLD static void fail(const char *function, const char *what, int errcode, 
+    const char *file, const int line);
+  
+#ifdef USING_PERFOSCOPE_HWC
+  PERFOSCOPE_COLD static void fail_papi(const char *function, const char *what, int errcode, 
+    const char *file, const int line);
+#endif // USING_PERFOSCOPE_HWC
+  
+  struct RegionFrame {
+    int path;
+#ifdef USING_PERFOSCOPE_WCT
+    perfoscope_internal::real_time_t start_time;
+    long long children_time;
+#endif // USING_PERFOSCOPE_WCT
+#ifdef USING_PERFOSCOPE_HWC
+    std::vector<long long> start_values;
+    std::vector<long long> children_values;
+#endif // USING_PERFOSCOPE_HWC
+  };
+  
+#ifdef USING_PERFOSCOPE_HWC
+  void read_region_counters(long long *values, const char *file, const int line);
+  
+  void save_region_counters(const char *file, const int line);
+#endif // USING_PERFOSCOPE_HWC
+  
+#ifdef USING_PERFOSCOPE_TRACE
+  void trace_snapshot(const int ci);
+  
+  void trace_append(const int ci, const perfoscope_internal::real_time_t &start);
+#endif // USING_PERFOSCOPE_TRACE
+  
 private:
   PerfoscopeData *m_data;
   
@@ -447,8 +1502,352 @@ private:
 #ifdef USING_PERFOSCOPE_WCT
   perfoscope_internal::real_time_t m_real_time;
 #endif // USING_PERFOSCOPE_WCT
+  
+#ifdef USING_PERFOSCOPE_TRACE
+  TraceBuffer *m_trace;
+  std::vector<long long> m_trace_deltas;
+#endif // USING_PERFOSCOPE_TRACE
+  
+  // Frames are kept when popped so that begin does not allocate
+  std::vector<RegionFrame> m_regions;
+  int m_region_depth;
+#ifdef USING_PERFOSCOPE_HWC
+  std::vector<long long> m_region_offset;
+  std::vector<long long> m_region_values;
+  std::vector<long long> m_stop_values;
+#endif // USING_PERFOSCOPE_HWC
+};
+
+/**---------------------------------------------------------------------------*/
+
+inline void Perfoscope::accumulate(const int ci, const char *file, const int line) {
+#ifdef USING_PERFOSCOPE_TRACE
+  const perfoscope_internal::real_time_t trace_start = m_real_time;
+  trace_snapshot(ci);
+#endif // USING_PERFOSCOPE_TRACE
+  
+  long long *row = m_data->category_row(ci);
+  
+#ifdef USING_PERFOSCOPE_WCT
+  perfoscope_internal::real_time_t temp = perfoscope_internal::get_real_time();
+  const long long ticks = perfoscope_internal::elapsed_ticks(temp, m_real_time);
+  row[m_data->m_values_stride-1] += ticks;
+  m_real_time = temp;
+  m_data->record_flat_call(ci, ticks);
+#else // USING_PERFOSCOPE_WCT
+  m_data->record_flat_call(ci, 0);
+#endif // USING_PERFOSCOPE_WCT
+  
+#ifdef USING_PERFOSCOPE_HWC
+  if(m_region_depth > 0) {
+    save_region_counters(file, line);
+  }
+  int errcode = PAPI_accum(m_eventset, row);
+  PERFOSCOPE_CHECK(errcode == PAPI_OK, fail_papi(__PRETTY_FUNCTION__, 
+    "could not accumulate PAPI counters", errcode, file, line));
+#endif // USING_PERFOSCOPE_HWC
+  
+#ifdef USING_PERFOSCOPE_TRACE
+  trace_append(ci, trace_start);
+#endif // USING_PERFOSCOPE_TRACE
+}
+
+inline void Perfoscope::stop(const int ci, const char *file, const int line) {
+#ifdef USING_PERFOSCOPE_TRACE
+  const perfoscope_internal::real_time_t trace_start = m_real_time;
+  trace_snapshot(ci);
+#endif // USING_PERFOSCOPE_TRACE
+  
+  long long *row = m_data->category_row(ci);
+  
+#ifdef USING_PERFOSCOPE_WCT
+  perfoscope_internal::real_time_t temp = perfoscope_internal::get_real_time();
+  const long long ticks = perfoscope_internal::elapsed_ticks(temp, m_real_time);
+  row[m_data->m_values_stride-1] += ticks;
+  m_real_time = temp;
+  m_data->record_flat_call(ci, ticks);
+#else // USING_PERFOSCOPE_WCT
+  m_data->record_flat_call(ci, 0);
+#endif // USING_PERFOSCOPE_WCT
+  
+#ifdef USING_PERFOSCOPE_HWC
+  if(m_region_depth > 0) {
+    save_region_counters(file, line);
+  }
+  int errcode = PAPI_stop(m_eventset, row);
+  PERFOSCOPE_CHECK(errcode == PAPI_OK, fail_papi(__PRETTY_FUNCTION__, 
+    "could not stop PAPI counters", errcode, file, line));
+#endif // USING_PERFOSCOPE_HWC
+  
+#ifdef USING_PERFOSCOPE_TRACE
+  trace_append(ci, trace_start);
+#endif // USING_PERFOSCOPE_TRACE
+}
+
+inline void Perfoscope::stop(const char *file, const int line) {
+#ifdef USING_PERFOSCOPE_HWC
+  int errcode = PAPI_stop(m_eventset, m_stop_values.data());
+  PERFOSCOPE_CHECK(errcode == PAPI_OK, fail_papi(__PRETTY_FUNCTION__, 
+    "could not stop PAPI counters", errcode, file, line));
+#endif // USING_PERFOSCOPE_HWC
+}
+
+#ifdef USING_PERFOSCOPE_TRACE
+inline void Perfoscope::trace_snapshot(const int ci) {
+#ifdef USING_PERFOSCOPE_HWC
+  std::memcpy(m_trace_deltas.data(), m_data->category_values(ci), m_trace_deltas.size()*sizeof(long long));
+#endif // USING_PERFOSCOPE_HWC
+}
+
+inline void Perfoscope::trace_append(const int ci, const perfoscope_internal::real_time_t &start) {
+#ifdef USING_PERFOSCOPE_HWC
+  const long long *counter_values = m_data->category_values(ci);
+  const int nevents = m_trace_deltas.size();
+  for(int ei = 0; ei < nevents; ++ei) {
+    m_trace_deltas[ei] = counter_values[ei] - m_trace_deltas[ei];
+  }
+#endif // USING_PERFOSCOPE_HWC
+  if(m_trace == nullptr) {
+    return;
+  }
+  const long long timestamp = perfoscope_internal::nanoseconds(start);
+  m_trace->append(timestamp, perfoscope_internal::nanoseconds(m_real_time) - timestamp, 
+    ci, m_trace_deltas.data());
+}
+#endif // USING_PERFOSCOPE_TRACE
+
+inline void Perfoscope::begin(const int ci, const char *file, const int line) {
+  const int parent = (m_region_depth == 0 ? -1 : m_regions[m_region_depth-1].path);
+  if(PERFOSCOPE_UNLIKELY(m_region_depth == int(m_regions.size()))) {
+    m_regions.push_back(RegionFrame());
+#ifdef USING_PERFOSCOPE_HWC
+    const int nevents = m_data->events_count();
+    m_regions.back().start_values.resize(nevents);
+    m_regions.back().children_values.resize(nevents);
+    m_region_offset.resize(nevents, 0);
+    m_region_values.resize(nevents);
+#endif // USING_PERFOSCOPE_HWC
+  }
+  
+  RegionFrame &frame = m_regions[m_region_depth++];
+  frame.path = m_data->find_or_add_path(parent, ci);
+  
+#ifdef USING_PERFOSCOPE_SAMPLING
+  if(m_data->m_samples != nullptr) {
+    m_data->m_samples->active_category(ci);
+  }
+#endif // USING_PERFOSCOPE_SAMPLING
+  
+#ifdef USING_PERFOSCOPE_HWC
+  std::fill(frame.children_values.begin(), frame.children_values.end(), 0);
+  read_region_counters(frame.start_values.data(), file, line);
+#endif // USING_PERFOSCOPE_HWC
+  
+#ifdef USING_PERFOSCOPE_WCT
+  frame.children_time = 0;
+  frame.start_time = perfoscope_internal::get_real_time();
+#endif // USING_PERFOSCOPE_WCT
+}
+
+inline void Perfoscope::end(const char *file, const int line) {
+#ifdef USING_PERFOSCOPE_WCT
+  perfoscope_internal::real_time_t end_time = perfoscope_internal::get_real_time();
+#endif // USING_PERFOSCOPE_WCT
+  
+  PERFOSCOPE_CHECK(m_region_depth > 0, fail(__PRETTY_FUNCTION__, "no region to end", 1, file, line));
+  
+  RegionFrame &frame = m_regions[--m_region_depth];
+  RegionFrame *parent = (m_region_depth == 0 ? nullptr : &m_regions[m_region_depth-1]);
+  PerfoscopeData::PathData &path = m_data->m_path_data[frame.path];
+  path.count += 1;
+  
+#ifdef USING_PERFOSCOPE_SAMPLING
+  if(m_data->m_samples != nullptr) {
+    m_data->m_samples->active_category(parent == nullptr ? -1 : m_data->m_path_data[parent->path].category);
+  }
+#endif // USING_PERFOSCOPE_SAMPLING
+  
+#ifdef USING_PERFOSCOPE_WCT
+  const long long inclusive_time = perfoscope_internal::elapsed_ticks(end_time, frame.start_time);
+  path.inclusive_time += inclusive_time;
+  path.exclusive_time += inclusive_time - frame.children_time;
+  if(parent != nullptr) {
+    parent->children_time += inclusive_time;
+  }
+  m_data->record_call(path.category, inclusive_time);
+#else // USING_PERFOSCOPE_WCT
+  m_data->record_call(path.category, 0);
+#endif // USING_PERFOSCOPE_WCT
+  
+#ifdef USING_PERFOSCOPE_HWC
+  read_region_counters(m_region_values.data(), file, line);
+  const int nevents = m_region_values.size();
+  for(int ei = 0; ei < nevents; ++ei) {
+    const long long inclusive_value = m_region_values[ei] - frame.start_values[ei];
+    path.inclusive_values[ei] += inclusive_value;
+    path.exclusive_values[ei] += inclusive_value - frame.children_values[ei];
+    if(parent != nullptr) {
+      parent->children_values[ei] += inclusive_value;
+    }
+  }
+#endif // USING_PERFOSCOPE_HWC
+}
+
+#ifdef USING_PERFOSCOPE_HWC
+// Regions need counter values that only grow while they are open, 
+// m_region_offset holds what accumulate/stop/reset took off the counters.
+inline void Perfoscope::read_region_counters(long long *values, const char *file, const int line) {
+  int errcode = PAPI_read(m_eventset, values);
+  PERFOSCOPE_CHECK(errcode == PAPI_OK, fail_papi(__PRETTY_FUNCTION__, 
+    "could not read PAPI counters", errcode, file, line));
+  const int nevents = m_region_offset.size();
+  for(int ei = 0; ei < nevents; ++ei) {
+    values[ei] += m_region_offset[ei];
+  }
+}
+
+inline void Perfoscope::save_region_counters(const char *file, const int line) {
+  read_region_counters(m_region_values.data(), file, line);
+  m_region_offset.swap(m_region_values);
+}
+#endif // USING_PERFOSCOPE_HWC
+
+/**---------------------------------------------------------------------------*/
+
+// A named region registered at static initialization, converts to the index 
+// of its category so that it can be passed wherever a category index is 
+// expected, e.g. accumulate(solve_region). Declared with PERFOSCOPE_REGION.
+class PerfoscopeRegion {
+public:
+  PerfoscopeRegion(const char *name, unsigned long long hash) : 
+    m_id(PerfoscopeUtil::register_region(name, hash)) {}
+  
+  int id() const {
+    return m_id;
+  }
+  
+  operator int() const {
+    return PerfoscopeUtil::region_category(m_id);
+  }
+  
+private:
+  int m_id;
+};
+
+// PERFOSCOPE_REGION(solve_region, "solve") declares the region "solve", the 
+// hash of the name is computed at compile time.
+#ifndef NO_PERFOSCOPE
+#define PERFOSCOPE_REGION(var, name) \
+  static const PerfoscopeRegion var(name, \
+    std::integral_constant<unsigned long long, perfoscope_internal::fnv1a(name)>::value)
+#else // #ifndef NO_PERFOSCOPE
+#define PERFOSCOPE_REGION(var, name) static const int var = 0
+#endif // #ifndef NO_PERFOSCOPE
+
+/**---------------------------------------------------------------------------*/
+
+// Begins region ci on construction and ends it on destruction
+class PerfoscopeScope {
+public:
+  PerfoscopeScope(Perfoscope &pscope, const int ci) : 
+    m_pscope(pscope) {
+    m_pscope.begin(ci);
+  }
+  
+  ~PerfoscopeScope() {
+    m_pscope.end();
+  }
+  
+private:
+  PerfoscopeScope(const PerfoscopeScope &rhs) = delete;
+  PerfoscopeScope & operator=(const PerfoscopeScope &rhs) = delete;
+  
+private:
+  Perfoscope &m_pscope;
+};
+
+/**---------------------------------------------------------------------------*/
+
+// Per-thread Perfoscopes for applications that create their own threads 
+// (std::thread, pthreads). A thread is attached on its first call to 
+// current(), which clones the PerfoscopeData of the thread, registers the 
+// thread with PAPI and starts its counters. The threads are kept in a lock 
+// free list, a thread that exits stops and destroys its Perfoscope but its 
+// data stays in the list, so add_run_data collects the data of every thread 
+// that was ever attached. add_run_data and reset_counter_values read and 
+// write the data of other threads and must be called while they do not 
+// measure, finalize after all other attached threads have exited. A thread 
+// that is still attached at finalize frees its data when it exits.
+class PerfoscopeThreads {
+public:
+  static const PerfoscopeData& init(
+    const char *profile, 
+    const char *categories[], 
+    const int ncategories, 
+    const char *events[], 
+    const int nevents, 
+    const char *dbfilename = nullptr, 
+    const char *dbvfs = nullptr, 
+    const char *file = "\0", const int line = 0); // main, sync
+  
+  static void finalize(const char *file = "\0", const int line = 0); // main, sync
+  
+  static Perfoscope & current() {
+    Perfoscope *pscope = s_current;
+    if(PERFOSCOPE_UNLIKELY(pscope == nullptr)) {
+      pscope = attach();
+    }
+    return *pscope;
+  }
+  
+  static void add_run_data(const int problem_size = -1); // main, sync
+  
+  static void reset_counter_values(); // main
+  
+  static void mark_iteration(); // main
+  
+  static int threads_count() {
+    return s_nthreads.load(std::memory_order_acquire);
+  }
+  
+private:
+  // Whoever of detach and finalize comes second frees the node
+  enum NodeState {
+    NODE_ATTACHED, 
+    NODE_DETACHED, 
+    NODE_ORPHANED
+  };
+  
+  struct ThreadNode {
+    PerfoscopeData *data;
+    Perfoscope *pscope; // owned by the thread
+    std::atomic<int> state;
+    ThreadNode *next;
+  };
+  
+  // Detaches the thread when it exits
+  struct ThreadExit {
+    ~ThreadExit() {
+      detach();
+    }
+  };
+  
+  static Perfoscope * attach();
+  
+  static void detach();
+  
+  static std::vector<ThreadNode*> nodes();
+  
+private:
+  static const PerfoscopeData *s_template;
+  static std::atomic<ThreadNode*> s_threads;
+  static std::atomic<int> s_nthreads;
+  static thread_local Perfoscope *s_current;
+  static thread_local ThreadNode *s_node;
 };
 
+/**---------------------------------------------------------------------------*/
+
 #ifndef NO_PERFOSCOPE
 
 // OpenMP wrappers
@@ -462,8 +1861,10 @@ extern int all_pscope_data_count;
 Perfoscope *pscope;
 #pragma omp threadprivate(pscope)
 
-inline void perfoscope_init(char *profile_name, char *categories[], 
-int ncategories, char const *events[], int nevents) {
+// Every thread clones its PerfoscopeData and creates its Perfoscope, so that 
+// both are allocated and first touched on the NUMA node of the thread.
+inline void perfoscope_init(const char *profile_name, const char *categories[], 
+int ncategories, const char *events[], int nevents) {
   const PerfoscopeData & tmplt = PerfoscopeUtil::init(profile_name, categories, 
     ncategories, events, nevents);
   all_pscope_data_count = omp_get_max_threads();
@@ -489,8 +1890,17 @@ inline void perfoscope_accumulate_counters(int category_id) {
   pscope->accumulate(category_id);
 }
 
+inline void perfoscope_begin(int category_id) {
+  pscope->begin(category_id);
+}
+
+inline void perfoscope_end() {
+  pscope->end();
+}
+
 inline void perfoscope_add(int problem_size = -1) {
-  PerfoscopeUtil::add_run_data(all_pscope_data, all_pscope_data_count, problem_size);
+  PerfoscopeUtil::add_run_data(const_cast<const PerfoscopeData**>(all_pscope_data), 
+    all_pscope_data_count, problem_size);
 }
 
 inline void perfoscope_clear() {
@@ -500,6 +1910,13 @@ inline void perfoscope_clear() {
   }
 }
 
+inline void perfoscope_iteration() {
+  #pragma omp parallel
+  {
+    all_pscope_data[omp_get_thread_num()]->mark_iteration();
+  }
+}
+
 inline void perfoscope_finalize() {
   #pragma omp parallel
   {
@@ -511,6 +1928,47 @@ inline void perfoscope_finalize() {
   delete[] all_pscope_data;
 }
 
+#else // #ifdef _OPENMP
+
+// Wrappers for other threads, every thread that calls them is attached to 
+// PerfoscopeThreads
+inline void perfoscope_init(const char *profile_name, const char *categories[], 
+int ncategories, const char *events[], int nevents) {
+  PerfoscopeThreads::init(profile_name, categories, ncategories, events, nevents);
+}
+
+inline void perfoscope_reset_counters() {
+  PerfoscopeThreads::current().reset();
+}
+
+inline void perfoscope_accumulate_counters(int category_id) {
+  PerfoscopeThreads::current().accumulate(category_id);
+}
+
+inline void perfoscope_begin(int category_id) {
+  PerfoscopeThreads::current().begin(category_id);
+}
+
+inline void perfoscope_end() {
+  PerfoscopeThreads::current().end();
+}
+
+inline void perfoscope_add(int problem_size = -1) {
+  PerfoscopeThreads::add_run_data(problem_size);
+}
+
+inline void perfoscope_clear() {
+  PerfoscopeThreads::reset_counter_values();
+}
+
+inline void perfoscope_iteration() {
+  PerfoscopeThreads::mark_iteration();
+}
+
+inline void perfoscope_finalize() {
+  PerfoscopeThreads::finalize(__FILE__, __LINE__);
+}
+
 #endif // #ifdef _OPENMP
 
 #else // #ifndef NO_PERFOSCOPE
@@ -518,8 +1976,11 @@ inline void perfoscope_finalize() {
 #define perfoscope_init(profile_name, categories, ncategories, events, nevents)
 #define perfoscope_reset_counters()
 #define perfoscope_accumulate_counters(category_id)
+#define perfoscope_begin(category_id)
+#define perfoscope_end()
 #define perfoscope_add(problem_size)
 #define perfoscope_clear()
+#define perfoscope_iteration()
 #define perfoscope_finalize()
 
 #endif // #ifndef NO_PERFOSCOPE
@@ -528,6 +1989,12 @@ inline void perfoscope_finalize() {
 
 TextTable * create_texttable(const PerfoscopeData &data);
 
+TextTable * create_path_texttable(const PerfoscopeData &data);
+
+TextTable * create_call_texttable(const PerfoscopeData &data);
+
+TextTable * create_roofline_texttable(const PerfoscopeData &data);
+
 /**---------------------------------------------------------------------------*/
 
 #endif // #ifndef _PERFOSCOPE_HPP_
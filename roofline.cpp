@@ -0,0 +1,204 @@
+#include "roofline.hpp"
+
+#include <chrono>
+#include <vector>
+
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif // _OPENMP
+
+// Bytes every thread moves in one timed sample of the bandwidth kernel
+static const long long s_bytes_per_sample = 1LL << 28;
+static const long long s_flop_iterations = 1LL << 22;
+static const int s_samples = 5;
+static const long long s_max_bytes_per_thread = 1LL << 29;
+
+// Results of the kernels are summed here so that they are not optimized away
+static volatile double s_sink = 0.0;
+
+static double seconds_since(const std::chrono::steady_clock::time_point &start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static int threads_count() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else // _OPENMP
+  return 1;
+#endif // _OPENMP
+}
+
+static long long cache_size(int name, long long fallback) {
+  const long long size = sysconf(name);
+  return (size > 0 ? size : fallback);
+}
+
+const char * Roofline::level_name(const int li) {
+  static const char *names[MachinePeaks::nlevels] = {"L1", "L2", "L3", "memory"};
+  return names[li];
+}
+
+const char * Roofline::build() {
+  return
+#ifdef __clang__
+    "clang " __clang_version__
+#else // __clang__
+    "gcc " __VERSION__
+#endif // __clang__
+#ifdef __OPTIMIZE__
+    " -O"
+#else // __OPTIMIZE__
+    " -O0"
+#endif // __OPTIMIZE__
+#ifdef __AVX512F__
+    " avx512f"
+#endif // __AVX512F__
+#ifdef __AVX2__
+    " avx2"
+#endif // __AVX2__
+#ifdef __AVX__
+    " avx"
+#endif // __AVX__
+#ifdef __FMA__
+    " fma"
+#endif // __FMA__
+#ifdef __ARM_FEATURE_SVE
+    " sve"
+#endif // __ARM_FEATURE_SVE
+#ifdef __ARM_NEON
+    " neon"
+#endif // __ARM_NEON
+#ifdef _OPENMP
+    " openmp"
+#endif // _OPENMP
+    ;
+}
+
+void Roofline::characterize(MachinePeaks &peaks) {
+  char host[256] = {0};
+  gethostname(host, sizeof(host)-1);
+  peaks.host = host;
+  peaks.build = build();
+  peaks.nthreads = threads_count();
+  
+  const long long l1_size = cache_size(_SC_LEVEL1_DCACHE_SIZE, 32LL << 10);
+  const long long l2_size = cache_size(_SC_LEVEL2_CACHE_SIZE, 1LL << 20);
+  const long long l3_size = cache_size(_SC_LEVEL3_CACHE_SIZE, 32LL << 20);
+  const long long l3_share = l3_size/peaks.nthreads;
+  peaks.level_sizes[0] = l1_size/2;
+  peaks.level_sizes[1] = l2_size/2;
+  peaks.level_sizes[2] = (l3_share/2 > l2_size ? l3_share/2 : l2_size);
+  peaks.level_sizes[3] = (2*l3_share > 4*l2_size ? 2*l3_share : 4*l2_size);
+  if(peaks.level_sizes[3] > s_max_bytes_per_thread) {
+    peaks.level_sizes[3] = s_max_bytes_per_thread;
+  }
+  
+  for(int li = 0; li < MachinePeaks::nlevels; ++li) {
+    peaks.bandwidths[li] = measure_bandwidth(peaks.level_sizes[li]);
+  }
+  peaks.gflops = measure_gflops();
+}
+
+double Roofline::measure_bandwidth(long long bytes_per_thread) {
+  const long long n = (bytes_per_thread/(3*sizeof(double)) > 0 ? bytes_per_thread/(3*sizeof(double)) : 1);
+  const long long repetitions = (s_bytes_per_sample/(24*n) > 0 ? s_bytes_per_sample/(24*n) : 1);
+  const int nthreads = threads_count();
+  double best = 0.0;
+  double sink = 0.0;
+  
+  #pragma omp parallel reduction(+:sink)
+  {
+    // Allocated and first touched by the thread that uses it
+    std::vector<double> arrays(3*n, 1.0);
+    double *a = &arrays[0];
+    const double *b = a + n;
+    const double *c = b + n;
+    
+    for(int si = 0; si < s_samples; ++si) {
+      std::chrono::steady_clock::time_point start;
+      #pragma omp barrier
+      #pragma omp master
+      start = std::chrono::steady_clock::now();
+      for(long long ri = 0; ri < repetitions; ++ri) {
+        const double s = 1.0 + 1e-9*ri;
+        for(long long i = 0; i < n; ++i) {
+          a[i] = b[i] + s*c[i];
+        }
+      }
+      #pragma omp barrier
+      #pragma omp master
+      {
+        const double seconds = seconds_since(start);
+        const double bandwidth = 24.0*n*repetitions*nthreads/seconds*1e-9;
+        if(bandwidth > best) {
+          best = bandwidth;
+        }
+      }
+    }
+    sink += a[n/2];
+  }
+  s_sink = s_sink + sink;
+  
+  return best;
+}
+
+double Roofline::measure_gflops() {
+  const int nthreads = threads_count();
+  double best = 0.0;
+  double sink = 0.0;
+  
+  #pragma omp parallel reduction(+:sink)
+  {
+    double x[32];
+    for(int i = 0; i < 32; ++i) {
+      x[i] = 1.0 + 1e-3*i;
+    }
+    const double a = 0.9999999;
+    const double b = 1e-7;
+    
+    for(int si = 0; si < s_samples; ++si) {
+      std::chrono::steady_clock::time_point start;
+      #pragma omp barrier
+      #pragma omp master
+      start = std::chrono::steady_clock::now();
+      for(long long it = 0; it < s_flop_iterations; ++it) {
+        for(int i = 0; i < 32; ++i) {
+          x[i] = x[i]*a + b;
+        }
+      }
+      #pragma omp barrier
+      #pragma omp master
+      {
+        const double seconds = seconds_since(start);
+        const double gflops = 64.0*s_flop_iterations*nthreads/seconds*1e-9;
+        if(gflops > best) {
+          best = gflops;
+        }
+      }
+    }
+    for(int i = 0; i < 32; ++i) {
+      sink += x[i];
+    }
+  }
+  s_sink = s_sink + sink;
+  
+  return best;
+}
+
+double Roofline::bound(const MachinePeaks &peaks, double flop,
+    const double bytes[], int *limit) {
+  double attainable = peaks.gflops;
+  *limit = -1;
+  for(int li = 0; li < MachinePeaks::nlevels; ++li) {
+    if(bytes[li] > 0.0) {
+      const double level_bound = flop/bytes[li]*peaks.bandwidths[li];
+      if(level_bound < attainable) {
+        attainable = level_bound;
+        *limit = li;
+      }
+    }
+  }
+  return attainable;
+}
@@ -0,0 +1,61 @@
+#ifndef _PERFOSCOPE_ROOFLINE_HPP_
+#define _PERFOSCOPE_ROOFLINE_HPP_
+
+#include <string>
+
+/**---------------------------------------------------------------------------*/
+
+// Peaks of a machine measured by the characterization kernels with all
+// threads of a process. Level li is L1, L2, L3 or memory, level_sizes are the
+// bytes per thread the bandwidth kernel ran on. build is the Roofline::build
+// of the kernels that measured them.
+struct MachinePeaks {
+  static const int nlevels = 4;
+  
+  MachinePeaks() : nthreads(0), gflops(0.0) {
+    for(int li = 0; li < nlevels; ++li) {
+      level_sizes[li] = 0;
+      bandwidths[li] = 0.0;
+    }
+  }
+  
+  std::string host;
+  std::string build;
+  int nthreads;
+  double gflops;
+  long long level_sizes[nlevels];
+  double bandwidths[nlevels]; // GB/s
+};
+
+// Characterization kernels and the roofline model. The bandwidth kernel is
+// the STREAM triad a[i] = b[i] + s*c[i] over arrays of every thread that fill
+// half of a cache level (half of the share of a thread of the L3) or twice
+// the share of the L3 for memory, counting 24 bytes per iteration. The
+// peak FLOP kernel runs independent multiply-adds in registers. The kernels
+// run on the OpenMP threads if the library is built with OpenMP and report
+// the best of several repetitions.
+class Roofline {
+public:
+  static const char * level_name(const int li);
+  
+  // Compiler, optimization and instruction set extensions the kernels were 
+  // built with, peaks measured by other builds are not comparable
+  static const char * build();
+  
+  static void characterize(MachinePeaks &peaks);
+  
+  // GB/s of all threads with the arrays of a thread in bytes_per_thread
+  static double measure_bandwidth(long long bytes_per_thread);
+  
+  static double measure_gflops();
+  
+  // Attainable GFLOP/s of a code with flop floating point operations that
+  // moves bytes[li] bytes from level li (0 if unknown). limit is set to the
+  // level that bounds it, or -1 if the peak FLOP rate bounds it.
+  static double bound(const MachinePeaks &peaks, double flop,
+    const double bytes[], int *limit);
+};
+
+/**---------------------------------------------------------------------------*/
+
+#endif // #ifndef _PERFOSCOPE_ROOFLINE_HPP_
@@ -0,0 +1,201 @@
+#include "samplebuffer.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <execinfo.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// Buffer of the thread a SIGPROF is delivered to
+static thread_local SampleBuffer *t_sample_buffer = nullptr;
+
+// The handler is installed by the first buffer that starts, the action it 
+// replaced is installed again when the last of them is closed
+static pthread_mutex_t s_action_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int s_action_count = 0;
+static struct sigaction s_previous_action;
+
+int SampleBuffer::open(long long capacity, int max_frames) {
+  close();
+  
+  m_categories = static_cast<int*>(std::calloc(capacity, sizeof(int)));
+  m_nframes = static_cast<int*>(std::calloc(capacity, sizeof(int)));
+  m_frames = static_cast<void**>(std::calloc(capacity*max_frames, sizeof(void*)));
+  if(m_categories == nullptr || m_nframes == nullptr || m_frames == nullptr) {
+    close();
+    return ENOMEM;
+  }
+  m_capacity = capacity;
+  m_max_frames = max_frames;
+  m_head = 0;
+  m_dropped = 0;
+  
+  // backtrace is not async-signal-safe, the handler calls it anyway. Its 
+  // first call loads libgcc and allocates, which is what must not happen in 
+  // the handler, so it is made here; later calls only walk the stack.
+  void *frames[2];
+  backtrace(frames, 2);
+  
+  return 0;
+}
+
+void SampleBuffer::close() {
+  stop();
+  if(m_handler_installed) {
+    pthread_mutex_lock(&s_action_mutex);
+    if(--s_action_count == 0) {
+      sigaction(SIGPROF, &s_previous_action, nullptr);
+    }
+    pthread_mutex_unlock(&s_action_mutex);
+    m_handler_installed = false;
+  }
+  std::free(m_categories);
+  std::free(m_nframes);
+  std::free(m_frames);
+  m_categories = nullptr;
+  m_nframes = nullptr;
+  m_frames = nullptr;
+  m_capacity = 0;
+}
+
+int SampleBuffer::start(long long interval_us) {
+  if(!m_handler_installed) {
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_sigaction = handle_signal;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    int errcode = 0;
+    pthread_mutex_lock(&s_action_mutex);
+    if(s_action_count == 0 && sigaction(SIGPROF, &action, &s_previous_action) != 0) {
+      errcode = errno;
+    } else {
+      ++s_action_count;
+    }
+    pthread_mutex_unlock(&s_action_mutex);
+    if(errcode != 0) {
+      return errcode;
+    }
+    m_handler_installed = true;
+  }
+  
+  t_sample_buffer = this;
+  
+  // The timer runs on the CPU time of the thread and signals only the thread
+  struct sigevent event;
+  std::memset(&event, 0, sizeof(event));
+  event.sigev_notify = SIGEV_THREAD_ID;
+  event.sigev_signo = SIGPROF;
+  event.sigev_notify_thread_id = syscall(SYS_gettid);
+  if(timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &m_timer) != 0) {
+    return errno;
+  }
+  m_timer_created = true;
+  
+  int errcode = arm_timer(interval_us);
+  if(errcode != 0) {
+    stop();
+    return errcode;
+  }
+  m_interval_us = interval_us;
+  
+  return 0;
+}
+
+// An interval of 0 disarms the timer
+int SampleBuffer::arm_timer(long long interval_us) {
+  struct itimerspec spec;
+  spec.it_interval.tv_sec = interval_us/1000000;
+  spec.it_interval.tv_nsec = (interval_us%1000000)*1000;
+  spec.it_value = spec.it_interval;
+  return (timer_settime(m_timer, 0, &spec, nullptr) != 0 ? errno : 0);
+}
+
+void SampleBuffer::clear() {
+  sigset_t profset, oldset;
+  sigemptyset(&profset);
+  sigaddset(&profset, SIGPROF);
+  const bool own_thread = (t_sample_buffer == this);
+  if(own_thread) {
+    pthread_sigmask(SIG_BLOCK, &profset, &oldset);
+  }
+  if(m_timer_created) {
+    arm_timer(0);
+  }
+  
+  __atomic_store_n(&m_head, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&m_dropped, 0, __ATOMIC_RELAXED);
+  
+  if(m_timer_created) {
+    arm_timer(m_interval_us);
+  }
+  if(own_thread) {
+    pthread_sigmask(SIG_SETMASK, &oldset, nullptr);
+  }
+}
+
+void SampleBuffer::stop() {
+  if(m_timer_created) {
+    timer_delete(m_timer);
+    m_timer_created = false;
+  }
+  if(t_sample_buffer == this) {
+    t_sample_buffer = nullptr;
+  }
+}
+
+void SampleBuffer::handle_signal(int signum, siginfo_t *info, void *context) {
+  SampleBuffer *buffer = t_sample_buffer;
+  if(buffer != nullptr) {
+    void *ip = nullptr;
+#if defined(__x86_64__)
+    ip = reinterpret_cast<void*>(static_cast<ucontext_t*>(context)->uc_mcontext.gregs[REG_RIP]);
+#elif defined(__aarch64__)
+    ip = reinterpret_cast<void*>(static_cast<ucontext_t*>(context)->uc_mcontext.pc);
+#endif
+    const int saved_errno = errno;
+    buffer->record(ip);
+    errno = saved_errno;
+  }
+}
+
+void SampleBuffer::record(void *ip) {
+  const long long head = __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+  if(head >= m_capacity) {
+    ++m_dropped;
+    return;
+  }
+  
+  // The backtrace starts in the handler, the frames before the interrupted
+  // instruction pointer are skipped
+  void **frames = m_frames + head*m_max_frames;
+  void *trace[64];
+  const int max_trace = (m_max_frames + 3 < 64 ? m_max_frames + 3 : 64);
+  const int ntrace = backtrace(trace, max_trace);
+  int first = 0;
+  while(first < ntrace && trace[first] != ip) {
+    ++first;
+  }
+  
+  int nframes = 0;
+  if(ip != nullptr) {
+    frames[nframes++] = ip;
+  }
+  for(int ti = first+1; ti < ntrace && nframes < m_max_frames; ++ti) {
+    frames[nframes++] = trace[ti];
+  }
+  
+  m_categories[head] = m_active_category;
+  m_nframes[head] = nframes;
+  // Fails if the buffer was cleared by another thread meanwhile
+  long long expected = head;
+  __atomic_compare_exchange_n(&m_head, &expected, head+1, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
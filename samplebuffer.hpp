@@ -0,0 +1,102 @@
+#ifndef _PERFOSCOPE_SAMPLEBUFFER_HPP_
+#define _PERFOSCOPE_SAMPLEBUFFER_HPP_
+
+#include <csignal>
+#include <ctime>
+
+/**---------------------------------------------------------------------------*/
+
+// Samples of one thread taken by a SIGPROF timer on the CPU time of the
+// thread. A sample holds the active category of the thread and up to
+// max_frames instruction pointers, the interrupted one first. The memory is
+// allocated when the buffer is opened, so the signal handler only writes to
+// it; samples that do not fit are counted as dropped.
+class SampleBuffer {
+public:
+  SampleBuffer() :
+    m_capacity(0),
+    m_max_frames(0),
+    m_head(0),
+    m_dropped(0),
+    m_active_category(-1),
+    m_categories(nullptr),
+    m_nframes(nullptr),
+    m_frames(nullptr),
+    m_interval_us(0),
+    m_timer_created(false),
+    m_handler_installed(false)
+  {}
+  
+  ~SampleBuffer() {
+    close();
+  }
+  
+  int open(long long capacity, int max_frames);
+  
+  // Stops the timer and restores the SIGPROF action the application had 
+  // when the first buffer started, once all started buffers are closed
+  void close();
+  
+  // Starts the timer of the calling thread, which must be the thread the
+  // buffer belongs to, and installs the SIGPROF handler
+  int start(long long interval_us);
+  
+  void stop();
+  
+  // Drops all samples, the timer is disarmed meanwhile and SIGPROF is 
+  // blocked if the calling thread is the thread of the buffer. A sample 
+  // taken before the clear that ends after it is dropped.
+  void clear();
+  
+  void active_category(int ci) {
+    m_active_category = ci;
+  }
+  
+  long long count() const {
+    return __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+  }
+  
+  long long dropped() const {
+    return m_dropped;
+  }
+  
+  int category(long long si) const {
+    return m_categories[si];
+  }
+  
+  int frames_count(long long si) const {
+    return m_nframes[si];
+  }
+  
+  void * const * frames(long long si) const {
+    return m_frames + si*m_max_frames;
+  }
+  
+private:
+  SampleBuffer(const SampleBuffer &rhs) = delete;
+  SampleBuffer & operator=(const SampleBuffer &rhs) = delete;
+  
+  static void handle_signal(int signum, siginfo_t *info, void *context);
+  
+  int arm_timer(long long interval_us);
+  
+  void record(void *ip);
+  
+private:
+  long long m_capacity;
+  int m_max_frames;
+  long long m_head;
+  long long m_dropped;
+  volatile sig_atomic_t m_active_category;
+  int *m_categories;
+  int *m_nframes;
+  void **m_frames;
+  timer_t m_timer;
+  long long m_interval_us;
+  bool m_timer_created;
+  bool m_handler_installed;
+};
+
+/**---------------------------------------------------------------------------*/
+
+#endif // #ifndef _PERFOSCOPE_SAMPLEBUFFER_HPP_
@@ -0,0 +1,85 @@
+#include "tracebuffer.hpp"
+
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+int TraceBuffer::open(
+    const char *filename, 
+    int proc_id, 
+    int thread_id, 
+    const std::string &profile_name, 
+    const std::vector<std::string> &category_names, 
+    const std::vector<std::string> &event_names, 
+    long long capacity) {
+  close();
+  
+  // Capacity is rounded up to a power of two so that a slot is found by masking
+  long long rounded_capacity = 1;
+  while(rounded_capacity < capacity) {
+    rounded_capacity <<= 1;
+  }
+  
+  std::string names = profile_name + '\0';
+  for(size_t ci = 0; ci < category_names.size(); ++ci) {
+    names += category_names[ci] + '\0';
+  }
+  for(size_t ei = 0; ei < event_names.size(); ++ei) {
+    names += event_names[ei] + '\0';
+  }
+  
+  const int nevents = event_names.size();
+  const int record_size = sizeof(TraceRecord) + nevents*sizeof(long long);
+  const long long records_offset = ((sizeof(TraceFileHeader) + names.size() + 63)/64)*64;
+  const size_t size = records_offset + rounded_capacity*record_size;
+  
+  int fd = ::open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0) {
+    return errno;
+  }
+  if(ftruncate(fd, size) != 0) {
+    int errcode = errno;
+    ::close(fd);
+    return errcode;
+  }
+  
+  void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+  int errcode = errno;
+  ::close(fd);
+  if(addr == MAP_FAILED) {
+    return errcode;
+  }
+  
+  m_size = size;
+  m_header = static_cast<TraceFileHeader*>(addr);
+  m_records = static_cast<char*>(addr) + records_offset;
+  m_mask = rounded_capacity-1;
+  m_record_size = record_size;
+  m_nevents = nevents;
+  
+  std::memcpy(m_header->magic, magic(), sizeof(m_header->magic));
+  m_header->version = version;
+  m_header->proc_id = proc_id;
+  m_header->thread_id = thread_id;
+  m_header->ncategories = category_names.size();
+  m_header->nevents = nevents;
+  m_header->record_size = record_size;
+  m_header->names_size = names.size();
+  m_header->records_offset = records_offset;
+  m_header->capacity = rounded_capacity;
+  m_header->head = 0;
+  std::memcpy(reinterpret_cast<char*>(m_header) + sizeof(TraceFileHeader), names.data(), names.size());
+  
+  return 0;
+}
+
+void TraceBuffer::close() {
+  if(m_header != nullptr) {
+    munmap(m_header, m_size);
+    m_header = nullptr;
+    m_records = nullptr;
+    m_size = 0;
+  }
+}
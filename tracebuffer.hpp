@@ -0,0 +1,115 @@
+#ifndef _PERFOSCOPE_TRACEBUFFER_HPP_
+#define _PERFOSCOPE_TRACEBUFFER_HPP_
+
+#include <string>
+#include <vector>
+#include <cstring>
+
+/**---------------------------------------------------------------------------*/
+
+// Layout of a trace file:
+//   TraceFileHeader
+//   names_size bytes of names, the profile name, ncategories category names
+//   and nevents event names, each '\0' terminated
+//   capacity records of record_size bytes at records_offset, each record is a
+//   TraceRecord followed by nevents counter deltas (long long)
+// Record i is stored in slot i%capacity, head is the number of records ever
+// appended, so the file holds the last min(head, capacity) records.
+
+struct TraceFileHeader {
+  char magic[8];
+  int version;
+  int proc_id;
+  int thread_id;
+  int ncategories;
+  int nevents;
+  int record_size;
+  long long names_size;
+  long long records_offset;
+  long long capacity;
+  long long head;
+};
+
+struct TraceRecord {
+  long long timestamp; // ns
+  long long duration; // ns
+  int category;
+  int reserved;
+};
+
+/**---------------------------------------------------------------------------*/
+
+// Ring buffer of trace records backed by a memory-mapped file. There is
+// exactly one writer per buffer (its thread), so append neither locks nor
+// makes a syscall, the pages are populated when the buffer is opened.
+class TraceBuffer {
+public:
+  static const char * magic() {
+    return "PSCTRACE";
+  }
+  
+  static const int version = 1;
+  
+  TraceBuffer() :
+    m_header(nullptr), 
+    m_records(nullptr), 
+    m_size(0), 
+    m_mask(0), 
+    m_record_size(0), 
+    m_nevents(0)
+  {}
+  
+  ~TraceBuffer() {
+    close();
+  }
+  
+  int open(
+    const char *filename, 
+    int proc_id, 
+    int thread_id, 
+    const std::string &profile_name, 
+    const std::vector<std::string> &category_names, 
+    const std::vector<std::string> &event_names, 
+    long long capacity
+  );
+  
+  void close();
+  
+  bool is_open() const {
+    return m_header != nullptr;
+  }
+  
+  // Drops all records
+  void clear() {
+    __atomic_store_n(&m_header->head, 0, __ATOMIC_RELEASE);
+  }
+  
+  void append(long long timestamp, long long duration, int category, const long long *deltas) {
+    const long long head = m_header->head;
+    char *slot = m_records + (head & m_mask)*m_record_size;
+    TraceRecord *record = reinterpret_cast<TraceRecord*>(slot);
+    record->timestamp = timestamp;
+    record->duration = duration;
+    record->category = category;
+    if(m_nevents > 0) {
+      std::memcpy(slot + sizeof(TraceRecord), deltas, m_nevents*sizeof(long long));
+    }
+    __atomic_store_n(&m_header->head, head+1, __ATOMIC_RELEASE);
+  }
+  
+private:
+  TraceBuffer(const TraceBuffer &rhs) = delete;
+  TraceBuffer & operator=(const TraceBuffer &rhs) = delete;
+  
+private:
+  TraceFileHeader *m_header;
+  char *m_records;
+  size_t m_size;
+  long long m_mask;
+  int m_record_size;
+  int m_nevents;
+};
+
+/**---------------------------------------------------------------------------*/
+
+#endif // #ifndef _PERFOSCOPE_TRACEBUFFER_HPP_